@@ -0,0 +1,100 @@
+#ifndef BACKOFF__H
+#define BACKOFF__H
+
+#include <SDKDDKVer.h>
+#include <Windows.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// What a CAS retry loop does after losing a race, before it tries again.
+typedef enum backoff_policy
+{
+	// retry straight away
+	BACKOFF_NONE,
+	// spin for a randomised, doubling number of pauses
+	BACKOFF_EXPONENTIAL,
+	// spin for a number of pauses proportional to a running estimate of how
+	// many threads are contending on the container
+	BACKOFF_PROPORTIONAL,
+	// give up the rest of the timeslice
+	BACKOFF_YIELD
+} backoff_policy_t;
+
+// Per-container policy and statistics. Containers embed one of these and
+// hand it to each retry loop. The statistics are only touched by operations
+// that lost at least one race, so uncontended operations don't pay for them.
+typedef struct contention
+{
+	volatile LONG policy;
+	// the proportional policy's estimate of the number of contending threads;
+	// like the statistics, only operations that had to retry update it
+	volatile LONG level;
+	// operations that had to retry, the retries, and the pauses spent backing off
+	volatile LONG64 contended_operations;
+	volatile LONG64 retries;
+	volatile LONG64 pauses;
+} contention_t;
+
+typedef struct contention_stats
+{
+	LONG64 contended_operations;
+	LONG64 retries;
+	LONG64 pauses;
+} contention_stats_t;
+
+void contention_init(contention_t* c, backoff_policy_t policy);
+void contention_set_policy(contention_t* c, backoff_policy_t policy);
+backoff_policy_t contention_get_policy(const contention_t* c);
+void contention_get_stats(const contention_t* c, contention_stats_t* stats);
+void contention_reset_stats(contention_t* c);
+
+// The state of one operation's retry loop; lives on the stack.
+typedef struct backoff
+{
+	contention_t* contention;
+	ULONG failures;
+	ULONG pauses;
+} backoff_t;
+
+void backoff_init(backoff_t* b, contention_t* c);
+// call after each lost CAS
+void backoff_failed(backoff_t* b);
+// call once the operation has finished, whether it retried or not
+void backoff_done(backoff_t* b);
+
+#ifdef __cplusplus
+}
+
+// finishes the loop's accounting however the function leaves it
+struct backoff_guard {
+	explicit backoff_guard(contention_t* c) {
+		::backoff_init(&b, c);
+	}
+
+	~backoff_guard() {
+		::backoff_done(&b);
+	}
+
+	void failed() {
+		::backoff_failed(&b);
+	}
+
+private:
+	backoff_guard(const backoff_guard&);
+	backoff_guard& operator=(const backoff_guard&);
+
+	backoff_t b;
+};
+#endif
+
+#endif
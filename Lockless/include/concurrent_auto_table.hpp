@@ -2,10 +2,10 @@
 #define CONCURRENT_AUTO_TABLE__HPP
 
 #include "smr.hpp"
+#include "backoff.h"
 
 #include <limits>
 #include <new>
-#include <ctime>
 #include <unordered_map>
 #include <atomic>
 
@@ -16,7 +16,8 @@ struct array : smr::smr_destructible, boost::noncopyable {
 	typedef std::atomic<T> element_type;
 	typedef array<T> array_type;
 
-	array(size_t length_) : length(length_), values(new (smr::smr) element_type[length]) {
+	// zeroed, so that a stripe nobody has touched yet counts for nothing
+	array(size_t length_) : length(length_), values(new (smr::smr) element_type[length]()) {
 	}
 
 	static bool finalize(void*, void* ptr) {
@@ -49,6 +50,133 @@ protected:
 	}
 };
 
+// Which stripe of a table a thread updates. Each thread is given a sequence
+// number the first time it touches any table, and uses that rather than a hash
+// of its thread ID, so the first n threads are guaranteed distinct stripes in
+// any table that has at least n. A thread that keeps losing the CAS on its
+// stripe anyway moves to a pseudo-random one.
+struct cat_probe {
+	static cat_probe& current() {
+		static thread_local cat_probe probe(next_sequence());
+		return probe;
+	}
+
+	size_t stripe() const {
+		return probe;
+	}
+
+	void succeeded() {
+		if(collisions != 0) {
+			collisions = 0;
+		}
+	}
+
+	void collided() {
+		if(++collisions < max_collisions) {
+			return;
+		}
+		collisions = 0;
+		// xorshift never gets to zero, and threads that collided go separate ways
+		probe ^= probe << 13;
+		probe ^= probe >> 17;
+		probe ^= probe <<  5;
+	}
+
+private:
+	explicit cat_probe(ULONG sequence) : probe(sequence), collisions(0) {
+	}
+
+	static ULONG next_sequence() {
+		static std::atomic<ULONG> sequence(0);
+		return ++sequence;
+	}
+
+	// how many CASes in a row a thread can lose before it moves
+	static const ULONG max_collisions = 2;
+
+	ULONG probe;
+	ULONG collisions;
+};
+
+// Picks the stripe of the processor the thread is running on, rather than one
+// that belongs to the thread, so a table needs only as many stripes as there
+// are processors however many threads there are, and a stripe's cache line
+// stays with its processor. Two threads only meet on a stripe when one is
+// preempted or migrated between reading the processor number and its CAS, so
+// the CAS nearly always works first time; it can't be dropped, though, as
+// Windows has nothing like Linux's restartable sequences to abort a plain
+// store when that happens.
+struct cat_cpu_probe {
+	static cat_cpu_probe& current() {
+		static cat_cpu_probe probe;
+		return probe;
+	}
+
+	size_t stripe() const {
+		::PROCESSOR_NUMBER pn;
+		::GetCurrentProcessorNumberEx(&pn);
+		return (static_cast<size_t>(pn.Group) << 6) + pn.Number;
+	}
+
+	// the next add will look up the processor again anyway
+	void succeeded() {
+	}
+
+	void collided() {
+	}
+};
+
+// How a table spaces its stripes out. The packed layout puts them four slots
+// apart, so two 8-byte stripes (or four 4-byte ones) share each cache line;
+// the padded layouts give each stripe a cache line to itself, or a 128-byte
+// pair of them for CPUs whose adjacent-line prefetcher fetches lines two at a
+// time. Padding costs memory in proportion, and a longer walk for get().
+struct cat_packed_layout {
+	template<typename T>
+	struct stride {
+		static const size_t value = 4;
+	};
+};
+
+struct cat_padded_layout {
+	template<typename T>
+	struct stride {
+		static const size_t value = CACHE_LINE / sizeof(T);
+	};
+};
+
+struct cat_pair_padded_layout {
+	template<typename T>
+	struct stride {
+		static const size_t value = 2 * CACHE_LINE / sizeof(T);
+	};
+};
+
+// Wall-clock nanoseconds from the performance counter, which is monotonic and,
+// on anything with an invariant TSC, not much dearer than reading it.
+// std::clock() measures the process's CPU time on some platforms, so it raced
+// ahead when many threads were busy and stood still when they were idle.
+struct cat_clock {
+	static ULONGLONG now() {
+		static const LONGLONG frequency = query_frequency();
+		LARGE_INTEGER ticks;
+		::QueryPerformanceCounter(&ticks);
+		// split up so that ticks * 10^9 can't overflow
+		const ULONGLONG seconds = static_cast<ULONGLONG>(ticks.QuadPart / frequency);
+		const ULONGLONG remainder = static_cast<ULONGLONG>(ticks.QuadPart % frequency);
+		return seconds * nanoseconds_per_second + remainder * nanoseconds_per_second / frequency;
+	}
+
+	static const ULONGLONG nanoseconds_per_second = 1000000000ULL;
+
+private:
+	static LONGLONG query_frequency() {
+		LARGE_INTEGER frequency;
+		::QueryPerformanceFrequency(&frequency);
+		return frequency.QuadPart;
+	}
+};
+
 // http://high-scale-lib.cvs.sourceforge.net/viewvc/high-scale-lib/high-scale-lib/org/cliffc/high_scale_lib/
 
 // An auto-resizing table of integer_types, supporting low-contention CAS
@@ -58,17 +186,40 @@ protected:
 // otherwise happen at such a high volume that the cache contention for
 // CAS'ing a single word is unacceptable.
 // 
-// This API is overkill for simple counters (e.g. no need for the 'mask')
-// and is untested as an API for making a scalable r/w lock and so is likely
-// to change!
-template<typename T>
+// This API is overkill for simple counters (e.g. no need for the 'mask').
+// concurrent_rw_lock is built on the masked operations; a table used that way
+// has to be sized up front and left alone by get(), set() and consolidate(),
+// since a fresh table wouldn't have the mask bits set.
+//
+// Probe picks which stripe an add goes to: cat_probe for one per thread,
+// cat_cpu_probe for one per processor.
+template<typename T, typename Layout = cat_packed_layout, typename Probe = cat_probe>
 struct concurrent_auto_table : smr::smr_destructible, boost::noncopyable {
 	typedef T integer_type;
-	typedef concurrent_auto_table<integer_type> table_type;
-	typedef std::hash<integer_type> hash_type;
+	typedef Layout layout_type;
+	typedef Probe probe_type;
+	typedef concurrent_auto_table<integer_type, layout_type, probe_type> table_type;
 	typedef array<integer_type> array_type;
 
-	concurrent_auto_table() : _cat(new (smr::smr) CAT(nullptr, 4, integer_type())){
+	// slots from one stripe to the next; only the first of each is ever used
+	static const size_t stride = layout_type::template stride<integer_type>::value;
+
+	// how out of date estimate_get() can be unless told otherwise: a millisecond
+	static const ULONGLONG default_max_staleness = cat_clock::nanoseconds_per_second / 1000;
+
+	concurrent_auto_table() : _cat(new (smr::smr) CAT(nullptr, stride, integer_type())), _consolidating(false), _consolidations(0), _max_staleness(default_max_staleness) {
+		contention_init(&_contention, BACKOFF_NONE);
+	}
+
+	// starts out with room for at least the given number of stripes
+	explicit concurrent_auto_table(size_t stripes) : _cat(new (smr::smr) CAT(nullptr, round_up(stripes) * stride, integer_type())), _consolidating(false), _consolidations(0), _max_staleness(default_max_staleness) {
+		contention_init(&_contention, BACKOFF_NONE);
+	}
+
+	// the table's backoff policy and retry statistics. Only updates that lose
+	// their first CAS on a stripe go through it.
+	contention_t* contention() {
+		return &_contention;
 	}
 
 	virtual smr::smr_destructible::finalizer_function_t get_finalizer() const {
@@ -102,7 +253,7 @@ struct concurrent_auto_table : smr::smr_destructible, boost::noncopyable {
 	// Atomically set the sum of the striped counters to specified value.
 	// Rather more expensive than a simple store, in order to remain atomic.
 	void set(integer_type x) {
-		CAT* newcat = new (smr::smr) CAT(nullptr, 4, x);
+		CAT* newcat = new (smr::smr) CAT(nullptr, stride, x);
 
 		smr::hazard_pointers<1> hazards;
 
@@ -110,6 +261,7 @@ struct concurrent_auto_table : smr::smr_destructible, boost::noncopyable {
 		for(;;) {
 			cat = _cat.load();
 			hazards[0] = cat;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
 			if(cat != _cat.load()) {
 				continue;
 			}
@@ -125,34 +277,137 @@ struct concurrent_auto_table : smr::smr_destructible, boost::noncopyable {
 	// Current value of the counter. Since other threads are updating furiously
 	// the value is only approximate, but it includes all counts made by the
 	// current thread. Requires a pass over the internally striped counters.
+	// Folds away old tables first, so the pass only covers the current one.
+	// A consolidation running alongside the pass moves counts from tables it
+	// hasn't reached into ones it already has, so the pass waits for one that's
+	// under way and starts again if another began while it was walking.
 	integer_type get() const {
+		const_cast<table_type*>(this)->consolidate(); // doesn't change the value
+		for(;;) {
+			const size_t consolidations = _consolidations.load();
+			if(_consolidating.load()) {
+				YieldProcessor();
+				continue;
+			}
+			const integer_type total = sum(integer_type());
+			if(!_consolidating.load() && consolidations == _consolidations.load()) {
+				return total;
+			}
+		}
+	}
+
+	// Every resize leaves the old table chained behind the new one, and the
+	// table never gets smaller by itself, so after a burst of contention get()
+	// has to walk tables that nobody writes to any more. This moves their
+	// counts into a single fresh table and drops the rest; if nobody has
+	// collided on the current table for decay_interval, the fresh one is half
+	// the size. get() calls it, but a thread that only ever increments can call
+	// it now and then instead. It gives up straight away if another thread is
+	// already consolidating.
+	void consolidate() {
+		smr::hazard_pointers<2> hazards;
+
+		CAT* cat = nullptr;
+		for(;;) {
+			cat = _cat.load();
+			hazards[0] = cat;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(cat == _cat.load()) {
+				break;
+			}
+		}
+		const size_t length = cat->length();
+		const bool shrink = length > stride && cat->quiet();
+		if(cat->_next.load() == nullptr && !shrink) {
+			return;
+		}
+		if(_consolidating.load() || _consolidating.exchange(true)) {
+			return;
+		}
+		CAT* newcat = new (smr::smr) CAT(cat, shrink ? length / 2 : length, integer_type());
+		hazards[1] = newcat; // a concurrent set() could retire it while we work
+		if(CAS_cat(cat, newcat)) {
+			// Only consolidation ever unlinks a table, so the chain under cat
+			// stays put while we drain it.
+			for(CAT* c = cat; c != nullptr; c = c->_next.load()) {
+				c->drain(newcat);
+			}
+			newcat->_next.store(nullptr);
+			smr::smr_destroy(cat);
+		} else {
+			newcat->_next.store(nullptr);
+			smr::smr_destroy(newcat);
+		}
+		_consolidations.fetch_add(1);
+		_consolidating.store(false);
+	}
+
+	// Add x to the given stripe's slot if the bits under mask are all zero
+	// there, retrying the CAS until it works or they aren't, and return the
+	// slot's old value. Unlike add(), it never moves to another stripe or
+	// grows the table, so a caller can come back to the same slot later.
+	integer_type add_to_stripe_if_mask(size_t stripe, integer_type x, integer_type mask) {
 		smr::hazard_pointers<1> hazards;
 
 		CAT* cat = nullptr;
 		for(;;) {
 			cat = _cat.load();
 			hazards[0] = cat;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
 			if(cat == _cat.load()) {
 				break;
 			}
 		}
-		return cat->sum(integer_type());
+		return cat->add_to_stripe_if_mask(stripe, x, mask);
+	}
+
+	// OR / AND every slot in every table with mask
+	void all_or(integer_type mask) {
+		for_each_table([mask](CAT* cat) { cat->all_or(mask); });
 	}
 
-	// A cheaper {@link #get}. Updated only once/millisecond, but as fast as a
-	// simple load instruction when not updating.
+	void all_and(integer_type mask) {
+		for_each_table([mask](CAT* cat) { cat->all_and(mask); });
+	}
+
+	// The sum with the bits under mask stripped off each slot first. It's
+	// never cached, so it's suitable for waiting on, and it doesn't
+	// consolidate.
+	integer_type get_masked(integer_type mask) const {
+		return sum(mask);
+	}
+
+	// A cheaper {@link #get}. Updated at most once per max_staleness(), but
+	// little more than a clock read and a load when not updating.
 	integer_type estimate_get() const {
+		return get_with_staleness(_max_staleness.load(std::memory_order_relaxed));
+	}
+
+	// estimate_get() for a caller with its own idea of how stale is too stale.
+	// The sum it returns was taken no more than max_staleness nanoseconds ago;
+	// zero always sums afresh.
+	integer_type get_with_staleness(ULONGLONG max_staleness) const {
 		smr::hazard_pointers<1> hazards;
 
 		CAT* cat = nullptr;
 		for(;;) {
 			cat = _cat.load();
 			hazards[0] = cat;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
 			if(cat == _cat.load()) {
 				break;
 			}
 		}
-		return cat->estimate_sum(integer_type());
+		return cat->estimate_sum(integer_type(), this, max_staleness);
+	}
+
+	ULONGLONG max_staleness() const {
+		return _max_staleness.load(std::memory_order_relaxed);
+	}
+
+	// in nanoseconds
+	void set_max_staleness(ULONGLONG max_staleness) {
+		_max_staleness.store(max_staleness, std::memory_order_relaxed);
 	}
 
 protected:
@@ -161,9 +416,13 @@ protected:
 	}
 
 private:
+	// How long a table has to go without a collision before consolidate()
+	// halves it.
+	static const ULONGLONG decay_interval = cat_clock::nanoseconds_per_second;
+
 	friend struct CAT;
 	struct CAT : smr::smr_destructible, boost::noncopyable {
-		CAT(CAT* next, size_t sz, integer_type init) : _next(next), _t(new (smr::smr) array_type(sz)), _sum_cache(std::numeric_limits<integer_type>::min()) {
+		CAT(CAT* next, size_t sz, integer_type init) : _next(next), _sum_cache(std::numeric_limits<integer_type>::min()), _fuzzy_sum_cache(), _fuzzy_time(0), _resizers(0), _draining(false), _collided(false), _since(cat_clock::now()), _t(new (smr::smr) array_type(sz)) {
 			_t.load()->values[0] = init;
 		}
 
@@ -178,11 +437,10 @@ private:
 			return false;
 		}
 
-		// Only add 'x' to some slot in table, hinted at by 'hash', if bits under
-		// the mask are all zero. The sum can overflow or 'x' can contain bits in
-		// the mask. Value is CAS'd so no counts are lost. The CAS is attempted
-		// ONCE.
-		integer_type add_if_mask(integer_type x, integer_type mask, size_t hash, concurrent_auto_table* master) {
+		// Only add 'x' to the probe's slot in table, if bits under the mask are
+		// all zero. The sum can overflow or 'x' can contain bits in the mask.
+		// Value is CAS'd so no counts are lost. The CAS is attempted ONCE.
+		integer_type add_if_mask(integer_type x, integer_type mask, probe_type& probe, concurrent_auto_table* master) {
 			smr::hazard_pointers<1> hazards;
 
 			array_type* t = nullptr;
@@ -190,11 +448,12 @@ private:
 			for(;;) {
 				t = _t.load();
 				hazards[0] = t;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
 				if(t == _t.load()) {
 					break;
 				}
 			}
-			size_t idx = hash & (t->length - 1);
+			size_t idx = (probe.stripe() * stride) & (t->length - 1);
 			// Peel loop; try once fast
 			integer_type old = t->values[idx].load();
 			bool ok = CAS(t->values, idx, old & ~mask, old + x);
@@ -202,17 +461,26 @@ private:
 				_sum_cache = std::numeric_limits<integer_type>::min(); // Blow out cache
 			}
 			if(ok) {
+				probe.succeeded();
+				reclaim(t, idx, master);
 				return old; // Got it
 			}
 			if((old & mask) != 0) {
 				return old; // Failed for bit-set under mask
 			}
+			probe.collided();
+			if(!_collided.load()) {
+				_collided.store(true);
+			}
 			// Try harder
+			backoff_guard backoff(&master->_contention);
+			backoff.failed();
 			old = t->values[idx].load();
 			if((old & mask) != 0) {
 				return old; // Failed for bit-set under mask
 			}
 			t->values[idx].fetch_add(x);
+			reclaim(t, idx, master);
 			if(t->length >= 1024 * 1024) {
 				return t->values[idx].load(); // too big already
 			}
@@ -221,6 +489,7 @@ private:
 			size_t r = _resizers.load();
 			size_t newbytes = (t->length << 1) << sizeof(integer_type); // word to bytes
 			while(!_resizers.compare_exchange_strong(r, r + newbytes)) {
+				backoff.failed();
 				r = _resizers.load();
 			}
 			r += newbytes;
@@ -232,6 +501,7 @@ private:
 				// table is ready, or after the timeout in any case. Annoyingly, this
 				// breaks the non-blocking property - so for now we just briefly sleep.
 				YieldProcessor();
+				backoff.failed();
 				if(master->_cat != this) {
 					return old;
 				}
@@ -239,22 +509,46 @@ private:
 
 			CAT* newcat = new (smr::smr) CAT(this, t->length * 2, integer_type());
 			if(!master->CAS_cat(this, newcat)) {
-				newcat->_next = nullptr;
+				newcat->_next.store(nullptr);
 				smr::smr_destroy(newcat);
 			}
 			return old;
 		}
 
-		// Return the current sum of all things in the table, stripping off mask
-		// before the add. Writers can be updating the table furiously, so the
-		// sum is only locally accurate.
+		integer_type add_to_stripe_if_mask(size_t stripe, integer_type x, integer_type mask) {
+			smr::hazard_pointers<1> hazards;
+
+			array_type* t = nullptr;
+			// get a stable read of the array
+			for(;;) {
+				t = _t.load();
+				hazards[0] = t;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(t == _t.load()) {
+					break;
+				}
+			}
+			size_t idx = (stripe * stride) & (t->length - 1);
+			integer_type old = t->values[idx].load();
+			while((old & mask) == 0 && !t->values[idx].compare_exchange_weak(old, old + x)) {
+			}
+			if(_sum_cache != std::numeric_limits<integer_type>::min()) {
+				_sum_cache = std::numeric_limits<integer_type>::min(); // Blow out cache
+			}
+			return old;
+		}
+
+		// Return the current sum of all things in this table (but not the ones
+		// chained behind it), stripping off mask before the add. Only the
+		// unmasked sum is cached. Writers can be
+		// updating the table furiously, so the sum is only locally accurate.
 		integer_type sum(integer_type mask) const {
 			integer_type sum = _sum_cache;
-			if(sum != std::numeric_limits<integer_type>::min()) {
+			if(mask == integer_type() && sum != std::numeric_limits<integer_type>::min()) {
 				return sum;
 			}
-			sum = _next == nullptr ? integer_type() : _next->sum(mask); // Recursively get cached sum
-			
+			sum = integer_type();
+
 			smr::hazard_pointers<1> hazards;
 
 			array_type* t = nullptr;
@@ -262,33 +556,88 @@ private:
 			for(;;) {
 				t = _t.load();
 				hazards[0] = t;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
 				if(t == _t.load()) {
 					break;
 				}
 			}
-			for(size_t i = 0; i < t->length; ++i) {
-				sum += t->values[i].load() & ~mask;
+			// The loop is bound by the cache lines it pulls in, so the loads are
+			// relaxed, and spread over four sums so that each doesn't wait on the
+			// one before; the fence afterwards makes them acquires.
+			const integer_type keep = ~mask;
+			const size_t unrolled = t->length & ~(4 * stride - 1);
+			integer_type s0 = integer_type(), s1 = integer_type(), s2 = integer_type(), s3 = integer_type();
+			size_t i = 0;
+			for(; i < unrolled; i += 4 * stride) {
+				s0 += t->values[i             ].load(std::memory_order_relaxed) & keep;
+				s1 += t->values[i +     stride].load(std::memory_order_relaxed) & keep;
+				s2 += t->values[i + 2 * stride].load(std::memory_order_relaxed) & keep;
+				s3 += t->values[i + 3 * stride].load(std::memory_order_relaxed) & keep;
+			}
+			for(; i < t->length; i += stride) {
+				s0 += t->values[i].load(std::memory_order_relaxed) & keep;
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			sum = s0 + s1 + s2 + s3;
+			if(mask == integer_type()) {
+				_sum_cache = sum;
 			}
-			_sum_cache = sum; // Cache includes recursive counts
 			return sum;
 		}
 
 		// Fast fuzzy version. Used a cached value until it gets old, then re-up
 		// the cache.
-		integer_type estimate_sum(integer_type mask) const {
+		integer_type estimate_sum(integer_type mask, const concurrent_auto_table* master, ULONGLONG max_staleness) const {
 			// For short tables, just do the work
-			if(_t.load()->length <= 64) {
+			if(_t.load()->length <= 64 && _next.load() == nullptr) {
 				return sum(mask);
 			}
 			// For bigger tables, periodically freshen a cached value
-			std::clock_t millis = std::clock();
-			if(_fuzzy_time != millis) { // Time marches on?
-				_fuzzy_sum_cache = sum(mask); // Get sum the hard way
-				_fuzzy_time = millis; // Indicate freshness of cached value
+			const ULONGLONG now = cat_clock::now();
+			if(now - _fuzzy_time > max_staleness || max_staleness == 0) { // Time marches on?
+				_fuzzy_sum_cache = master->sum(mask); // Get sum the hard way
+				_fuzzy_time = now; // Indicate freshness of cached value
 			}
 			return _fuzzy_sum_cache; // Return cached sum
 		}
 
+		size_t length() const {
+			return _t.load()->length;
+		}
+
+		// Nobody has collided on the table for a whole decay_interval. A table
+		// that has seen collisions starts a fresh interval when asked.
+		bool quiet() {
+			const ULONGLONG now = cat_clock::now();
+			if(now - _since.load() < decay_interval) {
+				return false;
+			}
+			if(_collided.load() && _collided.exchange(false)) {
+				_since.store(now);
+				return false;
+			}
+			return true;
+		}
+
+		// Moves everything in this table into the first slot of target, once the
+		// table is no longer current. Writers that were already on their way in
+		// can still add to it, but they check _draining afterwards and move
+		// their own counts on if we might have missed them; exchanging each
+		// slot means every count is moved by exactly one of us.
+		void drain(CAT* target) {
+			_draining.store(true);
+			array_type* t = _t.load();
+			for(size_t i = 0; i < t->length; i += stride) {
+				integer_type v = t->values[i].exchange(integer_type());
+				if(v != integer_type()) {
+					target->add_to_first(v);
+				}
+			}
+			if(_sum_cache != std::numeric_limits<integer_type>::min()) {
+				_sum_cache = std::numeric_limits<integer_type>::min(); // Blow out cache
+			}
+		}
+
 		// Update all table slots with CAS.
 		void all_or(integer_type mask) {
 			smr::hazard_pointers<1> hazards;
@@ -298,17 +647,15 @@ private:
 			for(;;) {
 				t = _t.load();
 				hazards[0] = t;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
 				if(t == _t.load()) {
 					break;
 				}
 			}
 
-			for(size_t i = 0; i < t->length; ++i) {
+			for(size_t i = 0; i < t->length; i += stride) {
 				t->values[i].fetch_or(mask);
 			}
-			if(_next != nullptr) {
-				_next->all_or(mask);
-			}
 			if(_sum_cache != std::numeric_limits<integer_type>::min()) {
 				_sum_cache = std::numeric_limits<integer_type>::min(); // Blow out cache
 			}
@@ -322,17 +669,15 @@ private:
 			for(;;) {
 				t = _t.load();
 				hazards[0] = t;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
 				if(t == _t.load()) {
 					break;
 				}
 			}
 
-			for(size_t i = 0; i < t->length; ++i) {
+			for(size_t i = 0; i < t->length; i += stride) {
 				t->values[i].fetch_and(mask);
 			}
-			if(_next != nullptr) {
-				_next->all_and(mask);
-			}
 			if(_sum_cache != std::numeric_limits<integer_type>::min()) {
 				_sum_cache = std::numeric_limits<integer_type>::min(); // Blow out cache
 			}
@@ -347,18 +692,16 @@ private:
 			for(;;) {
 				t = _t.load();
 				hazards[0] = t;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
 				if(t == _t.load()) {
 					break;
 				}
 			}
 
-			for(size_t i = 0; i < t->length; ++i) {
+			for(size_t i = 0; i < t->length; i += stride) {
 				t->values[i].store(val);
 			}
 
-			if(_next != nullptr) {
-				_next->all_set(val);
-			}
 			if(_sum_cache != std::numeric_limits<integer_type>::min()) {
 				_sum_cache = std::numeric_limits<integer_type>::min(); // Blow out cache
 			}
@@ -366,41 +709,109 @@ private:
 
 	protected:
 		~CAT() {
-			if(_next != nullptr) {
-				smr::smr_destroy(_next);
+			if(_next.load() != nullptr) {
+				smr::smr_destroy(_next.load());
 			}
 			smr::smr_destroy(_t.load());
 		}
 
 	private:
+		friend struct concurrent_auto_table;
+
 		static bool CAS(std::atomic<integer_type>* A, size_t idx, integer_type old, integer_type nnn) {
 			return A[idx].compare_exchange_strong(old, nnn);
 		}
 
-		CAT* _next;
+		void add_to_first(integer_type x) {
+			_t.load()->values[0].fetch_add(x);
+			if(_sum_cache != std::numeric_limits<integer_type>::min()) {
+				_sum_cache = std::numeric_limits<integer_type>::min(); // Blow out cache
+			}
+		}
+
+		// Called after adding to slot idx. If the table is being drained the
+		// drain may already have been past the slot, so whatever is in it now
+		// goes to the current table instead.
+		void reclaim(array_type* t, size_t idx, concurrent_auto_table* master) {
+			if(!_draining.load()) {
+				return;
+			}
+			integer_type left = t->values[idx].exchange(integer_type());
+			if(left != integer_type()) {
+				master->add_if_mask(left, integer_type());
+			}
+		}
+
+		std::atomic<CAT*> _next; // the table this one replaced; only consolidation clears it
 
 		mutable volatile integer_type _sum_cache;
 		mutable volatile integer_type _fuzzy_sum_cache;
-		mutable volatile std::clock_t _fuzzy_time;
+		mutable volatile ULONGLONG _fuzzy_time;
 		std::atomic<size_t> _resizers; // count of threads attempting a resize
-
-		static const size_t MAX_SPIN = 2;
+		std::atomic<bool> _draining; // consolidation is moving the counts out
+		std::atomic<bool> _collided; // somebody lost a CAS on this table since _since
+		std::atomic<ULONGLONG> _since;
 
 		std::atomic<array_type*> _t; // Power-of-2 array of integer_types
 	};
 
-	hash_type hasher;
-	// Hash spreader
-	size_t hash() {
-		size_t h = hasher(::GetCurrentThreadId());
-		h ^= (h >> 20) ^ (h >> 12); // Bit spreader, borrowed from Doug Lea
-		h ^= (h >>  7) ^ (h >>  4);
-		return h << 2; // Pad out cache lines. The goal is to avoid cache-line contention
-	}
-
 	// The underlying array of concurrently updated long counters
 	CACHE_ALIGN std::atomic<CAT*> _cat;
 
+	CACHE_ALIGN contention_t _contention;
+
+	std::atomic<bool> _consolidating;
+	std::atomic<size_t> _consolidations; // finished ones, so get() can tell its pass overlapped one
+	std::atomic<ULONGLONG> _max_staleness;
+
+	// The sum of the current table and every one chained behind it.
+	integer_type sum(integer_type mask) const {
+		integer_type total = integer_type();
+		for_each_table([&total, mask](CAT* cat) { total += cat->sum(mask); });
+		return total;
+	}
+
+	// Calls f on the current table and every one chained behind it. Tables
+	// can be unlinked while we walk, so each link is checked again once the
+	// next table is covered by a hazard pointer.
+	template<typename F>
+	void for_each_table(F f) const {
+		smr::hazard_pointers<2> hazards;
+
+		CAT* cat = nullptr;
+		for(;;) {
+			cat = _cat.load();
+			hazards[0] = cat;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(cat == _cat.load()) {
+				break;
+			}
+		}
+		size_t h = 0;
+		while(cat != nullptr) {
+			f(cat);
+			CAT* next = nullptr;
+			for(;;) {
+				next = cat->_next.load();
+				hazards[h ^ 1] = next;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(next == cat->_next.load()) {
+					break;
+				}
+			}
+			cat = next;
+			h ^= 1;
+		}
+	}
+
+	static size_t round_up(size_t n) {
+		size_t p = 1;
+		while(p < n) {
+			p <<= 1;
+		}
+		return p;
+	}
+
 	// Only add 'x' to some slot in table, hinted at by 'hash', if bits under
 	// the mask are all zero. The sum can overflow or 'x' can contain bits in
 	// the mask. Value is CAS'd so no counts are lost. The CAS is retried until
@@ -414,11 +825,12 @@ private:
 		for(;;) {
 			cat = _cat.load();
 			hazards[0] = cat;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
 			if(cat == _cat.load()) {
 				break;
 			}
 		}
-		return cat->add_if_mask(x, mask, hash(), this);
+		return cat->add_if_mask(x, mask, probe_type::current(), this);
 	}
 
 	bool CAS_cat(CAT* oldcat, CAT* newcat) {
@@ -0,0 +1,34 @@
+#ifndef CONCURRENT_COUNTER__H
+#define CONCURRENT_COUNTER__H
+
+#include <SDKDDKVer.h>
+#include <Windows.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// A C interface to concurrent_auto_table<long long>, for the C containers that
+// want a striped counter. Updates land on a per-thread stripe, so they don't
+// all fight over one cache line; reads sum the stripes.
+typedef struct concurrent_counter concurrent_counter_t;
+
+concurrent_counter_t* new_concurrent_counter(void);
+void delete_concurrent_counter(concurrent_counter_t* c);
+
+void concurrent_counter_add(concurrent_counter_t* c, LONG64 x);
+void concurrent_counter_increment(concurrent_counter_t* c);
+void concurrent_counter_decrement(concurrent_counter_t* c);
+// approximate while other threads are updating, but includes all of this thread's updates
+LONG64 concurrent_counter_get(const concurrent_counter_t* c);
+// cheaper, but only refreshed about once a millisecond
+LONG64 concurrent_counter_estimate_get(const concurrent_counter_t* c);
+// the same, but refreshed once the cached sum is more than max_staleness nanoseconds old
+LONG64 concurrent_counter_get_with_staleness(const concurrent_counter_t* c, ULONGLONG max_staleness);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef CONCURRENT_RW_LOCK__HPP
+#define CONCURRENT_RW_LOCK__HPP
+
+#include "concurrent_auto_table.hpp"
+#include "backoff.h"
+
+#include <atomic>
+
+#include <boost/noncopyable.hpp>
+
+// A reader-writer lock for read-mostly data, built on concurrent_auto_table's
+// masked operations. A reader increments the count in its own stripe, which
+// has a cache line to itself, so readers never write to a line that another
+// reader is using; the increment fails if writer_bit is set in the stripe. A
+// writer sets writer_bit in every stripe with all_or, which turns new readers
+// away, and then waits for the counts under it to drain to zero. Writers
+// exclude one another with a flag of their own, and get in ahead of readers
+// that arrive after them.
+//
+// lock_shared() returns the stripe the reader was counted in, and that has to
+// be handed back to unlock_shared(). The thread's stripe can move in the
+// meantime, and taking the count off a stripe that doesn't have it would
+// borrow from the writer bit.
+//
+// Waiting goes through the lock's backoff policy, which starts out yielding.
+struct concurrent_rw_lock : boost::noncopyable {
+	typedef concurrent_auto_table<LONG64, cat_padded_layout> table_type;
+
+	// one stripe per processor unless told otherwise
+	explicit concurrent_rw_lock(size_t stripes = 0) : readers(new (smr::smr) table_type(stripes != 0 ? stripes : processor_count())), writer(false) {
+		contention_init(&lock_contention, BACKOFF_YIELD);
+	}
+
+	~concurrent_rw_lock() {
+		smr::smr_destroy(readers);
+	}
+
+	size_t lock_shared() {
+		const size_t stripe = cat_probe::current().stripe();
+		if((readers->add_to_stripe_if_mask(stripe, 1, writer_bit) & writer_bit) == 0) {
+			return stripe;
+		}
+		backoff_guard backoff(&lock_contention);
+		do {
+			backoff.failed();
+		} while((readers->add_to_stripe_if_mask(stripe, 1, writer_bit) & writer_bit) != 0);
+		return stripe;
+	}
+
+	void unlock_shared(size_t stripe) {
+		readers->add_to_stripe_if_mask(stripe, -1, 0);
+	}
+
+	void lock() {
+		backoff_guard backoff(&lock_contention);
+		bool expected = false;
+		while(writer.load() || !writer.compare_exchange_strong(expected, true)) {
+			expected = false;
+			backoff.failed();
+		}
+		readers->all_or(writer_bit);
+		while(readers->get_masked(writer_bit) != 0) {
+			backoff.failed();
+		}
+	}
+
+	void unlock() {
+		readers->all_and(~writer_bit);
+		writer.store(false);
+	}
+
+	// the lock's backoff policy and waiting statistics
+	contention_t* contention() {
+		return &lock_contention;
+	}
+
+private:
+	// well clear of the sign bit, so that the counts under it stay positive
+	static const LONG64 writer_bit = 1LL << 62;
+
+	static size_t processor_count() {
+		::SYSTEM_INFO si = { 0 };
+		::GetSystemInfo(&si);
+		return si.dwNumberOfProcessors;
+	}
+
+	table_type* readers;
+	contention_t lock_contention;
+
+	// only writers touch it, so it's kept off the line readers read
+	CACHE_ALIGN std::atomic<bool> writer;
+};
+
+#endif
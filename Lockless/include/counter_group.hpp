@@ -0,0 +1,126 @@
+#ifndef COUNTER_GROUP__HPP
+#define COUNTER_GROUP__HPP
+
+#include "concurrent_auto_table.hpp"
+#include "smr.hpp"
+
+#include <atomic>
+#include <new>
+
+#include <boost/noncopyable.hpp>
+
+// A fixed set of counters that share their stripes. Where each
+// concurrent_auto_table has its own stripes, a counter_group has one row of
+// stripes per thread (or per processor, with cat_cpu_probe), holding every
+// counter in the group side by side. A thread bumping several related
+// counters only touches its own row, which for a handful of counters is a
+// single cache line, and a snapshot of the whole group is one sequential
+// sweep over the rows.
+//
+// Unlike concurrent_auto_table the table doesn't grow: threads beyond the
+// number of rows share rows, and their adds still all count, but they contend
+// for the lines.
+template<typename T, typename Probe = cat_probe>
+struct counter_group : boost::noncopyable {
+	typedef T integer_type;
+	typedef Probe probe_type;
+	typedef std::atomic<integer_type> element_type;
+
+	// one row per processor unless told otherwise
+	explicit counter_group(size_t counter_count, size_t row_count = 0) : counters(counter_count),
+	                                                                   row_length(round_up_to_line(counter_count)),
+	                                                                   rows(round_up(row_count != 0 ? row_count : processor_count())),
+	                                                                   values(new (smr::smr) element_type[rows * row_length]()) {
+	}
+
+	// not thread-safe; nobody else can be using the group by now
+	~counter_group() {
+		::operator delete[](values, smr::smr);
+	}
+
+	size_t size() const {
+		return counters;
+	}
+
+	void add(size_t counter, integer_type x) {
+		my_row()[counter].fetch_add(x, std::memory_order_relaxed);
+	}
+
+	void increment(size_t counter) {
+		add(counter, static_cast<integer_type>(1));
+	}
+
+	void decrement(size_t counter) {
+		add(counter, static_cast<integer_type>(-1));
+	}
+
+	// adds deltas[i] to counter i, for every counter in the group, all in the
+	// calling thread's row; zeroes are skipped
+	void add(const integer_type* deltas) {
+		element_type* row = my_row();
+		for(size_t i = 0; i < counters; ++i) {
+			if(deltas[i] != integer_type()) {
+				row[i].fetch_add(deltas[i], std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Like concurrent_auto_table::get, approximate while other threads are
+	// adding, but it includes all of the calling thread's adds.
+	integer_type get(size_t counter) const {
+		integer_type sum = integer_type();
+		for(size_t r = 0; r < rows; ++r) {
+			sum += values[r * row_length + counter].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return sum;
+	}
+
+	// Writes every counter's value to out[0] .. out[size() - 1], sweeping the
+	// rows in order. Each value is as approximate as get()'s, and they aren't
+	// taken at a single instant.
+	void snapshot(integer_type* out) const {
+		for(size_t i = 0; i < counters; ++i) {
+			out[i] = integer_type();
+		}
+		for(size_t r = 0; r < rows; ++r) {
+			const element_type* row = values + r * row_length;
+			for(size_t i = 0; i < counters; ++i) {
+				out[i] += row[i].load(std::memory_order_relaxed);
+			}
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}
+
+private:
+	element_type* my_row() const {
+		return values + (probe_type::current().stripe() & (rows - 1)) * row_length;
+	}
+
+	// rows start on a cache line, so that no two rows share one
+	static size_t round_up_to_line(size_t counter_count) {
+		const size_t per_line = CACHE_LINE / sizeof(element_type);
+		return (counter_count + per_line - 1) / per_line * per_line;
+	}
+
+	static size_t round_up(size_t n) {
+		size_t p = 1;
+		while(p < n) {
+			p <<= 1;
+		}
+		return p;
+	}
+
+	static size_t processor_count() {
+		::SYSTEM_INFO si = { 0 };
+		::GetSystemInfo(&si);
+		return si.dwNumberOfProcessors;
+	}
+
+	const size_t counters;
+	const size_t row_length; // in elements
+	const size_t rows;
+	element_type* const values;
+};
+
+#endif
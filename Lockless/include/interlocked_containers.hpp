@@ -2,11 +2,17 @@
 #define INTERLOCKED_CONTAINERS_HPP
 
 #include "interlocked_queue.h"
+#include "interlocked_segment_queue.h"
 #include "interlocked_stack.h"
+#include "interlocked_deque.h"
 #include "interlocked_kv_list.h"
+#include "interlocked_priority_queue.h"
+#include "interlocked_skip_list.h"
+#include "interlocked_hash_set.h"
 #include <memory>
 #include <functional>
 #include <utility>
+#include <iterator>
 #include <boost/utility.hpp>
 
 #include <queue>
@@ -89,6 +95,16 @@ namespace utility
 			return static_cast<size_type>(::interlocked_queue_depth(q.get()));
 		}
 
+		// walks the whole queue; for debugging, and only exact when nothing else is using it
+		size_type exact_size() const {
+			return static_cast<size_type>(::interlocked_queue_exact_depth(q.get()));
+		}
+
+		// the backoff policy and retry statistics
+		contention_t* contention() {
+			return ::interlocked_queue_contention(q.get());
+		}
+
 	private:
 		struct queue_delete {
 			void operator()(::interlocked_queue* q) const {
@@ -103,13 +119,63 @@ namespace utility
 		std::unique_ptr<::interlocked_queue, queue_delete> q;
 	};
 
+	template<typename T>
+	struct interlocked_segment_queue : boost::noncopyable {
+		typedef size_t size_type;
+		typedef T value_type;
+		typedef interlocked_segment_queue<T> my_type;
+
+		interlocked_segment_queue() : q(::new_interlocked_segment_queue(&my_type::value_destructor))
+		{
+		}
+
+		~interlocked_segment_queue() {
+		}
+
+		void push(const value_type& val) {
+			::interlocked_segment_queue_push(q.get(), new value_type(val));
+		}
+
+		std::pair<bool, value_type> pop() {
+			value_type* v(nullptr);
+			if(::interlocked_segment_queue_pop(q.get(), reinterpret_cast<void**>(&v))) {
+				std::unique_ptr<value_type> ptr(v);
+				return std::pair<bool, value_type>(true, *v);
+			} else {
+				return std::pair<bool, value_type>(false, value_type());
+			}
+		}
+
+		bool empty() const {
+			return ::interlocked_segment_queue_is_empty(q.get());
+		}
+
+		size_type approximate_size() const {
+			return static_cast<size_type>(::interlocked_segment_queue_depth(q.get()));
+		}
+
+	private:
+		struct queue_delete {
+			void operator()(::interlocked_segment_queue* q) const {
+				::delete_interlocked_segment_queue(q);
+			}
+		};
+
+		static void value_destructor(const void* v) {
+			std::unique_ptr<const value_type> p(static_cast<const value_type*>(v));
+		}
+
+		std::unique_ptr<::interlocked_segment_queue, queue_delete> q;
+	};
+
 	template<typename T>
 	struct interlocked_stack : boost::noncopyable {
 		typedef size_t size_type;
 		typedef T value_type;
 		typedef interlocked_stack<T> my_type;
 
-		interlocked_stack() : s(::new_interlocked_stack(&my_type::value_destructor))
+		explicit interlocked_stack(bool use_elimination = false) : s(use_elimination ? ::new_interlocked_elimination_stack(&my_type::value_destructor)
+		                                                                             : ::new_interlocked_stack(&my_type::value_destructor))
 		{
 		}
 
@@ -134,13 +200,22 @@ namespace utility
 		}
 
 		bool empty() const {
-			return ::interlocked_stack_is_empty(q.get()):
+			return ::interlocked_stack_is_empty(s.get());
 		}
 
 		size_type approximate_size() const {
 			return static_cast<size_type>(::interlocked_stack_depth(s.get()));
 		}
 
+		// walks the whole stack; for debugging, and only exact when nothing else is using it
+		size_type exact_size() const {
+			return static_cast<size_type>(::interlocked_stack_exact_depth(s.get()));
+		}
+
+		contention_t* contention() {
+			return ::interlocked_stack_contention(s.get());
+		}
+
 	private:
 		struct stack_delete {
 			void operator()(::interlocked_stack* s) const {
@@ -155,6 +230,66 @@ namespace utility
 		std::unique_ptr<::interlocked_stack, stack_delete> s;
 	};
 
+	// push and pop belong to the thread that owns the deque; steal can be called from anywhere
+	template<typename T>
+	struct interlocked_deque : boost::noncopyable {
+		typedef size_t size_type;
+		typedef T value_type;
+		typedef interlocked_deque<T> my_type;
+
+		interlocked_deque() : d(::new_interlocked_deque(&my_type::value_destructor))
+		{
+		}
+
+		~interlocked_deque() {
+		}
+
+		void push(const value_type& val) {
+			::interlocked_deque_push(d.get(), new value_type(val));
+		}
+
+		std::pair<bool, value_type> pop() {
+			value_type* v(nullptr);
+			if(::interlocked_deque_pop(d.get(), reinterpret_cast<void**>(&v))) {
+				std::unique_ptr<value_type> ptr(v);
+				return std::pair<bool, value_type>(true, *v);
+			} else {
+				return std::pair<bool, value_type>(false, value_type());
+			}
+		}
+
+		std::pair<bool, value_type> steal() {
+			value_type* v(nullptr);
+			if(::interlocked_deque_steal(d.get(), reinterpret_cast<void**>(&v))) {
+				std::unique_ptr<value_type> ptr(v);
+				return std::pair<bool, value_type>(true, *v);
+			} else {
+				return std::pair<bool, value_type>(false, value_type());
+			}
+		}
+
+		bool empty() const {
+			return ::interlocked_deque_is_empty(d.get());
+		}
+
+		size_type approximate_size() const {
+			return static_cast<size_type>(::interlocked_deque_depth(d.get()));
+		}
+
+	private:
+		struct deque_delete {
+			void operator()(::interlocked_deque* d) const {
+				::delete_interlocked_deque(d);
+			}
+		};
+
+		static void value_destructor(const void* v) {
+			std::unique_ptr<const value_type> p(static_cast<const value_type*>(v));
+		}
+
+		std::unique_ptr<::interlocked_deque, deque_delete> d;
+	};
+
 	template<typename K, typename V, typename C = std::less<K> >
 	struct interlocked_kv_list : boost::noncopyable {
 		typedef K key_type;
@@ -182,20 +317,108 @@ namespace utility
 		}
 
 		std::pair<bool, value_type> find(const key_type& k) {
-			value_type* v(nullptr);
-			if(::interlocked_kv_list_find(l.get(), std::addressof(k), reinterpret_cast<void**>(&v))) {
-				return std::pair<bool, value_type>(true, *v);
-			} else {
-				return std::pair<bool, value_type>(false, value_type());
-			}
+			std::pair<bool, value_type> r(false, value_type());
+			r.first = ::interlocked_kv_list_find(l.get(), std::addressof(k), &my_type::copy_value, &r.second);
+			return r;
 		}
 
 		bool erase(const key_type& k) {
 			return ::interlocked_kv_list_delete(l.get(), std::addressof(k));
 		}
 
+		// returns true if it inserted, false if it replaced the value that was there
+		bool insert_or_assign(const key_type& k, const value_type& v) {
+			std::unique_ptr<key_type> pk(new key_type(k));
+			std::unique_ptr<value_type> pv(new value_type(v));
+			bool inserted = ::interlocked_kv_list_insert_or_assign(l.get(), pk.get(), pv.get());
+			pv.release();
+			if(inserted) {
+				pk.release();
+			}
+			return inserted;
+		}
+
+		// inserts f(k) if k isn't there already; returns true if it inserted
+		template<typename F>
+		bool compute_if_absent(const key_type& k, F f) {
+			std::unique_ptr<key_type> pk(new key_type(k));
+			if(::interlocked_kv_list_compute_if_absent(l.get(), pk.get(), &my_type::compute_trampoline<F>, &f)) {
+				pk.release();
+				return true;
+			} else {
+				return false;
+			}
+		}
+
 		bool empty() const {
-			return ::interlocked_kv_list_is_empty(l.get()):
+			return ::interlocked_kv_list_is_empty(l.get());
+		}
+
+		contention_t* contention() {
+			return ::interlocked_kv_list_contention(l.get());
+		}
+
+		// Weakly consistent, like the C iterator underneath. Copies share a
+		// position, so it's only an input iterator, and the key and value it
+		// points at are only safe to use until it moves on.
+		struct const_iterator {
+			typedef std::input_iterator_tag iterator_category;
+			typedef std::pair<const key_type&, const value_type&> reference;
+
+			const_iterator() : k(nullptr), v(nullptr) {
+			}
+
+			explicit const_iterator(::interlocked_kv_list_t* l) : it(::new_interlocked_kv_list_iterator(l), iterator_delete()), k(nullptr), v(nullptr) {
+				advance();
+			}
+
+			reference operator*() const {
+				return reference(*static_cast<const key_type*>(k), *static_cast<const value_type*>(v));
+			}
+
+			const_iterator& operator++() {
+				advance();
+				return *this;
+			}
+
+			bool operator==(const const_iterator& rhs) const {
+				return it == rhs.it;
+			}
+
+			bool operator!=(const const_iterator& rhs) const {
+				return !(*this == rhs);
+			}
+
+		private:
+			void advance() {
+				if(!::interlocked_kv_list_iterator_next(it.get(), &k, &v)) {
+					it.reset();
+				}
+			}
+
+			struct iterator_delete {
+				void operator()(::interlocked_kv_list_iterator_t* i) const {
+					::delete_interlocked_kv_list_iterator(i);
+				}
+			};
+
+			std::shared_ptr<::interlocked_kv_list_iterator_t> it;
+			const void* k;
+			void* v;
+		};
+
+		const_iterator begin() {
+			return const_iterator(l.get());
+		}
+
+		const_iterator end() {
+			return const_iterator();
+		}
+
+		// calls f(key, value) for every entry with lo <= key < hi, in order
+		template<typename F>
+		void range_scan(const key_type& lo, const key_type& hi, F f) {
+			::interlocked_kv_list_range_scan(l.get(), std::addressof(lo), std::addressof(hi), &my_type::visit_trampoline<F>, &f);
 		}
 
 		//size_type approximate_size() const {
@@ -203,6 +426,23 @@ namespace utility
 		//}
 
 	private:
+		template<typename F>
+		static void* compute_trampoline(const void* k, void* context) {
+			F& f(*static_cast<F*>(context));
+			return new value_type(f(*static_cast<const key_type*>(k)));
+		}
+
+		template<typename F>
+		static bool visit_trampoline(const void* k, void* v, void* context) {
+			F& f(*static_cast<F*>(context));
+			f(*static_cast<const key_type*>(k), *static_cast<const value_type*>(v));
+			return true;
+		}
+
+		static void copy_value(const void*, void* v, void* context) {
+			*static_cast<value_type*>(context) = *static_cast<const value_type*>(v);
+		}
+
 		static int comparator(const void* l, const void* r) {
 			cmp_type cmp;
 			       if(cmp(*static_cast<const key_type*>(l), *static_cast<const key_type*>(r))) {
@@ -230,6 +470,252 @@ namespace utility
 
 		std::unique_ptr<::interlocked_kv_list_t, kv_list_delete> l;
 	};
+
+	template<typename K, typename V, typename C = std::less<K> >
+	struct interlocked_priority_queue : boost::noncopyable {
+		typedef K key_type;
+		typedef V value_type;
+		typedef C cmp_type;
+		typedef interlocked_priority_queue<K, V, C> my_type;
+
+		interlocked_priority_queue() : q(::new_interlocked_priority_queue(&my_type::comparator, &my_type::key_destructor, &my_type::value_destructor))
+		{
+		}
+
+		~interlocked_priority_queue() {
+		}
+
+		void push(const key_type& k, const value_type& v) {
+			std::unique_ptr<key_type> pk(new key_type(k));
+			std::unique_ptr<value_type> pv(new value_type(v));
+			::interlocked_priority_queue_push(q.get(), pk.get(), pv.get());
+			pk.release();
+			pv.release();
+		}
+
+		std::pair<bool, std::pair<key_type, value_type> > pop() {
+			std::pair<bool, std::pair<key_type, value_type> > e(false, std::make_pair(key_type(), value_type()));
+			e.first = ::interlocked_priority_queue_delete_min(q.get(), &my_type::take_entry, &e.second);
+			return e;
+		}
+
+		bool empty() const {
+			return ::interlocked_priority_queue_is_empty(q.get());
+		}
+
+	private:
+		// other threads may still compare against the key, so it's copied; nobody
+		// else looks at a claimed entry's value, so that can be moved out
+		static void take_entry(const void* k, void* v, void* context) {
+			std::pair<key_type, value_type>* e(static_cast<std::pair<key_type, value_type>*>(context));
+			e->first = *static_cast<const key_type*>(k);
+			e->second = std::move(*static_cast<value_type*>(v));
+		}
+
+		static int comparator(const void* l, const void* r) {
+			cmp_type cmp;
+			       if(cmp(*static_cast<const key_type*>(l), *static_cast<const key_type*>(r))) {
+				return -1;
+			} else if(cmp(*static_cast<const key_type*>(r), *static_cast<const key_type*>(l))) {
+				return 1;
+			} else {
+				return 0;
+			}
+		}
+
+		static void key_destructor(const void* k) {
+			std::unique_ptr<const key_type> p(static_cast<const key_type*>(k));
+		}
+
+		static void value_destructor(const void* v) {
+			std::unique_ptr<const value_type> p(static_cast<const value_type*>(v));
+		}
+
+		struct priority_queue_delete {
+			void operator()(::interlocked_priority_queue_t* q) const {
+				::delete_interlocked_priority_queue(q);
+			}
+		};
+
+		std::unique_ptr<::interlocked_priority_queue_t, priority_queue_delete> q;
+	};
+
+	template<typename K, typename V, typename C = std::less<K> >
+	struct interlocked_skip_list : boost::noncopyable {
+		typedef K key_type;
+		typedef V value_type;
+		typedef C cmp_type;
+		typedef interlocked_skip_list<K, V, C> my_type;
+		typedef std::pair<bool, std::pair<key_type, value_type> > entry_type;
+
+		interlocked_skip_list() : l(::new_interlocked_skip_list(&my_type::comparator, &my_type::key_destructor, &my_type::value_destructor))
+		{
+		}
+
+		~interlocked_skip_list() {
+		}
+
+		bool insert(const key_type& k, const value_type& v) {
+			std::unique_ptr<key_type> pk(new key_type(k));
+			std::unique_ptr<value_type> pv(new value_type(v));
+			if(::interlocked_skip_list_insert(l.get(), pk.get(), pv.get())) {
+				pk.release();
+				pv.release();
+				return true;
+			} else {
+				return false;
+			}
+		}
+
+		std::pair<bool, value_type> find(const key_type& k) {
+			entry_type e(false, std::make_pair(key_type(), value_type()));
+			e.first = ::interlocked_skip_list_find(l.get(), std::addressof(k), &my_type::copy_entry, &e.second);
+			return std::make_pair(e.first, e.second.second);
+		}
+
+		bool erase(const key_type& k) {
+			return ::interlocked_skip_list_delete(l.get(), std::addressof(k));
+		}
+
+		// the first entry not less than k
+		entry_type lower_bound(const key_type& k) {
+			entry_type e(false, std::make_pair(key_type(), value_type()));
+			e.first = ::interlocked_skip_list_lower_bound(l.get(), std::addressof(k), &my_type::copy_entry, &e.second);
+			return e;
+		}
+
+		// the first entry greater than k
+		entry_type upper_bound(const key_type& k) {
+			entry_type e(false, std::make_pair(key_type(), value_type()));
+			e.first = ::interlocked_skip_list_upper_bound(l.get(), std::addressof(k), &my_type::copy_entry, &e.second);
+			return e;
+		}
+
+		// calls f(key, value) for every entry with lo <= key < hi, in order
+		template<typename F>
+		void range_scan(const key_type& lo, const key_type& hi, F f) {
+			::interlocked_skip_list_range_scan(l.get(), std::addressof(lo), std::addressof(hi), &my_type::visit_trampoline<F>, &f);
+		}
+
+		bool empty() const {
+			return ::interlocked_skip_list_is_empty(l.get());
+		}
+
+		contention_t* contention() {
+			return ::interlocked_skip_list_contention(l.get());
+		}
+
+	private:
+		template<typename F>
+		static void visit_trampoline(const void* k, void* v, void* context) {
+			F& f(*static_cast<F*>(context));
+			f(*static_cast<const key_type*>(k), *static_cast<const value_type*>(v));
+		}
+
+		static void copy_entry(const void* k, void* v, void* context) {
+			std::pair<key_type, value_type>* e(static_cast<std::pair<key_type, value_type>*>(context));
+			e->first = *static_cast<const key_type*>(k);
+			e->second = *static_cast<const value_type*>(v);
+		}
+
+		static int comparator(const void* l, const void* r) {
+			cmp_type cmp;
+			       if(cmp(*static_cast<const key_type*>(l), *static_cast<const key_type*>(r))) {
+				return -1;
+			} else if(cmp(*static_cast<const key_type*>(r), *static_cast<const key_type*>(l))) {
+				return 1;
+			} else {
+				return 0;
+			}
+		}
+
+		static void key_destructor(const void* k) {
+			std::unique_ptr<const key_type> p(static_cast<const key_type*>(k));
+		}
+
+		static void value_destructor(const void* v) {
+			std::unique_ptr<const value_type> p(static_cast<const value_type*>(v));
+		}
+
+		struct skip_list_delete {
+			void operator()(::interlocked_skip_list_t* l) const {
+				::delete_interlocked_skip_list(l);
+			}
+		};
+
+		std::unique_ptr<::interlocked_skip_list_t, skip_list_delete> l;
+	};
+
+	template<typename K, typename H = std::hash<K>, typename C = std::less<K> >
+	struct interlocked_hash_set : boost::noncopyable {
+		typedef size_t size_type;
+		typedef K key_type;
+		typedef H hash_type;
+		typedef C cmp_type;
+		typedef interlocked_hash_set<K, H, C> my_type;
+
+		interlocked_hash_set() : s(::new_interlocked_hash_set(&my_type::hash, &my_type::comparator, &my_type::key_destructor))
+		{
+		}
+
+		~interlocked_hash_set() {
+		}
+
+		bool insert(const key_type& k) {
+			std::unique_ptr<key_type> pk(new key_type(k));
+			if(::interlocked_hash_set_insert(s.get(), pk.get())) {
+				pk.release();
+				return true;
+			} else {
+				return false;
+			}
+		}
+
+		bool erase(const key_type& k) {
+			return ::interlocked_hash_set_delete(s.get(), std::addressof(k));
+		}
+
+		bool contains(const key_type& k) {
+			return ::interlocked_hash_set_contains(s.get(), std::addressof(k));
+		}
+
+		size_type size() const {
+			return ::interlocked_hash_set_size(s.get());
+		}
+
+		contention_t* contention() {
+			return ::interlocked_hash_set_contention(s.get());
+		}
+
+	private:
+		static size_t hash(const void* k) {
+			hash_type h;
+			return h(*static_cast<const key_type*>(k));
+		}
+
+		static int comparator(const void* l, const void* r) {
+			cmp_type cmp;
+			       if(cmp(*static_cast<const key_type*>(l), *static_cast<const key_type*>(r))) {
+				return -1;
+			} else if(cmp(*static_cast<const key_type*>(r), *static_cast<const key_type*>(l))) {
+				return 1;
+			} else {
+				return 0;
+			}
+		}
+
+		static void key_destructor(const void* k) {
+			std::unique_ptr<const key_type> p(static_cast<const key_type*>(k));
+		}
+
+		struct hash_set_delete {
+			void operator()(::interlocked_hash_set_t* s) const {
+				::delete_interlocked_hash_set(s);
+			}
+		};
+
+		std::unique_ptr<::interlocked_hash_set_t, hash_set_delete> s;
+	};
 }
 
 #endif
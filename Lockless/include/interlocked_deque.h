@@ -0,0 +1,44 @@
+#ifndef INTERLOCKED_DEQUE__H
+#define INTERLOCKED_DEQUE__H
+
+#include "smr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// A Chase-Lev work-stealing deque. One thread owns the deque and pushes and
+// pops at the bottom; any other thread can steal from the top. The slots live
+// in a circular array that the owner doubles when it fills up; old arrays are
+// reclaimed with smr_retire. data must not be nullptr.
+typedef struct interlocked_deque interlocked_deque_t;
+
+typedef void     (*destructor_t)(const void*);
+
+interlocked_deque_t* new_interlocked_deque(destructor_t value_destructor);
+void delete_interlocked_deque(interlocked_deque_t* d);
+
+// owner only
+void interlocked_deque_push(interlocked_deque_t* d, void* data);
+bool interlocked_deque_pop(interlocked_deque_t* d, void** output);
+
+// any thread; returns false if the deque was empty, or if another thread took
+// the top element first, in which case a scheduler will usually try elsewhere
+bool interlocked_deque_steal(interlocked_deque_t* d, void** output);
+
+bool interlocked_deque_is_empty(const interlocked_deque_t* d);
+long interlocked_deque_depth(const interlocked_deque_t* d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
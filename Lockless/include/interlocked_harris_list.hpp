@@ -0,0 +1,211 @@
+#ifndef INTERLOCKED_HARRIS_LIST__HPP
+#define INTERLOCKED_HARRIS_LIST__HPP
+
+#include "smr.hpp"
+#include "backoff.h"
+
+#include <atomic>
+#include <functional>
+#include <new>
+#include <utility>
+
+#include <boost/noncopyable.hpp>
+
+namespace utility
+{
+	// The same Harris-Michael list as interlocked_kv_list, but the key and value
+	// live inside the SMR-allocated node and the comparator is a template
+	// parameter, so an insert is one allocation, comparisons are inlined, and
+	// looking at a node during a search touches a single cache line rather than
+	// the node, the key, and the value.
+	//
+	// A deleted node is retired by whichever thread's CAS unlinks it, with a
+	// finalizer that runs the key and value destructors once no hazard pointer
+	// covers the node any more.
+	template<typename K, typename V, typename C = std::less<K> >
+	struct interlocked_harris_list : boost::noncopyable {
+		typedef K key_type;
+		typedef V value_type;
+		typedef C cmp_type;
+		typedef interlocked_harris_list<K, V, C> my_type;
+
+		explicit interlocked_harris_list(const cmp_type& c = cmp_type()) : head(nullptr), cmp(c) {
+			contention_init(&list_contention, BACKOFF_NONE);
+		}
+
+		// not thread-safe; nobody else can be using the list by now. Nodes that
+		// were marked but never unlinked were never retired either, so they go too.
+		~interlocked_harris_list() {
+			node* n = head.load();
+			while(n != nullptr) {
+				node* next = unmarked(n->next.load());
+				retire(n);
+				n = next;
+			}
+		}
+
+		bool insert(const key_type& k, const value_type& v) {
+			return emplace(k, v);
+		}
+
+		template<typename... Args>
+		bool emplace(const key_type& k, Args&&... args) {
+			node* n = new (smr::smr) node(k, std::forward<Args>(args)...);
+			smr::hazard_pointers<2> hazards;
+			position p;
+			backoff_t b;
+			backoff_init(&b, &list_contention);
+			for(;;) {
+				if(search(k, p, hazards, b)) {
+					backoff_done(&b);
+					n->~node();
+					::operator delete(n, smr::smr);
+					return false;
+				}
+				n->next.store(p.curr);
+				if(p.prev->compare_exchange_strong(p.curr, n)) {
+					backoff_done(&b);
+					return true;
+				}
+				backoff_failed(&b);
+			}
+		}
+
+		// the value is copied out while the node is still protected
+		std::pair<bool, value_type> find(const key_type& k) {
+			smr::hazard_pointers<2> hazards;
+			position p;
+			backoff_t b;
+			backoff_init(&b, &list_contention);
+			bool found = search(k, p, hazards, b);
+			backoff_done(&b);
+			if(found) {
+				return std::pair<bool, value_type>(true, p.curr->value);
+			} else {
+				return std::pair<bool, value_type>(false, value_type());
+			}
+		}
+
+		bool erase(const key_type& k) {
+			smr::hazard_pointers<2> hazards;
+			position p;
+			backoff_t b;
+			backoff_init(&b, &list_contention);
+			for(;;) {
+				if(!search(k, p, hazards, b)) {
+					backoff_done(&b);
+					return false;
+				}
+				node* next = p.next;
+				if(!p.curr->next.compare_exchange_strong(next, marked(p.next))) {
+					backoff_failed(&b);
+					continue;
+				}
+				node* curr = p.curr;
+				if(p.prev->compare_exchange_strong(curr, p.next)) {
+					retire(p.curr);
+				} else {
+					// somebody's in the way; a search will unlink it
+					search(k, p, hazards, b);
+				}
+				backoff_done(&b);
+				return true;
+			}
+		}
+
+		bool empty() const {
+			return head.load() == nullptr;
+		}
+
+		// the list's backoff policy and retry statistics
+		contention_t* contention() {
+			return &list_contention;
+		}
+
+	private:
+		struct node : boost::noncopyable {
+			template<typename... Args>
+			node(const key_type& k, Args&&... args) : next(nullptr), key(k), value(std::forward<Args>(args)...) {
+			}
+
+			std::atomic<node*> next;
+			const key_type key;
+			value_type value;
+		};
+
+		struct position {
+			position() : prev(nullptr), curr(nullptr), next(nullptr) {
+			}
+
+			std::atomic<node*>* prev;
+			node* curr;
+			node* next;
+		};
+
+		static node* marked(node* n) {
+			return reinterpret_cast<node*>(reinterpret_cast<size_t>(n) | 1);
+		}
+
+		static node* unmarked(node* n) {
+			return reinterpret_cast<node*>(reinterpret_cast<size_t>(n) & ~static_cast<size_t>(1));
+		}
+
+		static bool is_marked(node* n) {
+			return (reinterpret_cast<size_t>(n) & 1) == 1;
+		}
+
+		static bool finalize_node(void*, void* n) {
+			static_cast<node*>(n)->~node();
+			return true;
+		}
+
+		static void retire(node* n) {
+			smr::smr_destroy(n, &my_type::finalize_node, nullptr);
+		}
+
+		// Finds the first node not less than k, unlinking any deleted nodes on the
+		// way. Leaves p.curr and the node p.prev points into both protected.
+		bool search(const key_type& k, position& p, smr::hazard_pointers<2>& hazards, backoff_t& b) {
+		try_again:
+			p.prev = &head;
+			p.curr = p.prev->load();
+			size_t h = 0;
+			while(p.curr != nullptr) {
+				hazards[h] = p.curr;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(p.prev->load() != p.curr) {
+					backoff_failed(&b);
+					goto try_again;
+				}
+				p.next = p.curr->next.load();
+				if(is_marked(p.next)) {
+					node* curr = p.curr;
+					if(!p.prev->compare_exchange_strong(curr, unmarked(p.next))) {
+						backoff_failed(&b);
+						goto try_again;
+					}
+					retire(p.curr);
+					p.curr = unmarked(p.next);
+					continue;
+				}
+				if(p.prev->load() != p.curr) {
+					backoff_failed(&b);
+					goto try_again;
+				}
+				if(!cmp(p.curr->key, k)) {
+					return !cmp(k, p.curr->key);
+				}
+				p.prev = &p.curr->next;
+				p.curr = p.next;
+				h ^= 1;
+			}
+			return false;
+		}
+
+		std::atomic<node*> head;
+		cmp_type cmp;
+		contention_t list_contention;
+	};
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef INTERLOCKED_HASH_SET__H
+#define INTERLOCKED_HASH_SET__H
+
+#include "smr.h"
+#include "backoff.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// Shalev and Shavit's split-ordered list: every key lives in a single
+// interlocked_kv_list, sorted by its hash with the bits reversed, and the
+// buckets are just shortcuts into that list (sentinel nodes that are never
+// deleted). Doubling the number of buckets splits each bucket's run of the
+// list in two without moving anything, and new buckets' sentinels are only
+// inserted the first time something hashes to them, so the table grows a
+// bucket at a time rather than with a stop-and-copy migration.
+typedef struct interlocked_hash_set interlocked_hash_set_t;
+
+typedef int      (*key_cmp     )(const void*, const void*);
+typedef void     (*destructor_t)(const void*);
+typedef size_t   (*key_hash    )(const void*);
+
+// keys with the same hash are kept in cmp order
+interlocked_hash_set_t* new_interlocked_hash_set(key_hash hash, key_cmp cmp, destructor_t key_destructor);
+void delete_interlocked_hash_set(interlocked_hash_set_t* s);
+
+// the set takes ownership of the key only if the insert succeeds
+bool interlocked_hash_set_insert  (interlocked_hash_set_t* s, const void* key);
+bool interlocked_hash_set_delete  (interlocked_hash_set_t* s, const void* key);
+bool interlocked_hash_set_contains(interlocked_hash_set_t* s, const void* key);
+// approximate while other threads are inserting and deleting
+size_t interlocked_hash_set_size(const interlocked_hash_set_t* s);
+// the set's backoff policy and retry statistics
+contention_t* interlocked_hash_set_contention(interlocked_hash_set_t* s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
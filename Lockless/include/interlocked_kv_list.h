@@ -2,6 +2,7 @@
 #define INTERLOCKED_SET__H
 
 #include "smr.h"
+#include "backoff.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -25,8 +26,54 @@ void delete_interlocked_kv_list(interlocked_kv_list_t* s);
 
 bool interlocked_kv_list_insert(interlocked_kv_list_t* s, const void* key, void*  value);
 bool interlocked_kv_list_delete(interlocked_kv_list_t* s, const void* key);
-bool interlocked_kv_list_find  (interlocked_kv_list_t* s, const void* key, void** value);
+// find hands the entry to a visitor while both the node and its value are
+// protected, so the visitor can copy them out; once it returns, a concurrent
+// delete or update is free to destroy them. visit may be nullptr.
+typedef void     (*kv_list_lookup_t)(const void* key, void* value, void* context);
+bool interlocked_kv_list_find  (interlocked_kv_list_t* s, const void* key, kv_list_lookup_t visit, void* context);
+
+// Updates swing the node's value pointer in place rather than deleting and
+// reinserting, and the value they replace is destroyed through SMR once no
+// iterator is looking at it.
+
+// inserts, or replaces the value if the key's already there. The list always
+// takes ownership of the value, but of the key only if it's inserted. Returns
+// true if it inserted.
+bool interlocked_kv_list_insert_or_assign(interlocked_kv_list_t* s, const void* key, void* value);
+// makes the value for a key that isn't in the list yet
+typedef void*    (*kv_list_compute_t)(const void* key, void* context);
+// Inserts key with the value compute makes for it, unless key is already there.
+// compute isn't called if it is, but if another thread inserts the key after
+// compute has run, the new value is destroyed. Returns true if it inserted, in
+// which case the list owns the key.
+bool interlocked_kv_list_compute_if_absent(interlocked_kv_list_t* s, const void* key, kv_list_compute_t compute, void* context);
+// replaces key's value with desired if it's currently expected; the list owns
+// desired only if this succeeds
+bool interlocked_kv_list_replace_value(interlocked_kv_list_t* s, const void* key, void* expected, void* desired);
 bool interlocked_kv_list_is_empty(const interlocked_kv_list_t* s);
+// the list's backoff policy and retry statistics
+contention_t* interlocked_kv_list_contention(interlocked_kv_list_t* s);
+
+// Iterators walk the list in key order, hand over hand. They're weakly
+// consistent: they see every entry that's in the list for the whole walk,
+// skip entries that have been deleted, and may or may not see entries that
+// come and go while they're running. Each one keeps hold of a few hazard
+// pointers, so it's for one thread at a time.
+typedef struct interlocked_kv_list_iterator interlocked_kv_list_iterator_t;
+
+interlocked_kv_list_iterator_t* new_interlocked_kv_list_iterator(interlocked_kv_list_t* s);
+void delete_interlocked_kv_list_iterator(interlocked_kv_list_iterator_t* it);
+// makes the next entry the first one whose key is not less than key
+void interlocked_kv_list_iterator_seek(interlocked_kv_list_iterator_t* it, const void* key);
+// the key and value stay safe to use until the iterator moves on or is deleted
+bool interlocked_kv_list_iterator_next(interlocked_kv_list_iterator_t* it, const void** key, void** value);
+
+// return false to stop the scan
+typedef bool     (*kv_list_visitor_t)(const void* key, void* value, void* context);
+
+// visits every entry with lo <= key < hi in key order; a nullptr bound means
+// no bound
+void interlocked_kv_list_range_scan(interlocked_kv_list_t* s, const void* lo, const void* hi, kv_list_visitor_t visit, void* context);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,58 @@
+#ifndef INTERLOCKED_KV_LIST_NODES__H
+#define INTERLOCKED_KV_LIST_NODES__H
+
+#include "interlocked_kv_list.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// The node-level Harris-Michael list that interlocked_kv_list is made of, for
+// containers that keep several lists (or one list with several entry points)
+// of their own. Everything here works on a link rather than a list, so a search
+// can start from any node that's never deleted. Nodes are smr_alloc'd, and may
+// be embedded at the start of something bigger, since it's the node pointer
+// that gets retired.
+typedef struct interlocked_kv_list_node_destructors {
+	destructor_t key_destructor;
+	destructor_t value_destructor;
+} interlocked_kv_list_node_destructors_t;
+
+// Each node carries its own destructors, so retiring one needs nothing that
+// might be gone by the time it's finalized. They fit in the cache line the
+// node takes up anyway.
+typedef struct interlocked_kv_list_node {
+	struct interlocked_kv_list_node* next;
+	const void* key;
+	void* value;
+	interlocked_kv_list_node_destructors_t destructors;
+} interlocked_kv_list_node_t;
+
+typedef CACHE_ALIGN struct per_thread_vars {
+	CACHE_ALIGN interlocked_kv_list_node_t** prev;
+	CACHE_ALIGN interlocked_kv_list_node_t* current;
+	CACHE_ALIGN interlocked_kv_list_node_t* next;
+} per_thread_vars_t;
+
+interlocked_kv_list_node_t* new_interlocked_kv_list_node(const void* key, void* value, const interlocked_kv_list_node_destructors_t* destructors);
+// runs the node's destructors and frees it once nothing's looking at it
+void retire_kv_list_node(interlocked_kv_list_node_t* node);
+
+void* kv_list_node_mark_as_deleted(void* ptr);
+void* kv_list_node_mark_as_undeleted(void* ptr);
+bool kv_list_node_test_if_deleted(void* ptr);
+
+// Each of these needs two hazard pointers. kv_list_node_find leaves
+// v->current (the first node not less than key) protected by hazards[0], and
+// the node v->prev points into by hazards[1].
+bool kv_list_node_find(interlocked_kv_list_node_t** head, const void* key, key_cmp cmp, per_thread_vars_t* v, void* volatile** hazards, backoff_t* b);
+// when it fails, v->current is the node that's already there
+bool kv_list_node_insert(interlocked_kv_list_node_t** head, interlocked_kv_list_node_t* node, key_cmp cmp, per_thread_vars_t* v, void* volatile** hazards, backoff_t* b);
+bool kv_list_node_delete(interlocked_kv_list_node_t** head, const void* key, key_cmp cmp, per_thread_vars_t* v, void* volatile** hazards, backoff_t* b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef INTERLOCKED_PRIORITY_QUEUE__H
+#define INTERLOCKED_PRIORITY_QUEUE__H
+
+#include "smr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// A skip list kept in key order, where delete_min claims the first node that
+// nobody else has claimed. Claimed nodes aren't unlinked one at a time; they
+// pile up at the front of the list and get unlinked in a batch once a
+// delete_min has had to walk past too many of them, so the head of the list
+// isn't a CAS hotspot. Keys that compare equal come out in the order they went in.
+typedef struct interlocked_priority_queue interlocked_priority_queue_t;
+
+typedef int      (*key_cmp     )(const void*, const void*);
+typedef void     (*destructor_t)(const void*);
+
+interlocked_priority_queue_t* new_interlocked_priority_queue(key_cmp cmp, destructor_t key_destructor, destructor_t value_destructor);
+void delete_interlocked_priority_queue(interlocked_priority_queue_t* q);
+
+// delete_min hands the entry it claims to a visitor while it's still
+// protected, so the visitor can copy the key and value out. The queue keeps
+// ownership of both, since a claimed entry's key is still compared against
+// until a cleanup unlinks it, and destroys them once the node is reclaimed.
+typedef void     (*priority_queue_visitor_t)(const void* key, void* value, void* context);
+
+// the queue takes ownership of the key and value
+void interlocked_priority_queue_push(interlocked_priority_queue_t* q, const void* key, void* value);
+bool interlocked_priority_queue_delete_min(interlocked_priority_queue_t* q, priority_queue_visitor_t visit, void* context);
+bool interlocked_priority_queue_is_empty(const interlocked_priority_queue_t* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,7 @@
 #define INTERLOCKED_QUEUE__H
 
 #include "smr.h"
+#include "backoff.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -25,7 +26,13 @@ void delete_interlocked_queue(interlocked_queue_t* q);
 void interlocked_queue_push(interlocked_queue_t* q, void* data);
 bool interlocked_queue_pop(interlocked_queue_t* q, void** output);
 bool interlocked_queue_is_empty(const interlocked_queue_t* q);
+// the queue's backoff policy and retry statistics
+contention_t* interlocked_queue_contention(interlocked_queue_t* q);
+// cheap; an estimate from a striped counter that push and pop keep up to date,
+// refreshed about once a millisecond
 long interlocked_queue_depth(const interlocked_queue_t* q);
+// walks the list, so it's slow, and only exact if nothing is pushing or popping
+long interlocked_queue_exact_depth(const interlocked_queue_t* q);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,38 @@
+#ifndef INTERLOCKED_SEGMENT_QUEUE__H
+#define INTERLOCKED_SEGMENT_QUEUE__H
+
+#include "smr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// A queue of linked fixed-size ring segments. Producers and consumers claim
+// slots with a fetch-and-add on the segment's indices rather than CASing the
+// tail, so the only CAS contention is on the occasional segment link. Segments
+// are reclaimed with smr_retire. data must not be nullptr.
+typedef struct interlocked_segment_queue interlocked_segment_queue_t;
+
+typedef void     (*destructor_t)(const void*);
+
+interlocked_segment_queue_t* new_interlocked_segment_queue(destructor_t value_destructor);
+void delete_interlocked_segment_queue(interlocked_segment_queue_t* q);
+
+void interlocked_segment_queue_push(interlocked_segment_queue_t* q, void* data);
+bool interlocked_segment_queue_pop(interlocked_segment_queue_t* q, void** output);
+bool interlocked_segment_queue_is_empty(const interlocked_segment_queue_t* q);
+long interlocked_segment_queue_depth(const interlocked_segment_queue_t* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
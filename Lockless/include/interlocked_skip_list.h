@@ -0,0 +1,57 @@
+#ifndef INTERLOCKED_SKIP_LIST__H
+#define INTERLOCKED_SKIP_LIST__H
+
+#include "smr.h"
+#include "backoff.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// An ordered map. Each level of the skip list is a Harris-Michael list: a
+// node is deleted at a level by marking its next pointer there, and whoever
+// walks past a marked node unlinks it. A node is only retired once it has been
+// unlinked from every level it was linked into, so operations are O(log n)
+// and nodes stay safe to dereference for as long as a hazard pointer covers them.
+typedef struct interlocked_skip_list interlocked_skip_list_t;
+
+typedef int      (*key_cmp     )(const void*, const void*);
+typedef void     (*destructor_t)(const void*);
+
+interlocked_skip_list_t* new_interlocked_skip_list(key_cmp cmp, destructor_t key_destructor, destructor_t value_destructor);
+void delete_interlocked_skip_list(interlocked_skip_list_t* s);
+
+// Lookups hand the entry they find to a visitor while it's still protected, so
+// the visitor can copy the key and value out; once it returns, a concurrent
+// delete is free to destroy them.
+typedef void     (*skip_list_visitor_t)(const void* key, void* value, void* context);
+
+// the list takes ownership of the key and value only if the insert succeeds
+bool interlocked_skip_list_insert(interlocked_skip_list_t* s, const void* key, void*  value);
+bool interlocked_skip_list_delete(interlocked_skip_list_t* s, const void* key);
+bool interlocked_skip_list_find  (interlocked_skip_list_t* s, const void* key, skip_list_visitor_t visit, void* context);
+// the first entry whose key is not less than key
+bool interlocked_skip_list_lower_bound(interlocked_skip_list_t* s, const void* key, skip_list_visitor_t visit, void* context);
+// the first entry whose key is greater than key
+bool interlocked_skip_list_upper_bound(interlocked_skip_list_t* s, const void* key, skip_list_visitor_t visit, void* context);
+// visits every entry with lo <= key < hi in key order, walking the bottom level
+// hand over hand; a nullptr bound means no bound. Like the kv_list iterator, it's
+// weakly consistent.
+void interlocked_skip_list_range_scan(interlocked_skip_list_t* s, const void* lo, const void* hi, skip_list_visitor_t visit, void* context);
+bool interlocked_skip_list_is_empty(const interlocked_skip_list_t* s);
+// the list's backoff policy and retry statistics
+contention_t* interlocked_skip_list_contention(interlocked_skip_list_t* s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef INTERLOCKED_SKIP_LIST_NODES__H
+#define INTERLOCKED_SKIP_LIST_NODES__H
+
+#include "interlocked_kv_list_nodes.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// The tower nodes that interlocked_skip_list and interlocked_priority_queue are
+// both made of. Links are marked with interlocked_kv_list_nodes.h's
+// kv_list_node_mark_as_deleted, like the list's are.
+typedef struct skip_list_node
+{
+	const void* key;
+	void* value;
+	// The node can outlive the container that made it, since it's only
+	// retired once nobody's looking at it, so it carries its own destructors.
+	// They fit in the cache line the node occupies anyway.
+	destructor_t key_destructor;
+	destructor_t value_destructor;
+	// the number of levels the node is linked into, or is still going to be;
+	// whoever takes it to zero retires the node
+	volatile LONG link_count;
+	LONG height;
+	// the low bit of next[i] set means the node is deleted at level i
+	struct skip_list_node* volatile next[1];
+} skip_list_node_t;
+
+skip_list_node_t* new_skip_list_node(const void* key, void* value, destructor_t key_destructor, destructor_t value_destructor, LONG height);
+// drops count of the node's links, and retires it, destructors and all, when
+// that was the last of them
+void release_skip_list_links(skip_list_node_t* n, LONG count);
+// a height between 1 and max_level, each level half as likely as the one below
+LONG random_skip_list_height(LONG max_level);
+
+void swap_hazards(void* volatile** a, void* volatile** b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
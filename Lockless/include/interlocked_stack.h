@@ -2,6 +2,7 @@
 #define INTERLOCKED_STACK__H
 
 #include "smr.h"
+#include "backoff.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -20,12 +21,22 @@ typedef struct interlocked_stack interlocked_stack_t;
 typedef void     (*destructor_t)(const void*);
 
 interlocked_stack_t* new_interlocked_stack(destructor_t value_destructor);
+// the same stack, but pushes and pops that collide can pair off in an
+// elimination array instead of retrying on top; it pays off under heavy
+// symmetric load
+interlocked_stack_t* new_interlocked_elimination_stack(destructor_t value_destructor);
 void delete_interlocked_stack(interlocked_stack_t* s);
 
 void interlocked_stack_push(interlocked_stack_t* s, void* data);
 bool interlocked_stack_pop(interlocked_stack_t* s, void** output);
+// cheap; an estimate from a striped counter that push and pop keep up to date,
+// refreshed about once a millisecond
 long interlocked_stack_depth(const interlocked_stack_t* s);
+// walks the list, so it's slow, and only exact if nothing is pushing or popping
+long interlocked_stack_exact_depth(const interlocked_stack_t* s);
 bool interlocked_stack_is_empty(const interlocked_stack_t* s);
+// the stack's backoff policy and retry statistics
+contention_t* interlocked_stack_contention(interlocked_stack_t* s);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,180 @@
+#ifndef INTERLOCKED_VALUE_QUEUE__HPP
+#define INTERLOCKED_VALUE_QUEUE__HPP
+
+#include "smr.hpp"
+
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <boost/noncopyable.hpp>
+
+namespace utility
+{
+	// A Michael-Scott queue that stores each element inside its SMR-allocated
+	// node, rather than pointing at a separately allocated copy the way
+	// interlocked_queue<T> does. A push is one allocation and a pop touches one
+	// node.
+	//
+	// In a Michael-Scott queue the node holding the popped value becomes the new
+	// dummy, so the value can't be destroyed along with its node. Instead the
+	// thread whose CAS advanced the head moves the value out and destroys it in
+	// place. The node is retired later, by whichever pop moves past it, and by
+	// then it is just an empty dummy. The hazard on the node keeps it alive
+	// until the winner has finished with the value.
+	template<typename T>
+	struct interlocked_value_queue : boost::noncopyable {
+		typedef size_t size_type;
+		typedef T value_type;
+		typedef interlocked_value_queue<T> my_type;
+
+		interlocked_value_queue() : head(new (smr::smr) node()), head_padding(), tail(head.load()) {
+		}
+
+		// not thread-safe; nobody else can be using the queue by now
+		~interlocked_value_queue() {
+			node* n = head.load();
+			node* next = n->next.load();
+			smr::smr_destroy(n);
+			while(next != nullptr) {
+				n = next;
+				next = n->next.load();
+				n->value()->~value_type();
+				smr::smr_destroy(n);
+			}
+		}
+
+		void push(const value_type& val) {
+			emplace(val);
+		}
+
+		void push(value_type&& val) {
+			emplace(std::move(val));
+		}
+
+		template<typename... Args>
+		void emplace(Args&&... args) {
+			node* n = new (smr::smr) node();
+			try {
+				::new(n->value()) value_type(std::forward<Args>(args)...);
+			} catch(...) {
+				::operator delete(n, smr::smr);
+				throw;
+			}
+			link(n);
+		}
+
+		// Moves the front element into output. If the move assignment throws, the
+		// element is lost: it has already been unlinked and nobody else can reach it.
+		bool try_pop(value_type& output) {
+			smr::hazard_pointers<2> hazards;
+
+			node* h = nullptr;
+			node* next = nullptr;
+			for(;;) {
+				h = head.load();
+				hazards[0] = h;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(h != head.load()) {
+					continue;
+				}
+				node* t = tail.load();
+				next = h->next.load();
+				hazards[1] = next;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(h != head.load()) {
+					continue;
+				}
+				if(next == nullptr) {
+					return false;
+				}
+				if(h == t) {
+					tail.compare_exchange_strong(t, next);
+					continue;
+				}
+				if(head.compare_exchange_strong(h, next)) {
+					break;
+				}
+			}
+
+			struct destroy_value {
+				~destroy_value() {
+					v->~value_type();
+				}
+				value_type* v;
+			} guard = { next->value() };
+			output = std::move(*guard.v);
+
+			smr::smr_destroy(h);
+			return true;
+		}
+
+		std::pair<bool, value_type> pop() {
+			std::pair<bool, value_type> result(false, value_type());
+			result.first = try_pop(result.second);
+			return result;
+		}
+
+		bool empty() const {
+			smr::hazard_pointers<1> hazards;
+
+			node* h = nullptr;
+			for(;;) {
+				h = head.load();
+				hazards[0] = h;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(h == head.load()) {
+					break;
+				}
+			}
+			return h->next.load() == nullptr;
+		}
+
+	private:
+		struct node : boost::noncopyable {
+			node() : next(nullptr) {
+			}
+
+			value_type* value() {
+				return reinterpret_cast<value_type*>(&storage);
+			}
+
+			std::atomic<node*> next;
+			typename std::aligned_storage<sizeof(value_type), std::alignment_of<value_type>::value>::type storage;
+		};
+
+		void link(node* n) {
+			smr::hazard_pointers<1> hazards;
+
+			node* t = nullptr;
+			for(;;) {
+				t = tail.load();
+				hazards[0] = t;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(t != tail.load()) {
+					continue;
+				}
+				node* next = t->next.load();
+				if(t != tail.load()) {
+					continue;
+				}
+				if(next != nullptr) {
+					tail.compare_exchange_strong(t, next);
+					continue;
+				}
+				if(t->next.compare_exchange_strong(next, n)) {
+					break;
+				}
+			}
+			tail.compare_exchange_strong(t, n);
+		}
+
+		// padded rather than aligned, since the queue itself is usually heap-allocated
+		std::atomic<node*> head;
+		char head_padding[CACHE_LINE - sizeof(std::atomic<node*>)];
+		std::atomic<node*> tail;
+	};
+}
+
+#endif
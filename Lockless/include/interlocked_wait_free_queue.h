@@ -0,0 +1,45 @@
+#ifndef INTERLOCKED_WAIT_FREE_QUEUE__H
+#define INTERLOCKED_WAIT_FREE_QUEUE__H
+
+#include "smr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// A wait-free MPMC queue. Operations first try a bounded number of lock-free
+// attempts (the fast path); if those all fail the operation is announced in
+// the queue's state array and completed by every thread that comes along (the
+// slow path), so each push and pop finishes in a bounded number of steps even
+// under starvation. Each thread must register for a handle before using the
+// queue, and at most max_threads handles can be live at once. data must not be
+// nullptr.
+typedef struct interlocked_wait_free_queue interlocked_wait_free_queue_t;
+typedef struct interlocked_wait_free_queue_handle interlocked_wait_free_queue_handle_t;
+
+typedef void     (*destructor_t)(const void*);
+
+interlocked_wait_free_queue_t* new_interlocked_wait_free_queue(destructor_t value_destructor, long max_threads);
+void delete_interlocked_wait_free_queue(interlocked_wait_free_queue_t* q);
+
+// returns nullptr if max_threads handles are already registered
+interlocked_wait_free_queue_handle_t* interlocked_wait_free_queue_register(interlocked_wait_free_queue_t* q);
+void interlocked_wait_free_queue_unregister(interlocked_wait_free_queue_t* q, interlocked_wait_free_queue_handle_t* h);
+
+void interlocked_wait_free_queue_push(interlocked_wait_free_queue_t* q, interlocked_wait_free_queue_handle_t* h, void* data);
+bool interlocked_wait_free_queue_pop(interlocked_wait_free_queue_t* q, interlocked_wait_free_queue_handle_t* h, void** output);
+bool interlocked_wait_free_queue_is_empty(const interlocked_wait_free_queue_t* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,7 @@
 #include "smr.hpp"
 
 #include "concurrent_auto_table.hpp"
+#include "backoff.h"
 
 #include <cassert>
 #include <boost/noncopyable.hpp>
@@ -80,6 +81,12 @@ struct non_blocking_unordered_map : boost::noncopyable, smr::smr_destructible {
 		_kvs.load()->values[0] = new (smr::smr) CHM();
 		_kvs.load()->values[1] = new (smr::smr) hash_array_type(1 << i);
 		_last_resize_milli = std::clock();
+		contention_init(&_contention, BACKOFF_NONE);
+	}
+
+	// the map's backoff policy and retry statistics
+	contention_t* contention() {
+		return &_contention;
 	}
 
 	size_t size() const {
@@ -465,6 +472,7 @@ private:
 		//}
 
 		// We are finally prepared to update the existing table
+		backoff_guard backoff(&topmap->_contention);
 		for(;;) {
 			assert(!is_prime(V.get_pointer()));
 			// Must match old, and we do not?  Then bail out now.  Note that either V
@@ -498,6 +506,7 @@ private:
 				                                                        : V,
 				                    clean_key, clean_value, clean_return);
 			}
+			backoff.failed();
 			V = val(kvs, idx);
 			if(map_type::is_prime(V.get_pointer())) {
 				return putIfMatch(topmap, chm->copy_slot_and_check(topmap, kvs, idx, expVal), key, putval, expVal);
@@ -563,12 +572,14 @@ private:
 		// null to set (once).
 		std::atomic<kv_array_type*> _newkvs;
 		// Set the _next field if we can.
-		bool CAS_newkvs(smr::stable_pointer<kv_array_type> newkvs) {
+		bool CAS_newkvs(map_type* topmap, smr::stable_pointer<kv_array_type> newkvs) {
+			backoff_guard backoff(&topmap->_contention);
 			while(_newkvs.load() == nullptr) {
 				kv_array_type* expected = nullptr;
 				if(_newkvs.compare_exchange_strong(expected, newkvs.get_pointer())) {
 					return true;
 				}
+				backoff.failed();
 			}
 			return false;
 		}
@@ -655,8 +666,12 @@ private:
 			// handful - lest we have 750 threads all trying to allocate a giant
 			// resized array.
 			size_t r = _resizers.load();
-			while(!_resizers.compare_exchange_strong(r, r + 1)) {
-				r = _resizers.load();
+			{
+				backoff_guard backoff(&topmap->_contention);
+				while(!_resizers.compare_exchange_strong(r, r + 1)) {
+					backoff.failed();
+					r = _resizers.load();
+				}
 			}
 
 			// Size calculation: 2 words (K+V) per table entry, plus a handful.
@@ -690,7 +705,7 @@ private:
 			
 			// The new table must be CAS'd in so only 1 winner amongst duplicate
 			// racing resizing threads. Extra CHM's will be GC'd.
-			if(!CAS_newkvs(newkvs)) {
+			if(!CAS_newkvs(topmap, newkvs)) {
 				smr::smr_destroy(newkvs.get_pointer(), &map_type::finalize_kvs, nullptr);
 				newkvs = _newkvs; // Reread new table
 			}
@@ -949,6 +964,8 @@ private:
 
 	// Time since last resize
 	std::clock_t _last_resize_milli;
+
+	CACHE_ALIGN contention_t _contention;
 	
 	static const size_t MIN_SIZE_LOG = 3;
 	static const size_t MIN_SIZE = (1 << MIN_SIZE_LOG);
@@ -0,0 +1,38 @@
+#ifndef OBJECT_POOL__H
+#define OBJECT_POOL__H
+
+#include "smr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// A pool of fixed-size, cache-aligned buffers. Each thread keeps a couple of
+// magazines (small arrays of buffers) to itself, so acquire and release are
+// normally a load and a store with no atomics. Only when both of a thread's
+// magazines are empty (or full) does it swap one for a full (or empty)
+// magazine from a shared depot, which is a pair of interlocked_stacks. When a
+// thread exits, its magazines go back to the depot.
+typedef struct object_pool object_pool_t;
+
+object_pool_t* new_object_pool(size_t object_size);
+// nothing else can be using the pool; buffers that are still out are the
+// caller's to free with smr_free
+void delete_object_pool(object_pool_t* p);
+
+void* object_pool_acquire(object_pool_t* p);
+void object_pool_release(object_pool_t* p, void* object);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef SLOPPY_COUNTER__HPP
+#define SLOPPY_COUNTER__HPP
+
+#include "concurrent_auto_table.hpp"
+#include "smr.hpp"
+
+#include <atomic>
+#include <new>
+
+#include <boost/noncopyable.hpp>
+
+// One thread's unflushed adds to one sloppy_counter. The record is shared by
+// the thread, which keeps it on its list, and the counter, which keeps it on
+// its own list, and whichever lets go of it last frees it.
+struct sloppy_record : boost::noncopyable {
+	explicit sloppy_record(ULONGLONG id) : counter_id(id), next_in_thread(nullptr), next_in_counter(nullptr), pending(0), refs(2) {
+	}
+
+	// adds the delta to the counter, if it's still around
+	virtual void flush() = 0;
+
+	// true once the counter is gone
+	virtual bool orphaned() const = 0;
+
+	// Counters of every type draw from the same ids, and they aren't reused,
+	// so a thread can't mistake a new counter for an old one that happened to
+	// live at the same address.
+	static ULONGLONG next_counter_id() {
+		static std::atomic<ULONGLONG> ids(0);
+		return ++ids;
+	}
+
+	void release() {
+		if(--refs == 0) {
+			this->~sloppy_record();
+			::operator delete(this, smr::smr);
+		}
+	}
+
+	const ULONGLONG counter_id;
+	sloppy_record* next_in_thread;
+	sloppy_record* next_in_counter;
+	size_t pending; // adds since the last flush
+
+protected:
+	virtual ~sloppy_record() {
+	}
+
+private:
+	std::atomic<LONG> refs;
+};
+
+// The calling thread's records, with the last one it used at the front. The
+// first counter a thread touches arranges for all of them to be flushed when
+// the thread exits.
+struct sloppy_thread_state {
+	static sloppy_thread_state& current() {
+		static thread_local sloppy_thread_state state;
+		if(!state.registered) {
+			state.registered = true;
+			smr::detail::smr_at_thread_exit(&sloppy_thread_state::at_exit, &state);
+		}
+		return state;
+	}
+
+	// finds the record for the counter, dropping any orphans on the way
+	sloppy_record* find(ULONGLONG counter_id) {
+		sloppy_record** prev = &records;
+		while(*prev != nullptr) {
+			sloppy_record* r = *prev;
+			if(r->counter_id == counter_id) {
+				// move it to the front, so the next lookup is a single compare
+				*prev = r->next_in_thread;
+				r->next_in_thread = records;
+				records = r;
+				return r;
+			}
+			if(r->orphaned()) {
+				*prev = r->next_in_thread;
+				r->release();
+				continue;
+			}
+			prev = &r->next_in_thread;
+		}
+		return nullptr;
+	}
+
+	void push(sloppy_record* r) {
+		r->next_in_thread = records;
+		records = r;
+	}
+
+	sloppy_record* records;
+
+private:
+	sloppy_thread_state() : records(nullptr), registered(false) {
+	}
+
+	static void at_exit(void* context) {
+		sloppy_thread_state* state = static_cast<sloppy_thread_state*>(context);
+		while(state->records != nullptr) {
+			sloppy_record* r = state->records;
+			state->records = r->next_in_thread;
+			r->flush();
+			r->release();
+		}
+	}
+
+	bool registered;
+};
+
+// A counter for statistics that can stand to be a little behind. Each thread
+// adds into a plain thread-private delta, and only folds it into a shared
+// concurrent_auto_table every flush_interval adds, when it calls flush(), and
+// when it exits; the common case is an ordinary add and compare, with no
+// locked instruction at all.
+//
+// get() reports what has been folded in so far. For each thread that has
+// added to the counter and not yet exited, it can be missing up to
+// flush_interval - 1 of that thread's adds, and nothing else, so with
+// increments alone it's short by at most threads * (flush_interval - 1).
+// Adds are never lost, except those still pending when the counter is
+// destroyed.
+template<typename T, typename Layout = cat_packed_layout>
+struct sloppy_counter : boost::noncopyable {
+	typedef T integer_type;
+	typedef concurrent_auto_table<integer_type, Layout> table_type;
+
+	static const size_t default_flush_interval = 1024;
+
+	explicit sloppy_counter(size_t flush_every = default_flush_interval) : shared(new (smr::smr) table_type()), records(nullptr), id(sloppy_record::next_counter_id()), interval(flush_every != 0 ? flush_every : 1) {
+	}
+
+	// not thread-safe; nobody else can be adding by now, but threads that did
+	// may still be running, so their records are orphaned rather than freed
+	~sloppy_counter() {
+		sloppy_record* r = records.load();
+		while(r != nullptr) {
+			sloppy_record* next = r->next_in_counter;
+			static_cast<record*>(r)->table.store(nullptr);
+			r->release();
+			r = next;
+		}
+		smr::smr_destroy(shared);
+	}
+
+	void add(integer_type x) {
+		record* r = local();
+		r->delta += x;
+		if(++r->pending >= interval) {
+			r->flush();
+		}
+	}
+
+	void increment() {
+		add(static_cast<integer_type>(1));
+	}
+
+	void decrement() {
+		add(static_cast<integer_type>(-1));
+	}
+
+	// folds the calling thread's delta in now
+	void flush() {
+		local()->flush();
+	}
+
+	integer_type get() const {
+		return shared->get();
+	}
+
+	integer_type estimate_get() const {
+		return shared->estimate_get();
+	}
+
+	size_t flush_interval() const {
+		return interval;
+	}
+
+private:
+	struct record : sloppy_record {
+		record(ULONGLONG id, table_type* t) : sloppy_record(id), delta(), table(t) {
+		}
+
+		virtual void flush() {
+			pending = 0;
+			if(delta == integer_type()) {
+				return;
+			}
+			smr::hazard_pointers<1> hazards;
+
+			// the counter clears table before it retires it
+			table_type* t = nullptr;
+			for(;;) {
+				t = table.load();
+				hazards[0] = t;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(t == table.load()) {
+					break;
+				}
+			}
+			if(t != nullptr) {
+				t->add(delta);
+			}
+			delta = integer_type();
+		}
+
+		virtual bool orphaned() const {
+			return table.load() == nullptr;
+		}
+
+		integer_type delta;
+		std::atomic<table_type*> table;
+	};
+
+	record* local() {
+		sloppy_thread_state& state = sloppy_thread_state::current();
+		if(state.records != nullptr && state.records->counter_id == id) {
+			return static_cast<record*>(state.records);
+		}
+		sloppy_record* r = state.find(id);
+		if(r == nullptr) {
+			r = new (smr::smr) record(id, shared);
+			sloppy_record* head = records.load();
+			do {
+				r->next_in_counter = head;
+			} while(!records.compare_exchange_weak(head, r));
+			state.push(r);
+		}
+		return static_cast<record*>(r);
+	}
+
+	table_type* shared;
+	std::atomic<sloppy_record*> records;
+	const ULONGLONG id;
+	const size_t interval;
+};
+
+#endif
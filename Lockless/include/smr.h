@@ -35,6 +35,18 @@ void report_remaining_objects();
 void* allocate_hazard_pointers(LONG count, void* volatile** pointers);
 void deallocate_hazard_pointers(void* key);
 
+// Sets up the calling thread's SMR record, and caches hazard_count hazard
+// pointers for it, so that its first container operation doesn't pay for it.
+// Optional; threads that don't call it get set up on first use.
+void smr_thread_attach(LONG hazard_count);
+
+typedef void (*thread_exit_callback_t)(void* context);
+
+// Runs callback on the calling thread as it exits, most recently registered
+// first, while it can still use containers. For per-thread caches that have
+// to hand back what they're holding.
+void smr_at_thread_exit(thread_exit_callback_t callback, void* context);
+
 bool cas(volatile LONG* addr, LONG expected_value, LONG new_value);
 bool casp(void* volatile* addr, void* expected_value, void* new_value);
 bool tas(volatile LONG* addr);
@@ -0,0 +1,55 @@
+#ifndef TASK_SCHEDULER__H
+#define TASK_SCHEDULER__H
+
+#include "smr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __cplusplus
+#define nullptr NULL
+typedef char bool;
+#define false 0
+#define true 1
+#endif
+
+// A work-stealing thread pool. Each worker has its own interlocked_deque;
+// tasks submitted from a worker go on its deque, and tasks submitted from
+// anywhere else go on a shared interlocked_queue. Workers with nothing to do
+// steal from each other, and then park until more work turns up.
+typedef struct task_scheduler task_scheduler_t;
+
+typedef void (*task_proc_t)(void* context);
+typedef void (*range_proc_t)(size_t begin, size_t end, void* context);
+
+// Counts the tasks submitted against it that haven't finished yet, so that
+// they can be waited for. Zero it before use; it can live on the stack.
+typedef struct task_group
+{
+	volatile LONG pending;
+} task_group_t;
+
+// worker_count 0 means one per processor. Pinned workers are bound to a
+// processor each, round-robin.
+task_scheduler_t* new_task_scheduler(size_t worker_count, bool pin_workers);
+// runs whatever is still queued, then stops the workers
+void delete_task_scheduler(task_scheduler_t* s);
+
+size_t task_scheduler_worker_count(const task_scheduler_t* s);
+
+// group can be nullptr if nobody is going to wait for the task
+void task_scheduler_submit(task_scheduler_t* s, task_group_t* group, task_proc_t proc, void* context);
+// runs other tasks until everything in the group has finished
+void task_scheduler_wait(task_scheduler_t* s, task_group_t* group);
+
+// calls body on pieces of [begin, end) no bigger than grain, in parallel,
+// and returns once they've all finished
+void task_scheduler_parallel_for(task_scheduler_t* s, size_t begin, size_t end, size_t grain, range_proc_t body, void* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef TASK_SCHEDULER_HPP
+#define TASK_SCHEDULER_HPP
+
+#include "task_scheduler.h"
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <boost/utility.hpp>
+
+namespace utility
+{
+	struct task_group : boost::noncopyable {
+		task_group() {
+			g.pending = 0;
+		}
+
+		::task_group_t* get() {
+			return &g;
+		}
+
+	private:
+		::task_group_t g;
+	};
+
+	// tasks run inside the C scheduler, so they mustn't let exceptions escape
+	struct task_scheduler : boost::noncopyable {
+		typedef size_t size_type;
+
+		explicit task_scheduler(size_type worker_count = 0, bool pin_workers = false) : s(::new_task_scheduler(worker_count, pin_workers))
+		{
+		}
+
+		~task_scheduler() {
+		}
+
+		size_type worker_count() const {
+			return ::task_scheduler_worker_count(s.get());
+		}
+
+		template<typename F>
+		void submit(F&& f) {
+			enqueue(nullptr, std::forward<F>(f));
+		}
+
+		template<typename F>
+		void submit(task_group& g, F&& f) {
+			enqueue(g.get(), std::forward<F>(f));
+		}
+
+		void wait(task_group& g) {
+			::task_scheduler_wait(s.get(), g.get());
+		}
+
+		// calls f(i) for every i in [begin, end), grain indices to a task
+		template<typename F>
+		void parallel_for(size_type begin, size_type end, size_type grain, F f) {
+			::task_scheduler_parallel_for(s.get(), begin, end, grain, &my_type::range_trampoline<F>, &f);
+		}
+
+	private:
+		typedef task_scheduler my_type;
+
+		template<typename F>
+		void enqueue(::task_group_t* g, F&& f) {
+			typedef typename std::decay<F>::type function_type;
+			::task_scheduler_submit(s.get(), g, &my_type::task_trampoline<function_type>, new function_type(std::forward<F>(f)));
+		}
+
+		template<typename F>
+		static void task_trampoline(void* context) {
+			std::unique_ptr<F> f(static_cast<F*>(context));
+			(*f)();
+		}
+
+		template<typename F>
+		static void range_trampoline(size_t begin, size_t end, void* context) {
+			F& f(*static_cast<F*>(context));
+			for(size_t i(begin); i != end; ++i) {
+				f(i);
+			}
+		}
+
+		struct scheduler_delete {
+			void operator()(::task_scheduler* s) const {
+				::delete_task_scheduler(s);
+			}
+		};
+
+		std::unique_ptr<::task_scheduler, scheduler_delete> s;
+	};
+}
+
+#endif
@@ -0,0 +1,113 @@
+#include "stdafx.h"
+
+#include "backoff.h"
+
+#include <intrin.h>
+
+// exponential backoff tops out at 2^MAX_EXPONENT pauses
+#define MAX_EXPONENT	10
+// proportional backoff waits this many pauses per estimated contender
+#define PAUSES_PER_CONTENDER	16
+#define MAX_LEVEL	64
+
+void contention_init(contention_t* c, backoff_policy_t policy)
+{
+	memset(c, 0, sizeof(contention_t));
+	c->policy = policy;
+}
+
+void contention_set_policy(contention_t* c, backoff_policy_t policy)
+{
+	c->policy = policy;
+}
+
+backoff_policy_t contention_get_policy(const contention_t* c)
+{
+	return (backoff_policy_t)c->policy;
+}
+
+void contention_get_stats(const contention_t* c, contention_stats_t* stats)
+{
+	stats->contended_operations = InterlockedCompareExchange64((volatile LONG64*)&c->contended_operations, 0, 0);
+	stats->retries = InterlockedCompareExchange64((volatile LONG64*)&c->retries, 0, 0);
+	stats->pauses = InterlockedCompareExchange64((volatile LONG64*)&c->pauses, 0, 0);
+}
+
+void contention_reset_stats(contention_t* c)
+{
+	InterlockedExchange64(&c->contended_operations, 0);
+	InterlockedExchange64(&c->retries, 0);
+	InterlockedExchange64(&c->pauses, 0);
+}
+
+void backoff_init(backoff_t* b, contention_t* c)
+{
+	b->contention = c;
+	b->failures = 0;
+	b->pauses = 0;
+}
+
+static void spin(backoff_t* b, ULONG pauses)
+{
+	ULONG i = 0;
+	for(i = 0; i < pauses; ++i)
+	{
+		YieldProcessor();
+	}
+	b->pauses += pauses;
+}
+
+void backoff_failed(backoff_t* b)
+{
+	contention_t* c = b->contention;
+	ULONG ceiling = 0;
+	LONG level = 0;
+
+	++b->failures;
+	switch(c->policy)
+	{
+	case BACKOFF_NONE:
+		break;
+	case BACKOFF_EXPONENTIAL:
+		// a random wait in the top half of the window, so threads that
+		// collided don't come back in lockstep
+		ceiling = 1UL << (b->failures < MAX_EXPONENT ? b->failures : MAX_EXPONENT);
+		spin(b, (ceiling / 2) + ((ULONG)__rdtsc() & (((ceiling / 2) - 1) | 1)));
+		break;
+	case BACKOFF_PROPORTIONAL:
+		// the estimate is only a hint, so racing updates to it don't matter
+		level = c->level;
+		if(level < MAX_LEVEL)
+		{
+			c->level = ++level;
+		}
+		spin(b, (ULONG)level * PAUSES_PER_CONTENDER);
+		break;
+	case BACKOFF_YIELD:
+		SwitchToThread();
+		break;
+	}
+}
+
+void backoff_done(backoff_t* b)
+{
+	contention_t* c = b->contention;
+	// nothing on the uncontended path writes to the shared line
+	if(b->failures == 0)
+	{
+		return;
+	}
+	// Getting through at the second attempt means contention is dying down.
+	// Operations that get through first time leave the estimate alone, so a
+	// stale estimate only lasts until the next retry that succeeds quickly.
+	if(b->failures == 1 && c->policy == BACKOFF_PROPORTIONAL && c->level > 0)
+	{
+		c->level = c->level - 1;
+	}
+	InterlockedIncrement64(&c->contended_operations);
+	InterlockedExchangeAdd64(&c->retries, b->failures);
+	if(b->pauses != 0)
+	{
+		InterlockedExchangeAdd64(&c->pauses, b->pauses);
+	}
+}
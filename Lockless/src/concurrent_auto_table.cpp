@@ -8,3 +8,11 @@ template struct concurrent_auto_table<long>;
 template struct concurrent_auto_table<unsigned long>;
 template struct concurrent_auto_table<long long>;
 template struct concurrent_auto_table<unsigned long long>;
+
+template struct concurrent_auto_table<long long, cat_padded_layout>;
+template struct concurrent_auto_table<unsigned long long, cat_padded_layout>;
+template struct concurrent_auto_table<long long, cat_pair_padded_layout>;
+template struct concurrent_auto_table<unsigned long long, cat_pair_padded_layout>;
+
+template struct concurrent_auto_table<long long, cat_padded_layout, cat_cpu_probe>;
+template struct concurrent_auto_table<unsigned long long, cat_padded_layout, cat_cpu_probe>;
@@ -0,0 +1,47 @@
+#include "stdafx.hpp"
+
+#include "concurrent_auto_table.hpp"
+#include "concurrent_counter.h"
+
+// the C handle is just the table itself
+typedef concurrent_auto_table<long long> counter_type;
+
+static counter_type* as_table(concurrent_counter_t* c) {
+	return reinterpret_cast<counter_type*>(c);
+}
+
+static const counter_type* as_table(const concurrent_counter_t* c) {
+	return reinterpret_cast<const counter_type*>(c);
+}
+
+extern "C" concurrent_counter_t* new_concurrent_counter(void) {
+	return reinterpret_cast<concurrent_counter_t*>(new (smr::smr) counter_type());
+}
+
+extern "C" void delete_concurrent_counter(concurrent_counter_t* c) {
+	smr::smr_destroy(as_table(c));
+}
+
+extern "C" void concurrent_counter_add(concurrent_counter_t* c, LONG64 x) {
+	as_table(c)->add(x);
+}
+
+extern "C" void concurrent_counter_increment(concurrent_counter_t* c) {
+	as_table(c)->increment();
+}
+
+extern "C" void concurrent_counter_decrement(concurrent_counter_t* c) {
+	as_table(c)->decrement();
+}
+
+extern "C" LONG64 concurrent_counter_get(const concurrent_counter_t* c) {
+	return as_table(c)->get();
+}
+
+extern "C" LONG64 concurrent_counter_estimate_get(const concurrent_counter_t* c) {
+	return as_table(c)->estimate_get();
+}
+
+extern "C" LONG64 concurrent_counter_get_with_staleness(const concurrent_counter_t* c, ULONGLONG max_staleness) {
+	return as_table(c)->get_with_staleness(max_staleness);
+}
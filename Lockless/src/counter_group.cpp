@@ -0,0 +1,8 @@
+#include "stdafx.hpp"
+
+#include "counter_group.hpp"
+
+// force instantiation
+template struct counter_group<long long>;
+template struct counter_group<unsigned long long>;
+template struct counter_group<unsigned long long, cat_cpu_probe>;
@@ -0,0 +1,173 @@
+#include "stdafx.h"
+
+#include "interlocked_deque.h"
+
+#define INITIAL_SIZE	64
+
+typedef struct interlocked_deque_array
+{
+	LONG size;
+	void* volatile slots[1];
+} interlocked_deque_array_t;
+
+interlocked_deque_array_t* new_interlocked_deque_array(LONG size)
+{
+	size_t bytes = sizeof(interlocked_deque_array_t) + ((size - 1) * sizeof(void*));
+	interlocked_deque_array_t* a = smr_alloc(bytes);
+	memset(a, 0, bytes);
+	a->size = size;
+	return a;
+}
+
+// The indices only ever go up, and are allowed to wrap; they are only ever
+// compared through their difference, which stays small.
+typedef struct interlocked_deque
+{
+	CACHE_ALIGN volatile LONG top;
+	CACHE_ALIGN volatile LONG bottom;
+	CACHE_ALIGN interlocked_deque_array_t* volatile array;
+
+	destructor_t value_destructor;
+} interlocked_deque_t;
+
+static LONG distance(LONG from, LONG to)
+{
+	return (LONG)((ULONG)to - (ULONG)from);
+}
+
+static void* volatile* slot(interlocked_deque_array_t* a, LONG index)
+{
+	return &a->slots[(ULONG)index & (ULONG)(a->size - 1)];
+}
+
+interlocked_deque_t* new_interlocked_deque(destructor_t value_destructor)
+{
+	interlocked_deque_t* d = smr_alloc(sizeof(interlocked_deque_t));
+	memset(d, 0, sizeof(interlocked_deque_t));
+	d->array = new_interlocked_deque_array(INITIAL_SIZE);
+	d->value_destructor = value_destructor;
+	return d;
+}
+
+void delete_interlocked_deque(interlocked_deque_t* d)
+{
+	void* value;
+	while(interlocked_deque_pop(d, &value))
+	{
+		d->value_destructor(value);
+	}
+	smr_retire(d->array);
+	d->array = nullptr;
+	smr_retire(d);
+}
+
+// Copies the live range into an array twice the size. Thieves may still be
+// reading the old array, so it's retired rather than freed; a thief that reads
+// a stale slot from either array loses its CAS on top anyway.
+static interlocked_deque_array_t* grow(interlocked_deque_t* d, interlocked_deque_array_t* a, LONG top, LONG bottom)
+{
+	interlocked_deque_array_t* bigger = new_interlocked_deque_array(a->size * 2);
+	LONG i = 0;
+	for(i = top; i != bottom; ++i)
+	{
+		*slot(bigger, i) = *slot(a, i);
+	}
+	d->array = bigger;
+	smr_retire(a);
+	return bigger;
+}
+
+void interlocked_deque_push(interlocked_deque_t* d, void* data)
+{
+	LONG bottom = d->bottom;
+	LONG top = d->top;
+	interlocked_deque_array_t* a = d->array;
+
+	if(distance(top, bottom) >= a->size)
+	{
+		a = grow(d, a, top, bottom);
+	}
+	*slot(a, bottom) = data;
+	// volatile stores are releases, so the slot is visible before the new bottom
+	d->bottom = bottom + 1;
+}
+
+bool interlocked_deque_pop(interlocked_deque_t* d, void** output)
+{
+	LONG bottom = d->bottom - 1;
+	LONG top = 0;
+	LONG remaining = 0;
+	interlocked_deque_array_t* a = d->array;
+	void* data = nullptr;
+
+	d->bottom = bottom;
+	// the store to bottom has to be visible before we look at top, or a thief
+	// and the owner can both take the last element
+	MemoryBarrier();
+	top = d->top;
+
+	remaining = distance(top, bottom);
+	if(remaining < 0)
+	{
+		d->bottom = top;
+		if(output) { *output = nullptr; }
+		return false;
+	}
+	data = *slot(a, bottom);
+	if(remaining == 0)
+	{
+		// the last element; race the thieves for it
+		if(!cas(&d->top, top, top + 1))
+		{
+			data = nullptr;
+		}
+		d->bottom = top + 1;
+	}
+	if(output) { *output = data; }
+	return data != nullptr;
+}
+
+bool interlocked_deque_steal(interlocked_deque_t* d, void** output)
+{
+	LONG top = 0;
+	LONG bottom = 0;
+	interlocked_deque_array_t* a = nullptr;
+	void* data = nullptr;
+	void* volatile* hazards[1] = { nullptr };
+	void* key = allocate_hazard_pointers(1, hazards);
+	if(!hazards[0]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	top = d->top;
+	MemoryBarrier();
+	bottom = d->bottom;
+	if(distance(top, bottom) > 0)
+	{
+		do
+		{
+			a = d->array;
+			*hazards[0] = a;
+			MemoryBarrier();
+		}
+		while(d->array != a);
+		data = *slot(a, top);
+		if(!cas(&d->top, top, top + 1))
+		{
+			data = nullptr;
+		}
+	}
+
+	deallocate_hazard_pointers(key);
+	if(output) { *output = data; }
+	return data != nullptr;
+}
+
+bool interlocked_deque_is_empty(const interlocked_deque_t* d)
+{
+	return distance(d->top, d->bottom) <= 0;
+}
+
+long interlocked_deque_depth(const interlocked_deque_t* d)
+{
+	LONG depth = distance(d->top, d->bottom);
+	return depth > 0 ? depth : 0;
+}
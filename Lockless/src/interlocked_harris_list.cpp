@@ -0,0 +1,13 @@
+#include "stdafx.hpp"
+
+#include "interlocked_harris_list.hpp"
+
+#include <string>
+
+// force instantiation
+
+// primitive (no-destructor) types
+template struct utility::interlocked_harris_list<int, int>;
+
+// complex (class) types
+template struct utility::interlocked_harris_list<std::string, std::string>;
@@ -0,0 +1,302 @@
+#include "stdafx.h"
+
+#include "interlocked_hash_set.h"
+#include "interlocked_kv_list_nodes.h"
+#include "concurrent_counter.h"
+
+// The bucket directory is a set of segments that double in size, so it never
+// gets copied either: segment 0 holds buckets 0 and 1, and segment i > 0 holds
+// buckets [2^i, 2^(i + 1)). Segments are allocated the first time one of their
+// buckets is used.
+#define MIN_BUCKETS	2
+#define MAX_BUCKETS	((LONG)1 << 30)
+#define SEGMENT_COUNT	31
+// the average number of keys per bucket before the bucket count doubles
+#define MAX_LOAD	2
+
+typedef struct split_key
+{
+	// the hash with its bits reversed. Real keys have the low bit set, and
+	// bucket sentinels have it clear, so each sentinel sorts just before the
+	// keys in its bucket.
+	ULONGLONG order;
+	const void* key;
+	// the list's comparator only gets to see the key, so each key carries the
+	// set's comparator with it
+	key_cmp cmp;
+} split_key_t;
+
+// The node's key is its split key. The set's own key goes in as the node's
+// value too, so that the list's finalizer destroys it.
+typedef struct hash_set_node
+{
+	interlocked_kv_list_node_t node;
+	split_key_t key;
+} hash_set_node_t;
+
+typedef struct interlocked_hash_set
+{
+	key_hash hash;
+	key_cmp cmp;
+	interlocked_kv_list_node_destructors_t key_destructors;
+	interlocked_kv_list_node_destructors_t sentinel_destructors;
+	concurrent_counter_t* count;
+	CACHE_ALIGN volatile LONG bucket_count;
+	CACHE_ALIGN hash_set_node_t* volatile* volatile segments[SEGMENT_COUNT];
+	CACHE_ALIGN contention_t contention;
+} interlocked_hash_set_t;
+
+static ULONGLONG reverse_bits(ULONGLONG x)
+{
+	x = ((x >>  1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) <<  1);
+	x = ((x >>  2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) <<  2);
+	x = ((x >>  4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) <<  4);
+	x = ((x >>  8) & 0x00ff00ff00ff00ffULL) | ((x & 0x00ff00ff00ff00ffULL) <<  8);
+	x = ((x >> 16) & 0x0000ffff0000ffffULL) | ((x & 0x0000ffff0000ffffULL) << 16);
+	return (x >> 32) | (x << 32);
+}
+
+static ULONGLONG key_order(size_t hash)
+{
+	return reverse_bits((ULONGLONG)hash | 0x8000000000000000ULL);
+}
+
+static ULONGLONG sentinel_order(ULONG bucket)
+{
+	return reverse_bits(bucket);
+}
+
+static int compare_split_keys(const void* l, const void* r)
+{
+	const split_key_t* lhs = l;
+	const split_key_t* rhs = r;
+	if(lhs->order != rhs->order)
+	{
+		return lhs->order < rhs->order ? -1 : 1;
+	}
+	if((lhs->order & 1) == 0)
+	{
+		return 0;
+	}
+	return lhs->cmp(lhs->key, rhs->key);
+}
+
+static void ignore(const void* p)
+{
+	UNREFERENCED_PARAMETER(p);
+}
+
+static hash_set_node_t* new_hash_set_node(interlocked_hash_set_t* s, ULONGLONG order, const void* key)
+{
+	hash_set_node_t* n = smr_alloc(sizeof(hash_set_node_t));
+	n->node.next = nullptr;
+	n->node.key = &n->key;
+	n->node.value = (void*)key;
+	n->node.destructors = (order & 1) == 1 ? s->key_destructors : s->sentinel_destructors;
+	n->key.order = order;
+	n->key.key = key;
+	n->key.cmp = s->cmp;
+	return n;
+}
+
+interlocked_hash_set_t* new_interlocked_hash_set(key_hash hash, key_cmp cmp, destructor_t key_destructor)
+{
+	interlocked_hash_set_t* s = smr_alloc(sizeof(interlocked_hash_set_t));
+	memset(s, 0, sizeof(interlocked_hash_set_t));
+	s->hash = hash;
+	s->cmp = cmp;
+	s->key_destructors.key_destructor = &ignore;
+	s->key_destructors.value_destructor = key_destructor;
+	s->sentinel_destructors.key_destructor = &ignore;
+	s->sentinel_destructors.value_destructor = &ignore;
+	s->count = new_concurrent_counter();
+	s->bucket_count = MIN_BUCKETS;
+	s->segments[0] = smr_alloc(MIN_BUCKETS * sizeof(hash_set_node_t*));
+	memset((void*)s->segments[0], 0, MIN_BUCKETS * sizeof(hash_set_node_t*));
+	// bucket 0's sentinel is the head of the whole list
+	s->segments[0][0] = new_hash_set_node(s, sentinel_order(0), nullptr);
+	contention_init(&s->contention, BACKOFF_NONE);
+	return s;
+}
+
+void delete_interlocked_hash_set(interlocked_hash_set_t* s)
+{
+	interlocked_kv_list_node_t* n = &s->segments[0][0]->node;
+	interlocked_kv_list_node_t* next = nullptr;
+	LONG i = 0;
+
+	// nobody else is using the set, so the list can be taken apart directly,
+	// deleted nodes that haven't been unlinked yet included
+	while(n != nullptr)
+	{
+		next = kv_list_node_mark_as_undeleted(n->next);
+		retire_kv_list_node(n);
+		n = next;
+	}
+	for(i = 0; i < SEGMENT_COUNT; ++i)
+	{
+		if(s->segments[i] != nullptr)
+		{
+			smr_retire((void*)s->segments[i]);
+		}
+	}
+	delete_concurrent_counter(s->count);
+	smr_retire(s);
+}
+
+static hash_set_node_t* volatile* get_bucket_slot(interlocked_hash_set_t* s, ULONG bucket)
+{
+	ULONG segment = 0;
+	ULONG first = 0;
+	hash_set_node_t* volatile* buckets = nullptr;
+
+	if(bucket >= MIN_BUCKETS)
+	{
+		BitScanReverse(&segment, bucket);
+		first = 1UL << segment;
+	}
+	buckets = s->segments[segment];
+	if(buckets == nullptr)
+	{
+		size_t size = (segment == 0 ? MIN_BUCKETS : first) * sizeof(hash_set_node_t*);
+		hash_set_node_t* volatile* fresh = smr_alloc(size);
+		memset((void*)fresh, 0, size);
+		if(casp((void* volatile*)&s->segments[segment], nullptr, (void*)fresh))
+		{
+			buckets = fresh;
+		}
+		else
+		{
+			smr_free((void*)fresh);
+			buckets = s->segments[segment];
+		}
+	}
+	return &buckets[bucket - first];
+}
+
+// A bucket's sentinel goes into the list just after its parent's, the parent
+// being the bucket it was split from: the same index without its top bit.
+static hash_set_node_t* get_bucket(interlocked_hash_set_t* s, ULONG bucket, void* volatile** hazards, backoff_t* b)
+{
+	hash_set_node_t* volatile* slot = get_bucket_slot(s, bucket);
+	hash_set_node_t* parent = nullptr;
+	hash_set_node_t* sentinel = nullptr;
+	per_thread_vars_t v = {0};
+	ULONG top = 0;
+
+	if(*slot != nullptr)
+	{
+		return *slot;
+	}
+	BitScanReverse(&top, bucket);
+	parent = get_bucket(s, bucket & ~(1UL << top), hazards, b);
+	sentinel = new_hash_set_node(s, sentinel_order(bucket), nullptr);
+	if(!kv_list_node_insert(&parent->node.next, &sentinel->node, &compare_split_keys, &v, hazards, b))
+	{
+		// someone else got there first. Sentinels are never deleted, so it
+		// doesn't need protecting
+		smr_free(sentinel);
+		sentinel = (hash_set_node_t*)v.current;
+	}
+	casp((void* volatile*)slot, nullptr, sentinel);
+	return sentinel;
+}
+
+static hash_set_node_t* get_bucket_for(interlocked_hash_set_t* s, size_t hash, void* volatile** hazards, backoff_t* b)
+{
+	return get_bucket(s, (ULONG)(hash & (size_t)(s->bucket_count - 1)), hazards, b);
+}
+
+static void grow(interlocked_hash_set_t* s)
+{
+	LONG buckets = s->bucket_count;
+	if(buckets < MAX_BUCKETS && concurrent_counter_estimate_get(s->count) > (LONG64)buckets * MAX_LOAD)
+	{
+		// the new buckets fill themselves in as they're used
+		cas(&s->bucket_count, buckets, buckets * 2);
+	}
+}
+
+bool interlocked_hash_set_insert(interlocked_hash_set_t* s, const void* key)
+{
+	size_t hash = s->hash(key);
+	hash_set_node_t* node = new_hash_set_node(s, key_order(hash), key);
+	hash_set_node_t* bucket = nullptr;
+	per_thread_vars_t v = {0};
+	backoff_t b;
+	bool inserted = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	bucket = get_bucket_for(s, hash, hazards, &b);
+	inserted = kv_list_node_insert(&bucket->node.next, &node->node, &compare_split_keys, &v, hazards, &b);
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	if(inserted)
+	{
+		concurrent_counter_increment(s->count);
+		grow(s);
+	}
+	else
+	{
+		smr_free(node);
+	}
+	return inserted;
+}
+
+bool interlocked_hash_set_delete(interlocked_hash_set_t* s, const void* key)
+{
+	size_t hash = s->hash(key);
+	split_key_t k = { key_order(hash), key, s->cmp };
+	hash_set_node_t* bucket = nullptr;
+	per_thread_vars_t v = {0};
+	backoff_t b;
+	bool deleted = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	bucket = get_bucket_for(s, hash, hazards, &b);
+	deleted = kv_list_node_delete(&bucket->node.next, &k, &compare_split_keys, &v, hazards, &b);
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	if(deleted)
+	{
+		concurrent_counter_decrement(s->count);
+	}
+	return deleted;
+}
+
+bool interlocked_hash_set_contains(interlocked_hash_set_t* s, const void* key)
+{
+	size_t hash = s->hash(key);
+	split_key_t k = { key_order(hash), key, s->cmp };
+	hash_set_node_t* bucket = nullptr;
+	per_thread_vars_t v = {0};
+	backoff_t b;
+	bool found = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	bucket = get_bucket_for(s, hash, hazards, &b);
+	found = kv_list_node_find(&bucket->node.next, &k, &compare_split_keys, &v, hazards, &b);
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	return found;
+}
+
+size_t interlocked_hash_set_size(const interlocked_hash_set_t* s)
+{
+	LONG64 count = concurrent_counter_get(s->count);
+	return count > 0 ? (size_t)count : 0;
+}
+
+contention_t* interlocked_hash_set_contention(interlocked_hash_set_t* s)
+{
+	return &s->contention;
+}
@@ -1,37 +1,73 @@
 #include "stdafx.h"
 
 #include "interlocked_kv_list.h"
+#include "interlocked_kv_list_nodes.h"
+#include "backoff.h"
 
-typedef struct interlocked_kv_list_node {
-	struct interlocked_kv_list_node* next;
-	const void* key;
-	void* value;
-} interlocked_kv_list_node_t;
-
-typedef struct interlocked_kv_list_node_destructors {
-	destructor_t key_destructor;
-	destructor_t value_destructor;
-} interlocked_kv_list_node_destructors_t;
-
-interlocked_kv_list_node_t* new_interlocked_kv_list_node(const void* key, void* value) {
+interlocked_kv_list_node_t* new_interlocked_kv_list_node(const void* key, void* value, const interlocked_kv_list_node_destructors_t* destructors) {
 	interlocked_kv_list_node_t* n = smr_alloc(sizeof(interlocked_kv_list_node_t));
 	n->next = nullptr;
 	n->key = key;
 	n->value = value;
+	n->destructors = *destructors;
 	return n;
 }
 
-typedef CACHE_ALIGN struct per_thread_vars {
-	CACHE_ALIGN interlocked_kv_list_node_t** prev;
-	CACHE_ALIGN interlocked_kv_list_node_t* current;
-	CACHE_ALIGN interlocked_kv_list_node_t* next;
-} per_thread_vars_t;
+bool finalize_node(void* context, void* ptr) {
+	interlocked_kv_list_node_t* node = ptr;
+	UNREFERENCED_PARAMETER(context);
+
+	node->destructors.key_destructor(node->key);
+	node->destructors.value_destructor(node->value);
+	return true;
+}
+
+void retire_kv_list_node(interlocked_kv_list_node_t* node) {
+	smr_retire_with_finalizer(node, &finalize_node, nullptr);
+}
+
+// values belong to the caller's allocator, not SMR, so this only destroys them
+static bool finalize_value(void* context, void* ptr) {
+	destructor_t value_destructor = (destructor_t)context;
+	value_destructor(ptr);
+	return false;
+}
+
+// a value that's been swapped out of a node may still be in use by a reader
+// that got to it first
+static void retire_value(interlocked_kv_list_node_t* node, void* value) {
+	smr_retire_with_finalizer(value, &finalize_value, (void*)node->destructors.value_destructor);
+}
+
+static bool swap_value(interlocked_kv_list_node_t* node, void* expected, void* desired) {
+	if(!casp((void* volatile*)&node->value, expected, desired)) {
+		return false;
+	}
+	// there's nothing to destroy in a nullptr, and a value that's been put back
+	// in place of itself is still in use
+	if(expected != nullptr && expected != desired) {
+		retire_value(node, expected);
+	}
+	return true;
+}
+
+// loads the node's value and keeps it covered by the hazard pointer
+static void* protect_value(interlocked_kv_list_node_t* node, void* volatile* hazard) {
+	void* value = nullptr;
+	do {
+		value = node->value;
+		*hazard = value;
+		MemoryBarrier();
+	} while(node->value != value);
+	return value;
+}
 
 typedef struct interlocked_kv_list {
 	interlocked_kv_list_node_t* head;
 
 	key_cmp cmp;
 	interlocked_kv_list_node_destructors_t destructors;
+	CACHE_ALIGN contention_t contention;
 } interlocked_kv_list_t;
 
 interlocked_kv_list_t* new_interlocked_kv_list(key_cmp cmp, destructor_t key_destructor, destructor_t value_destructor) {
@@ -40,6 +76,7 @@ interlocked_kv_list_t* new_interlocked_kv_list(key_cmp cmp, destructor_t key_des
 	s->cmp = cmp;
 	s->destructors.key_destructor = key_destructor;
 	s->destructors.value_destructor = value_destructor;
+	contention_init(&s->contention, BACKOFF_NONE);
 	return s;
 }
 
@@ -60,47 +97,45 @@ void delete_interlocked_kv_list(interlocked_kv_list_t* s) {
 	smr_retire(s);
 }
 
-void* mark_as_deleted(void* ptr) {
-	return (void*)((size_t)ptr & 1);
+void* kv_list_node_mark_as_deleted(void* ptr) {
+	return (void*)((size_t)ptr | 1);
 }
 
-void* mark_as_undeleted(void* ptr) {
+void* kv_list_node_mark_as_undeleted(void* ptr) {
 	return (void*)((size_t)ptr & ~1);
 }
 
-bool test_if_deleted(void* ptr) {
+bool kv_list_node_test_if_deleted(void* ptr) {
 	return ((size_t)ptr & 1) == 1;
 }
 
-bool find(interlocked_kv_list_node_t** head, const void* key, key_cmp cmp, per_thread_vars_t* v) {
-	void* volatile* hazards[2] = { nullptr };
-	void* hkey = allocate_hazard_pointers(2, hazards);
-	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
-
+bool kv_list_node_find(interlocked_kv_list_node_t** head, const void* key, key_cmp cmp, per_thread_vars_t* v, void* volatile** hazards, backoff_t* b) {
 try_again:
 	v->prev = head;
 	v->current = *v->prev;
 	while(v->current != nullptr) {
 		*hazards[0] = v->current;
+		MemoryBarrier();
 		if(*v->prev != v->current) {
+			backoff_failed(b);
 			goto try_again;
 		}
 		v->next = v->current->next;
-		if(test_if_deleted(v->next)) {
-			if(!casp((void* volatile*)v->prev, v->current, mark_as_undeleted(v->next))) {
+		if(kv_list_node_test_if_deleted(v->next)) {
+			if(!casp((void* volatile*)v->prev, v->current, kv_list_node_mark_as_undeleted(v->next))) {
+				backoff_failed(b);
 				goto try_again;
 			}
-			smr_retire(v->current);
-			v->current = mark_as_undeleted(v->next);
+			retire_kv_list_node(v->current);
+			v->current = kv_list_node_mark_as_undeleted(v->next);
 		} else {
 			void* volatile* tmp;
 			const void* current_key = v->current->key;
 			if(*v->prev != v->current) {
+				backoff_failed(b);
 				goto try_again;
 			}
 			if(cmp(current_key, key) >= 0) {
-				*hazards[0] = nullptr;
-				*hazards[1] = nullptr;
 				return cmp(current_key, key) == 0;
 			}
 			v->prev = &(v->current->next);
@@ -110,53 +145,54 @@ try_again:
 			v->current = v->next;
 		}
 	}
-	deallocate_hazard_pointers(hkey);
 	return false;
 }
 
-bool insert(interlocked_kv_list_node_t** head, interlocked_kv_list_node_t* node, key_cmp cmp, per_thread_vars_t* v) {
+bool kv_list_node_insert(interlocked_kv_list_node_t** head, interlocked_kv_list_node_t* node, key_cmp cmp, per_thread_vars_t* v, void* volatile** hazards, backoff_t* b) {
 	for(;;) {
-		if(find(head, node->key, cmp, v)) {
+		if(kv_list_node_find(head, node->key, cmp, v, hazards, b)) {
 			return false;
 		}
 		node->next = v->current;
 		if(casp((void* volatile*)v->prev, v->current, node)) {
 			return true;
 		}
+		backoff_failed(b);
 	}
 }
 
 bool interlocked_kv_list_insert(interlocked_kv_list_t* s, const void* key, void* value) {
-	interlocked_kv_list_node_t* node = new_interlocked_kv_list_node(key, value);
+	interlocked_kv_list_node_t* node = new_interlocked_kv_list_node(key, value, &s->destructors);
 	per_thread_vars_t v = {0};
-	return insert(&s->head, node, s->cmp, &v);
-}
-
-bool finalize_node(void* context, void* ptr) {
-	interlocked_kv_list_node_t* node = ptr;
-	interlocked_kv_list_node_destructors_t* d = context;
+	backoff_t b;
+	bool inserted = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
 
-	d->key_destructor(node->key);
-	d->value_destructor(node->value);
-	smr_retire(d);
-	return true;
+	backoff_init(&b, &s->contention);
+	inserted = kv_list_node_insert(&s->head, node, s->cmp, &v, hazards, &b);
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	if(!inserted) {
+		smr_free(node);
+	}
+	return inserted;
 }
 
-bool del(interlocked_kv_list_node_t** head, const void* key, key_cmp cmp, interlocked_kv_list_node_destructors_t* destructors, per_thread_vars_t* v) {
+bool kv_list_node_delete(interlocked_kv_list_node_t** head, const void* key, key_cmp cmp, per_thread_vars_t* v, void* volatile** hazards, backoff_t* b) {
 	for(;;) {
-		if(!find(head, key, cmp, v)) {
+		if(!kv_list_node_find(head, key, cmp, v, hazards, b)) {
 			return false;
 		}
-		if(!casp((void* volatile*)&v->current->next, v->next, mark_as_deleted(v->next))) {
+		if(!casp((void* volatile*)&v->current->next, v->next, kv_list_node_mark_as_deleted(v->next))) {
+			backoff_failed(b);
 			continue;
 		}
 		if(casp((void* volatile*)v->prev, v->current, v->next)) {
-			interlocked_kv_list_node_destructors_t* destructor_copy = smr_alloc(sizeof(interlocked_kv_list_node_destructors_t));
-			destructor_copy->key_destructor = destructors->key_destructor;
-			destructor_copy->value_destructor = destructors->value_destructor;
-			smr_retire_with_finalizer(v->current, &finalize_node, destructor_copy);
+			retire_kv_list_node(v->current);
 		} else {
-			find(head, key, cmp, v);
+			kv_list_node_find(head, key, cmp, v, hazards, b);
 		}
 		return true;
 	}
@@ -164,20 +200,276 @@ bool del(interlocked_kv_list_node_t** head, const void* key, key_cmp cmp, interl
 
 bool interlocked_kv_list_delete(interlocked_kv_list_t* s, const void* key) {
 	per_thread_vars_t v = {0};
-	return del(&s->head, key, s->cmp, &s->destructors, &v);
+	backoff_t b;
+	bool deleted = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	deleted = kv_list_node_delete(&s->head, key, s->cmp, &v, hazards, &b);
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	return deleted;
+}
+
+bool interlocked_kv_list_find(interlocked_kv_list_t* s, const void* key, kv_list_lookup_t visit, void* context) {
+	per_thread_vars_t v = {0};
+	backoff_t b;
+	bool found = false;
+	// kv_list_node_find's two, and one for the value
+	void* volatile* hazards[3] = { nullptr };
+	void* hkey = allocate_hazard_pointers(3, hazards);
+	if(!hazards[0] || !hazards[1] || !hazards[2]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	found = kv_list_node_find(&s->head, key, s->cmp, &v, hazards, &b);
+	backoff_done(&b);
+	if(found && visit != nullptr) {
+		// hazards[0] keeps the node alive, but an update can still swap the
+		// value out and retire it
+		visit(v.current->key, protect_value(v.current, hazards[2]), context);
+	}
+	deallocate_hazard_pointers(hkey);
+	return found;
+}
+
+// An assignment that lands on a node just as it's being deleted is simply
+// ordered before the delete, and its value goes with the node.
+bool interlocked_kv_list_insert_or_assign(interlocked_kv_list_t* s, const void* key, void* value) {
+	interlocked_kv_list_node_t* node = nullptr;
+	per_thread_vars_t v = {0};
+	backoff_t b;
+	bool inserted = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	for(;;) {
+		if(kv_list_node_find(&s->head, key, s->cmp, &v, hazards, &b)) {
+			void* old = v.current->value;
+			if(swap_value(v.current, old, value)) {
+				break;
+			}
+			backoff_failed(&b);
+			continue;
+		}
+		if(node == nullptr) {
+			node = new_interlocked_kv_list_node(key, value, &s->destructors);
+		}
+		node->next = v.current;
+		if(casp((void* volatile*)v.prev, v.current, node)) {
+			inserted = true;
+			break;
+		}
+		backoff_failed(&b);
+	}
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	if(!inserted && node != nullptr) {
+		smr_free(node);
+	}
+	return inserted;
+}
+
+bool interlocked_kv_list_compute_if_absent(interlocked_kv_list_t* s, const void* key, kv_list_compute_t compute, void* context) {
+	interlocked_kv_list_node_t* node = nullptr;
+	per_thread_vars_t v = {0};
+	backoff_t b;
+	bool inserted = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	for(;;) {
+		if(kv_list_node_find(&s->head, key, s->cmp, &v, hazards, &b)) {
+			break;
+		}
+		if(node == nullptr) {
+			node = new_interlocked_kv_list_node(key, compute(key, context), &s->destructors);
+		}
+		node->next = v.current;
+		if(casp((void* volatile*)v.prev, v.current, node)) {
+			inserted = true;
+			break;
+		}
+		backoff_failed(&b);
+	}
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	if(!inserted && node != nullptr) {
+		// somebody else inserted the key after the value was computed
+		s->destructors.value_destructor(node->value);
+		smr_free(node);
+	}
+	return inserted;
+}
+
+bool interlocked_kv_list_replace_value(interlocked_kv_list_t* s, const void* key, void* expected, void* desired) {
+	per_thread_vars_t v = {0};
+	backoff_t b;
+	bool replaced = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	if(kv_list_node_find(&s->head, key, s->cmp, &v, hazards, &b)) {
+		replaced = swap_value(v.current, expected, desired);
+	}
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	return replaced;
+}
+
+typedef struct interlocked_kv_list_iterator {
+	interlocked_kv_list_t* list;
+	// hazards[0] covers current and hazards[1] the node being stepped onto;
+	// hazards[2] holds on to current while a search starts over from the head,
+	// and hazards[3] covers current's value, in case it's replaced
+	void* volatile* hazards[4];
+	void* hkey;
+	interlocked_kv_list_node_t* current;
+	void* value;
+	// the link to follow next: the list head, current->next, or nullptr at the end
+	interlocked_kv_list_node_t** link;
+	// current was found by a seek and hasn't been handed out yet
+	bool pending;
+} interlocked_kv_list_iterator_t;
+
+static void init_iterator(interlocked_kv_list_iterator_t* it, interlocked_kv_list_t* s) {
+	it->list = s;
+	it->hkey = allocate_hazard_pointers(4, it->hazards);
+	if(!it->hazards[0] || !it->hazards[1] || !it->hazards[2] || !it->hazards[3]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return; }
+	it->current = nullptr;
+	it->link = &s->head;
+	it->pending = false;
 }
 
-bool interlocked_kv_list_find(interlocked_kv_list_t* s, const void* key, void** value) {
+static void seek_iterator(interlocked_kv_list_iterator_t* it, const void* key, backoff_t* b) {
 	per_thread_vars_t v = {0};
-	if(find(&s->head, key, s->cmp, &v)) {
-		*value = v.current->value;
+	kv_list_node_find(&it->list->head, key, it->list->cmp, &v, it->hazards, b);
+	it->current = v.current;
+	it->link = v.current ? &v.current->next : nullptr;
+	it->pending = true;
+}
+
+static bool step_iterator(interlocked_kv_list_iterator_t* it, backoff_t* b) {
+	interlocked_kv_list_node_t* n;
+	interlocked_kv_list_node_t* next;
+	void* volatile* tmp;
+
+	if(it->pending) {
+		it->pending = false;
+		return it->current != nullptr;
+	}
+	while(it->link != nullptr) {
+		n = *it->link;
+		if(kv_list_node_test_if_deleted(n)) {
+			// current was deleted under us, so its next pointer can't be trusted any
+			// more; find where it would be and carry on from there
+			interlocked_kv_list_node_t* anchor = it->current;
+			per_thread_vars_t v = {0};
+			*it->hazards[2] = anchor;
+			backoff_failed(b);
+			kv_list_node_find(&it->list->head, anchor->key, it->list->cmp, &v, it->hazards, b);
+			it->current = v.current;
+			it->link = v.current ? &v.current->next : nullptr;
+			if(v.current != nullptr && it->list->cmp(v.current->key, anchor->key) == 0) {
+				// a new entry with the key we've already handed out
+				*it->hazards[2] = nullptr;
+				continue;
+			}
+			*it->hazards[2] = nullptr;
+			return v.current != nullptr;
+		}
+		if(n == nullptr) {
+			break;
+		}
+		*it->hazards[1] = n;
+		MemoryBarrier();
+		if(*it->link != n) {
+			continue;
+		}
+		next = n->next;
+		if(kv_list_node_test_if_deleted(next)) {
+			// logically deleted; unlink it the way kv_list_node_find does, and look again
+			if(casp((void* volatile*)it->link, n, kv_list_node_mark_as_undeleted(next))) {
+				retire_kv_list_node(n);
+			} else {
+				backoff_failed(b);
+			}
+			continue;
+		}
+		tmp = it->hazards[0];
+		it->hazards[0] = it->hazards[1];
+		it->hazards[1] = tmp;
+		it->current = n;
+		it->link = &n->next;
 		return true;
-	} else {
-		*value = nullptr;
-		return false;
 	}
+	it->current = nullptr;
+	it->link = nullptr;
+	return false;
+}
+
+interlocked_kv_list_iterator_t* new_interlocked_kv_list_iterator(interlocked_kv_list_t* s) {
+	interlocked_kv_list_iterator_t* it = smr_alloc(sizeof(interlocked_kv_list_iterator_t));
+	init_iterator(it, s);
+	return it;
+}
+
+void delete_interlocked_kv_list_iterator(interlocked_kv_list_iterator_t* it) {
+	deallocate_hazard_pointers(it->hkey);
+	smr_free(it);
+}
+
+void interlocked_kv_list_iterator_seek(interlocked_kv_list_iterator_t* it, const void* key) {
+	backoff_t b;
+	backoff_init(&b, &it->list->contention);
+	seek_iterator(it, key, &b);
+	backoff_done(&b);
+}
+
+bool interlocked_kv_list_iterator_next(interlocked_kv_list_iterator_t* it, const void** key, void** value) {
+	backoff_t b;
+	bool found = false;
+	backoff_init(&b, &it->list->contention);
+	found = step_iterator(it, &b);
+	backoff_done(&b);
+	it->value = found ? protect_value(it->current, it->hazards[3]) : nullptr;
+	if(key) { *key = found ? it->current->key : nullptr; }
+	if(value) { *value = it->value; }
+	return found;
+}
+
+void interlocked_kv_list_range_scan(interlocked_kv_list_t* s, const void* lo, const void* hi, kv_list_visitor_t visit, void* context) {
+	interlocked_kv_list_iterator_t it;
+	backoff_t b;
+	init_iterator(&it, s);
+	backoff_init(&b, &s->contention);
+	if(lo != nullptr) {
+		seek_iterator(&it, lo, &b);
+	}
+	while(step_iterator(&it, &b)) {
+		if(hi != nullptr && s->cmp(it.current->key, hi) >= 0) {
+			break;
+		}
+		it.value = protect_value(it.current, it.hazards[3]);
+		if(!visit(it.current->key, it.value, context)) {
+			break;
+		}
+	}
+	backoff_done(&b);
+	deallocate_hazard_pointers(it.hkey);
 }
 
 bool interlocked_kv_list_is_empty(const interlocked_kv_list_t* s) {
 	return s->head == nullptr;
 }
+
+contention_t* interlocked_kv_list_contention(interlocked_kv_list_t* s) {
+	return &s->contention;
+}
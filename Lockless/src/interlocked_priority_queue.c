@@ -0,0 +1,382 @@
+#include "stdafx.h"
+
+#include "interlocked_priority_queue.h"
+#include "interlocked_skip_list_nodes.h"
+
+#define MAX_LEVEL	16
+
+// how many claimed nodes delete_min will walk past before it unlinks them
+#define CLEANUP_BOUND	32
+
+// pred and succ for every level, plus two for walking
+#define INSERT_HAZARDS	((2 * MAX_LEVEL) + 2)
+
+// Marking level 0 of a node is what claims it. Claimed nodes stay linked, and
+// other threads keep comparing against their keys, until a cleanup unlinks
+// them; so the node owns its key and value until it's reclaimed.
+typedef skip_list_node_t interlocked_priority_queue_node_t;
+
+typedef struct interlocked_priority_queue
+{
+	CACHE_ALIGN interlocked_priority_queue_node_t* head;
+	// Bumped by every unlink, before the unlinker gives up its link on the
+	// nodes. Nodes are only retired once their link count hits zero, so a
+	// traversal that protects a node and then sees the epoch unchanged knows the
+	// node hasn't been retired, even if it got there through claimed nodes.
+	CACHE_ALIGN volatile LONG unlink_epoch;
+	CACHE_ALIGN volatile LONG cleaning;
+
+	key_cmp cmp;
+	destructor_t key_destructor;
+	destructor_t value_destructor;
+} interlocked_priority_queue_t;
+
+// Loads x->next[level], mark and all, and protects the node it points to.
+// Returns false if an unlink has happened since the traversal read epoch, in
+// which case the traversal has to start over.
+static bool protect_next(const interlocked_priority_queue_t* q, interlocked_priority_queue_node_t* x, LONG level, LONG epoch, void* volatile* hazard, interlocked_priority_queue_node_t** output)
+{
+	interlocked_priority_queue_node_t* next = x->next[level];
+	*hazard = kv_list_node_mark_as_undeleted(next);
+	MemoryBarrier();
+	if(q->unlink_epoch != epoch)
+	{
+		return false;
+	}
+	*output = next;
+	return true;
+}
+
+// Unlinks the runs of nodes deleted at this level that sit in front of the
+// first live node. Those are almost all of them, since delete_min works from
+// the front.
+static void unlink_deleted_prefix(interlocked_priority_queue_t* q, LONG level, void* volatile** hazards)
+{
+	interlocked_priority_queue_node_t* pred = nullptr;
+	interlocked_priority_queue_node_t* first = nullptr;
+	interlocked_priority_queue_node_t* last = nullptr;
+	interlocked_priority_queue_node_t* after = nullptr;
+	interlocked_priority_queue_node_t* x = nullptr;
+	LONG epoch = 0;
+
+restart:
+	epoch = q->unlink_epoch;
+	pred = q->head;
+	for(;;)
+	{
+		if(!protect_next(q, pred, level, epoch, hazards[1], &first))
+		{
+			goto restart;
+		}
+		if(kv_list_node_test_if_deleted(first))
+		{
+			goto restart;
+		}
+		if(first == nullptr)
+		{
+			return;
+		}
+		if(!kv_list_node_test_if_deleted(first->next[level]))
+		{
+			if(!kv_list_node_test_if_deleted(first->next[0]))
+			{
+				return;
+			}
+			// claimed, but not yet deleted at this level; it can still be linked after
+			pred = first;
+			swap_hazards(&hazards[0], &hazards[1]);
+			continue;
+		}
+
+		// first stays protected for the CAS; the walk along the run uses the other two
+		last = first;
+		for(;;)
+		{
+			if(!protect_next(q, last, level, epoch, hazards[2], &after))
+			{
+				goto restart;
+			}
+			after = kv_list_node_mark_as_undeleted(after);
+			if(after == nullptr || !kv_list_node_test_if_deleted(after->next[level]))
+			{
+				break;
+			}
+			last = after;
+			swap_hazards(&hazards[2], &hazards[3]);
+		}
+
+		// the next pointers inside the run are marked, so nothing can be linked
+		// into it; only pred->next can have changed
+		if(casp((void* volatile*)&pred->next[level], first, after))
+		{
+			InterlockedIncrement(&q->unlink_epoch);
+			// our link keeps each node alive until we've read its next pointer
+			for(x = first; x != after;)
+			{
+				interlocked_priority_queue_node_t* next = kv_list_node_mark_as_undeleted(x->next[level]);
+				release_skip_list_links(x, 1);
+				x = next;
+			}
+		}
+		goto restart;
+	}
+}
+
+static void cleanup(interlocked_priority_queue_t* q)
+{
+	LONG level = 0;
+	void* volatile* hazards[4] = { nullptr };
+	void* key = nullptr;
+
+	// one cleaner at a time is plenty; everyone else just gets on with their operation
+	if(tas(&q->cleaning))
+	{
+		return;
+	}
+	key = allocate_hazard_pointers(4, hazards);
+	if(!hazards[0] || !hazards[1] || !hazards[2] || !hazards[3]) { q->cleaning = 0; RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return; }
+
+	for(level = MAX_LEVEL - 1; level >= 0; --level)
+	{
+		unlink_deleted_prefix(q, level, hazards);
+	}
+
+	deallocate_hazard_pointers(key);
+	q->cleaning = 0;
+}
+
+// Finds, for every level, the last node with a key no greater than key that
+// isn't deleted at that level, and the node that currently follows it. Both
+// are left protected by the level's hazards.
+static void find_position(const interlocked_priority_queue_t* q, const void* key, interlocked_priority_queue_node_t** preds, interlocked_priority_queue_node_t** succs, void* volatile** pred_hazards, void* volatile** succ_hazards, void* volatile** walk_hazards)
+{
+	interlocked_priority_queue_node_t* pred = nullptr;
+	interlocked_priority_queue_node_t* succ = nullptr;
+	interlocked_priority_queue_node_t* curr = nullptr;
+	interlocked_priority_queue_node_t* next = nullptr;
+	LONG level = 0;
+	LONG epoch = 0;
+
+restart:
+	epoch = q->unlink_epoch;
+	pred = q->head;
+	for(level = MAX_LEVEL - 1; level >= 0; --level)
+	{
+		*pred_hazards[level] = pred;
+		if(!protect_next(q, pred, level, epoch, walk_hazards[0], &succ))
+		{
+			goto restart;
+		}
+		// pred has been deleted at this level since we used it on the one above
+		if(kv_list_node_test_if_deleted(succ))
+		{
+			goto restart;
+		}
+		*succ_hazards[level] = succ;
+		curr = succ;
+		while(curr != nullptr)
+		{
+			if(!protect_next(q, curr, level, epoch, walk_hazards[1], &next))
+			{
+				goto restart;
+			}
+			if(kv_list_node_test_if_deleted(next))
+			{
+				// deleted at this level; walk past it, but it can't be linked after
+				curr = kv_list_node_mark_as_undeleted(next);
+				swap_hazards(&walk_hazards[0], &walk_hazards[1]);
+				continue;
+			}
+			if(q->cmp(curr->key, key) > 0)
+			{
+				break;
+			}
+			pred = curr;
+			succ = next;
+			*pred_hazards[level] = pred;
+			*succ_hazards[level] = succ;
+			curr = next;
+			swap_hazards(&walk_hazards[0], &walk_hazards[1]);
+		}
+		preds[level] = pred;
+		succs[level] = succ;
+	}
+}
+
+interlocked_priority_queue_t* new_interlocked_priority_queue(key_cmp cmp, destructor_t key_destructor, destructor_t value_destructor)
+{
+	interlocked_priority_queue_t* q = smr_alloc(sizeof(interlocked_priority_queue_t));
+	memset(q, 0, sizeof(interlocked_priority_queue_t));
+	q->cmp = cmp;
+	q->key_destructor = key_destructor;
+	q->value_destructor = value_destructor;
+	q->head = new_skip_list_node(nullptr, nullptr, q->key_destructor, q->value_destructor, MAX_LEVEL);
+	return q;
+}
+
+void delete_interlocked_priority_queue(interlocked_priority_queue_t* q)
+{
+	// the nodes destroy their keys and values when they're reclaimed
+	while(interlocked_priority_queue_delete_min(q, nullptr, nullptr))
+	{
+	}
+	// everything's claimed now, so this unlinks and retires the lot
+	cleanup(q);
+	smr_retire(q->head);
+	q->head = nullptr;
+	smr_retire(q);
+}
+
+void interlocked_priority_queue_push(interlocked_priority_queue_t* q, const void* key, void* value)
+{
+	LONG height = random_skip_list_height(MAX_LEVEL);
+	interlocked_priority_queue_node_t* node = new_skip_list_node(key, value, q->key_destructor, q->value_destructor, height);
+	interlocked_priority_queue_node_t* preds[MAX_LEVEL] = { nullptr };
+	interlocked_priority_queue_node_t* succs[MAX_LEVEL] = { nullptr };
+	interlocked_priority_queue_node_t* old = nullptr;
+	LONG level = 0;
+	void* volatile* hazards[INSERT_HAZARDS] = { nullptr };
+	void* hkey = allocate_hazard_pointers(INSERT_HAZARDS, hazards);
+	if(!hazards[INSERT_HAZARDS - 1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return; }
+
+	find_position(q, key, preds, succs, hazards, hazards + MAX_LEVEL, hazards + (2 * MAX_LEVEL));
+	for(;;)
+	{
+		node->next[0] = succs[0];
+		if(casp((void* volatile*)&preds[0]->next[0], succs[0], node))
+		{
+			break;
+		}
+		find_position(q, key, preds, succs, hazards, hazards + MAX_LEVEL, hazards + (2 * MAX_LEVEL));
+	}
+
+	for(level = 1; level < height; ++level)
+	{
+		for(;;)
+		{
+			old = node->next[level];
+			// once the node's been claimed there's no point linking it any higher
+			if(kv_list_node_test_if_deleted(old) || kv_list_node_test_if_deleted(node->next[0]))
+			{
+				release_skip_list_links(node, height - level);
+				deallocate_hazard_pointers(hkey);
+				return;
+			}
+			// fails only if delete_min has just marked this level
+			if(old != succs[level] && !casp((void* volatile*)&node->next[level], old, succs[level]))
+			{
+				continue;
+			}
+			if(casp((void* volatile*)&preds[level]->next[level], succs[level], node))
+			{
+				break;
+			}
+			find_position(q, key, preds, succs, hazards, hazards + MAX_LEVEL, hazards + (2 * MAX_LEVEL));
+		}
+	}
+	deallocate_hazard_pointers(hkey);
+}
+
+bool interlocked_priority_queue_delete_min(interlocked_priority_queue_t* q, priority_queue_visitor_t visit, void* context)
+{
+	interlocked_priority_queue_node_t* curr = nullptr;
+	interlocked_priority_queue_node_t* next = nullptr;
+	interlocked_priority_queue_node_t* succ = nullptr;
+	LONG epoch = 0;
+	LONG passed = 0;
+	LONG level = 0;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+restart:
+	epoch = q->unlink_epoch;
+	passed = 0;
+	curr = q->head;
+	for(;;)
+	{
+		if(!protect_next(q, curr, 0, epoch, hazards[1], &next))
+		{
+			goto restart;
+		}
+		curr = kv_list_node_mark_as_undeleted(next);
+		swap_hazards(&hazards[0], &hazards[1]);
+		if(curr == nullptr)
+		{
+			deallocate_hazard_pointers(hkey);
+			if(passed >= CLEANUP_BOUND)
+			{
+				cleanup(q);
+			}
+			return false;
+		}
+		for(;;)
+		{
+			succ = curr->next[0];
+			if(kv_list_node_test_if_deleted(succ))
+			{
+				break;
+			}
+			if(casp((void* volatile*)&curr->next[0], succ, kv_list_node_mark_as_deleted(succ)))
+			{
+				goto claimed;
+			}
+		}
+		++passed;
+	}
+
+claimed:
+	// nothing else will be linked after it now, at any level
+	for(level = curr->height - 1; level > 0; --level)
+	{
+		do
+		{
+			succ = curr->next[level];
+		}
+		while(!kv_list_node_test_if_deleted(succ) && !casp((void* volatile*)&curr->next[level], succ, kv_list_node_mark_as_deleted(succ)));
+	}
+	// curr is still protected, and its key and value live as long as it does
+	if(visit) { visit(curr->key, curr->value, context); }
+	deallocate_hazard_pointers(hkey);
+	if(passed >= CLEANUP_BOUND)
+	{
+		cleanup(q);
+	}
+	return true;
+}
+
+bool interlocked_priority_queue_is_empty(const interlocked_priority_queue_t* q)
+{
+	interlocked_priority_queue_node_t* curr = nullptr;
+	interlocked_priority_queue_node_t* next = nullptr;
+	LONG epoch = 0;
+	bool empty = false;
+	void* volatile* hazards[2] = { nullptr };
+	void* key = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+restart:
+	epoch = q->unlink_epoch;
+	curr = q->head;
+	for(;;)
+	{
+		if(!protect_next(q, curr, 0, epoch, hazards[1], &next))
+		{
+			goto restart;
+		}
+		curr = kv_list_node_mark_as_undeleted(next);
+		swap_hazards(&hazards[0], &hazards[1]);
+		if(curr == nullptr)
+		{
+			empty = true;
+			break;
+		}
+		if(!kv_list_node_test_if_deleted(curr->next[0]))
+		{
+			break;
+		}
+	}
+
+	deallocate_hazard_pointers(key);
+	return empty;
+}
@@ -1,6 +1,8 @@
 #include "stdafx.h"
 
 #include "interlocked_queue.h"
+#include "concurrent_counter.h"
+#include "backoff.h"
 
 typedef struct interlocked_queue_node
 {
@@ -8,6 +10,10 @@ typedef struct interlocked_queue_node
 	void* data;
 } interlocked_queue_node_t;
 
+// marks a node that has been dequeued. It mustn't be nullptr, or a pusher still
+// holding a stale tail could CAS its node onto the end of a retired one.
+#define DELINKED	((interlocked_queue_node_t*)(size_t)1)
+
 interlocked_queue_node_t* new_interlocked_queue_node()
 {
 	interlocked_queue_node_t* n = smr_alloc(sizeof(interlocked_queue_node_t));
@@ -22,6 +28,8 @@ typedef struct interlocked_queue
 	CACHE_ALIGN interlocked_queue_node_t* tail;
 
 	destructor_t value_destructor;
+	concurrent_counter_t* depth;
+	CACHE_ALIGN contention_t contention;
 } interlocked_queue_t;
 
 interlocked_queue_t* new_interlocked_queue(destructor_t value_destructor)
@@ -30,6 +38,8 @@ interlocked_queue_t* new_interlocked_queue(destructor_t value_destructor)
 	memset(q, 0, sizeof(interlocked_queue_t));
 	q->head = q->tail = new_interlocked_queue_node();
 	q->value_destructor = value_destructor;
+	q->depth = new_concurrent_counter();
+	contention_init(&q->contention, BACKOFF_NONE);
 	return q;
 }
 
@@ -43,6 +53,8 @@ void delete_interlocked_queue(interlocked_queue_t* q)
 	smr_retire(q->head);
 	q->head = nullptr;
 	q->tail = nullptr;
+	delete_concurrent_counter(q->depth);
+	q->depth = nullptr;
 	smr_retire(q);
 }
 
@@ -51,11 +63,13 @@ void interlocked_queue_push(interlocked_queue_t* q, void* data)
 	interlocked_queue_node_t* node = new_interlocked_queue_node();
 	interlocked_queue_node_t* t = nullptr;
 	interlocked_queue_node_t* next = nullptr;
+	backoff_t b;
 	void* volatile* hazards[1] = { nullptr };
 	void* key = allocate_hazard_pointers(1, hazards);
 	if(!hazards[0]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return; }
 
 	node->data = data;
+	backoff_init(&b, &q->contention);
 
 	for(;;)
 	{
@@ -81,9 +95,12 @@ void interlocked_queue_push(interlocked_queue_t* q, void* data)
 		{
 			break;
 		}
+		backoff_failed(&b);
 	}
 	casp((void* volatile*)&q->tail, t, node);
 	deallocate_hazard_pointers(key);
+	backoff_done(&b);
+	concurrent_counter_increment(q->depth);
 }
 
 bool interlocked_queue_pop(interlocked_queue_t* q, void** output)
@@ -92,10 +109,12 @@ bool interlocked_queue_pop(interlocked_queue_t* q, void** output)
 	interlocked_queue_node_t* t = nullptr;
 	interlocked_queue_node_t* next = nullptr;
 	void* data = nullptr;
+	backoff_t b;
 	void* volatile* hazards[2] = { nullptr };
 	void* key = allocate_hazard_pointers(2, hazards);
 	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
 
+	backoff_init(&b, &q->contention);
 	for(;;)
 	{
 		h = q->head;
@@ -115,8 +134,8 @@ bool interlocked_queue_pop(interlocked_queue_t* q, void** output)
 		}
 		if(next == nullptr)
 		{
-			*hazards[0] = nullptr;
-			*hazards[1] = nullptr;
+			deallocate_hazard_pointers(key);
+			backoff_done(&b);
 			if(output) { *output = nullptr; }
 			return false;
 		}
@@ -130,18 +149,28 @@ bool interlocked_queue_pop(interlocked_queue_t* q, void** output)
 		{
 			break;
 		}
+		backoff_failed(&b);
 	}
+	backoff_done(&b);
 
-	h->next = nullptr;
+	h->next = DELINKED;
 	smr_retire(h);
 	if(output) { *output = data; }
 	deallocate_hazard_pointers(key);
+	concurrent_counter_decrement(q->depth);
 	return data != nullptr;
 }
 
+long interlocked_queue_depth(const interlocked_queue_t* q)
+{
+	// pushes and pops update the counter after the fact, so it can briefly dip below zero
+	LONG64 depth = concurrent_counter_estimate_get(q->depth);
+	return depth > 0 ? (long)depth : 0;
+}
+
 #define MAX_RETRIES	3
 
-long interlocked_queue_depth(const interlocked_queue_t* q)
+long interlocked_queue_exact_depth(const interlocked_queue_t* q)
 {
 	interlocked_queue_node_t* h = nullptr;
 	interlocked_queue_node_t* next = nullptr;
@@ -157,6 +186,7 @@ long interlocked_queue_depth(const interlocked_queue_t* q)
 		h = q->head;
 		if(h == q->tail)
 		{
+			deallocate_hazard_pointers(key);
 			return count;
 		}
 		*hazards[0] = h;
@@ -167,9 +197,13 @@ long interlocked_queue_depth(const interlocked_queue_t* q)
 	while(h != nullptr)
 	{
 		next = h->next;
+		if(next == DELINKED) // musta been delinked, nothing we can do to recover, so bail
+		{
+			break;
+		}
 		*hazards[1] = next;
 		MemoryBarrier();
-		if(next != h->next) // musta been delinked, nothing we can do to recover, so bail
+		if(next != h->next)
 		{
 			break;
 		}
@@ -188,3 +222,8 @@ bool interlocked_queue_is_empty(const interlocked_queue_t* q)
 {
 	return q->head == q->tail;
 }
+
+contention_t* interlocked_queue_contention(interlocked_queue_t* q)
+{
+	return &q->contention;
+}
@@ -0,0 +1,226 @@
+#include "stdafx.h"
+
+#include "interlocked_segment_queue.h"
+
+#define SEGMENT_SIZE	1024
+
+// a slot that a consumer has claimed before its producer got around to filling it
+#define TAKEN	((void*)(size_t)1)
+
+typedef struct interlocked_segment_queue_segment
+{
+	CACHE_ALIGN volatile LONG enqueue_index;
+	CACHE_ALIGN volatile LONG dequeue_index;
+	CACHE_ALIGN struct interlocked_segment_queue_segment* next;
+	LONG64 ordinal;
+	void* slots[SEGMENT_SIZE];
+} interlocked_segment_queue_segment_t;
+
+interlocked_segment_queue_segment_t* new_interlocked_segment_queue_segment(LONG64 ordinal, void* first)
+{
+	interlocked_segment_queue_segment_t* s = smr_alloc(sizeof(interlocked_segment_queue_segment_t));
+	memset(s, 0, sizeof(interlocked_segment_queue_segment_t));
+	s->ordinal = ordinal;
+	if(first != nullptr)
+	{
+		// the thread that allocates a segment gets the first slot for free, so
+		// winning the link CAS is the same as completing the push
+		s->slots[0] = first;
+		s->enqueue_index = 1;
+	}
+	return s;
+}
+
+typedef struct interlocked_segment_queue
+{
+	CACHE_ALIGN interlocked_segment_queue_segment_t* head;
+	CACHE_ALIGN interlocked_segment_queue_segment_t* tail;
+
+	destructor_t value_destructor;
+} interlocked_segment_queue_t;
+
+interlocked_segment_queue_t* new_interlocked_segment_queue(destructor_t value_destructor)
+{
+	interlocked_segment_queue_t* q = smr_alloc(sizeof(interlocked_segment_queue_t));
+	memset(q, 0, sizeof(interlocked_segment_queue_t));
+	q->head = q->tail = new_interlocked_segment_queue_segment(0, nullptr);
+	q->value_destructor = value_destructor;
+	return q;
+}
+
+void delete_interlocked_segment_queue(interlocked_segment_queue_t* q)
+{
+	void* value;
+	while(interlocked_segment_queue_pop(q, &value))
+	{
+		q->value_destructor(value);
+	}
+	smr_retire(q->head);
+	q->head = nullptr;
+	q->tail = nullptr;
+	smr_retire(q);
+}
+
+void interlocked_segment_queue_push(interlocked_segment_queue_t* q, void* data)
+{
+	interlocked_segment_queue_segment_t* t = nullptr;
+	interlocked_segment_queue_segment_t* next = nullptr;
+	interlocked_segment_queue_segment_t* fresh = nullptr;
+	LONG idx = 0;
+	void* volatile* hazards[1] = { nullptr };
+	void* key = allocate_hazard_pointers(1, hazards);
+	if(!hazards[0]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return; }
+
+	for(;;)
+	{
+		t = q->tail;
+		*hazards[0] = t;
+		MemoryBarrier();
+		if(q->tail != t)
+		{
+			continue;
+		}
+		idx = InterlockedIncrement(&t->enqueue_index) - 1;
+		if(idx < SEGMENT_SIZE)
+		{
+			// fails only if a consumer overtook us and poisoned the slot; take another
+			if(casp(&t->slots[idx], nullptr, data))
+			{
+				break;
+			}
+			continue;
+		}
+		// segment is full
+		if(q->tail != t)
+		{
+			continue;
+		}
+		next = t->next;
+		if(next != nullptr)
+		{
+			casp((void* volatile*)&q->tail, t, next);
+			continue;
+		}
+		fresh = new_interlocked_segment_queue_segment(t->ordinal + 1, data);
+		if(casp((void* volatile*)&t->next, nullptr, fresh))
+		{
+			casp((void* volatile*)&q->tail, t, fresh);
+			break;
+		}
+		// never published, so there's nobody to defer the free for
+		smr_free(fresh);
+	}
+	deallocate_hazard_pointers(key);
+}
+
+bool interlocked_segment_queue_pop(interlocked_segment_queue_t* q, void** output)
+{
+	interlocked_segment_queue_segment_t* h = nullptr;
+	interlocked_segment_queue_segment_t* next = nullptr;
+	void* data = nullptr;
+	LONG idx = 0;
+	void* volatile* hazards[1] = { nullptr };
+	void* key = allocate_hazard_pointers(1, hazards);
+	if(!hazards[0]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	for(;;)
+	{
+		h = q->head;
+		*hazards[0] = h;
+		MemoryBarrier();
+		if(q->head != h)
+		{
+			continue;
+		}
+		if(h->dequeue_index >= h->enqueue_index && h->next == nullptr)
+		{
+			break;
+		}
+		idx = InterlockedIncrement(&h->dequeue_index) - 1;
+		if(idx < SEGMENT_SIZE)
+		{
+			data = InterlockedExchangePointer(&h->slots[idx], TAKEN);
+			if(data != nullptr)
+			{
+				break;
+			}
+			// the producer that owns this slot hasn't filled it yet; it will see
+			// TAKEN and go round again, so we do the same
+			continue;
+		}
+		// segment is drained
+		next = h->next;
+		if(next == nullptr)
+		{
+			break;
+		}
+		// the tail must never be left pointing at a retired segment
+		if(q->tail == h)
+		{
+			casp((void* volatile*)&q->tail, h, next);
+		}
+		if(casp((void* volatile*)&q->head, h, next))
+		{
+			*hazards[0] = nullptr;
+			smr_retire(h);
+		}
+	}
+
+	deallocate_hazard_pointers(key);
+	if(output) { *output = data; }
+	return data != nullptr;
+}
+
+bool interlocked_segment_queue_is_empty(const interlocked_segment_queue_t* q)
+{
+	interlocked_segment_queue_segment_t* h = nullptr;
+	bool empty = false;
+	void* volatile* hazards[1] = { nullptr };
+	void* key = allocate_hazard_pointers(1, hazards);
+	if(!hazards[0]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	do
+	{
+		h = q->head;
+		*hazards[0] = h;
+		MemoryBarrier();
+	}
+	while(q->head != h);
+	empty = h->dequeue_index >= h->enqueue_index && h->next == nullptr;
+
+	deallocate_hazard_pointers(key);
+	return empty;
+}
+
+long interlocked_segment_queue_depth(const interlocked_segment_queue_t* q)
+{
+	interlocked_segment_queue_segment_t* h = nullptr;
+	interlocked_segment_queue_segment_t* t = nullptr;
+	LONG64 enqueued = 0;
+	LONG64 dequeued = 0;
+	void* volatile* hazards[2] = { nullptr };
+	void* key = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return 0; }
+
+	do
+	{
+		h = q->head;
+		*hazards[0] = h;
+		MemoryBarrier();
+	}
+	while(q->head != h);
+	do
+	{
+		t = q->tail;
+		*hazards[1] = t;
+		MemoryBarrier();
+	}
+	while(q->tail != t);
+
+	// the indices overshoot the segment size when threads race past the end
+	enqueued = (t->ordinal * SEGMENT_SIZE) + (t->enqueue_index < SEGMENT_SIZE ? t->enqueue_index : SEGMENT_SIZE);
+	dequeued = (h->ordinal * SEGMENT_SIZE) + (h->dequeue_index < SEGMENT_SIZE ? h->dequeue_index : SEGMENT_SIZE);
+
+	deallocate_hazard_pointers(key);
+	return enqueued > dequeued ? (long)(enqueued - dequeued) : 0;
+}
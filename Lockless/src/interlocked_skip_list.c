@@ -0,0 +1,405 @@
+#include "stdafx.h"
+
+#include "interlocked_skip_list.h"
+#include "interlocked_skip_list_nodes.h"
+#include "backoff.h"
+
+// with nodes promoted with probability 1/2, enough for tens of millions of keys
+#define MAX_LEVEL	24
+
+// pred and succ for every level, and one for walking
+#define FIND_HAZARDS	((2 * MAX_LEVEL) + 1)
+// and one for the new node
+#define INSERT_HAZARDS	(FIND_HAZARDS + 1)
+
+// where a search stops
+#define SEARCH_LOWER	0	// the first key not less than the key
+#define SEARCH_UPPER	1	// the first key greater than the key
+#define SEARCH_FIRST	2	// the first key of all
+
+// a node is removed from the map once level 0 of it is marked
+typedef skip_list_node_t interlocked_skip_list_node_t;
+
+typedef struct interlocked_skip_list
+{
+	CACHE_ALIGN interlocked_skip_list_node_t* head;
+
+	key_cmp cmp;
+	destructor_t key_destructor;
+	destructor_t value_destructor;
+	CACHE_ALIGN contention_t contention;
+} interlocked_skip_list_t;
+
+static bool goes_before(const interlocked_skip_list_t* s, const void* node_key, const void* key, int mode)
+{
+	int c = 0;
+	if(mode == SEARCH_FIRST)
+	{
+		return false;
+	}
+	c = s->cmp(node_key, key);
+	return c < 0 || (c == 0 && mode == SEARCH_UPPER);
+}
+
+// Walks one step along a level: protects pred->next[level], checks pred still
+// points at it, and unlinks it if it's been deleted at this level. Returns false
+// if pred has changed under us, in which case the search has to start over.
+// Otherwise *curr is the protected, live successor, or nullptr, and *succ is what
+// follows it.
+static bool advance(interlocked_skip_list_node_t* pred, LONG level, void* volatile* hazard, interlocked_skip_list_node_t** curr, interlocked_skip_list_node_t** succ)
+{
+	interlocked_skip_list_node_t* c = pred->next[level];
+	for(;;)
+	{
+		if(kv_list_node_test_if_deleted(c))
+		{
+			return false;
+		}
+		if(c == nullptr)
+		{
+			*curr = nullptr;
+			*succ = nullptr;
+			return true;
+		}
+		*hazard = c;
+		MemoryBarrier();
+		// still linked after an unmarked pred, so not yet retired
+		if(pred->next[level] != c)
+		{
+			return false;
+		}
+		*succ = c->next[level];
+		if(!kv_list_node_test_if_deleted(*succ))
+		{
+			*curr = c;
+			return true;
+		}
+		if(!casp((void* volatile*)&pred->next[level], c, kv_list_node_mark_as_undeleted(*succ)))
+		{
+			return false;
+		}
+		release_skip_list_links(c, 1);
+		c = kv_list_node_mark_as_undeleted(*succ);
+	}
+}
+
+// Finds, for every level, the last node that goes before key and the node
+// that follows it, both protected by the level's hazards. Returns true if the
+// level 0 successor has key.
+static bool find_position(interlocked_skip_list_t* s, const void* key, interlocked_skip_list_node_t** preds, interlocked_skip_list_node_t** succs, void* volatile** hazards, backoff_t* b)
+{
+	void* volatile** pred_hazards = hazards;
+	void* volatile** succ_hazards = hazards + MAX_LEVEL;
+	void* volatile* walk_hazard = hazards[2 * MAX_LEVEL];
+	interlocked_skip_list_node_t* pred = nullptr;
+	interlocked_skip_list_node_t* curr = nullptr;
+	interlocked_skip_list_node_t* succ = nullptr;
+	LONG level = 0;
+
+restart:
+	pred = s->head;
+	for(level = MAX_LEVEL - 1; level >= 0; --level)
+	{
+		*pred_hazards[level] = pred;
+		for(;;)
+		{
+			if(!advance(pred, level, walk_hazard, &curr, &succ))
+			{
+				backoff_failed(b);
+				goto restart;
+			}
+			if(curr == nullptr || !goes_before(s, curr->key, key, SEARCH_LOWER))
+			{
+				break;
+			}
+			pred = curr;
+			*pred_hazards[level] = pred;
+		}
+		preds[level] = pred;
+		succs[level] = curr;
+		*succ_hazards[level] = curr;
+	}
+	return curr != nullptr && s->cmp(curr->key, key) == 0;
+}
+
+// The lookups only need to remember where they are, not where they've been.
+// Returns the level 0 node the search stops at, protected by hazards[1].
+static interlocked_skip_list_node_t* search(interlocked_skip_list_t* s, const void* key, int mode, void* volatile** hazards, backoff_t* b)
+{
+	interlocked_skip_list_node_t* pred = nullptr;
+	interlocked_skip_list_node_t* curr = nullptr;
+	interlocked_skip_list_node_t* succ = nullptr;
+	LONG level = 0;
+
+restart:
+	pred = s->head;
+	for(level = MAX_LEVEL - 1; level >= 0; --level)
+	{
+		for(;;)
+		{
+			if(!advance(pred, level, hazards[1], &curr, &succ))
+			{
+				backoff_failed(b);
+				goto restart;
+			}
+			if(curr == nullptr || !goes_before(s, curr->key, key, mode))
+			{
+				break;
+			}
+			pred = curr;
+			swap_hazards(&hazards[0], &hazards[1]);
+		}
+	}
+	return curr;
+}
+
+interlocked_skip_list_t* new_interlocked_skip_list(key_cmp cmp, destructor_t key_destructor, destructor_t value_destructor)
+{
+	interlocked_skip_list_t* s = smr_alloc(sizeof(interlocked_skip_list_t));
+	memset(s, 0, sizeof(interlocked_skip_list_t));
+	s->cmp = cmp;
+	s->key_destructor = key_destructor;
+	s->value_destructor = value_destructor;
+	s->head = new_skip_list_node(nullptr, nullptr, s->key_destructor, s->value_destructor, MAX_LEVEL);
+	contention_init(&s->contention, BACKOFF_NONE);
+	return s;
+}
+
+void delete_interlocked_skip_list(interlocked_skip_list_t* s)
+{
+	interlocked_skip_list_node_t* n = nullptr;
+	interlocked_skip_list_node_t* next = nullptr;
+	LONG level = 0;
+
+	// nobody else is using the list, so just drop every link there is,
+	// deleted nodes that haven't been unlinked yet included
+	for(level = MAX_LEVEL - 1; level >= 0; --level)
+	{
+		for(n = kv_list_node_mark_as_undeleted(s->head->next[level]); n != nullptr; n = next)
+		{
+			next = kv_list_node_mark_as_undeleted(n->next[level]);
+			release_skip_list_links(n, 1);
+		}
+	}
+	smr_retire(s->head);
+	s->head = nullptr;
+	smr_retire(s);
+}
+
+bool interlocked_skip_list_insert(interlocked_skip_list_t* s, const void* key, void* value)
+{
+	LONG height = random_skip_list_height(MAX_LEVEL);
+	interlocked_skip_list_node_t* node = nullptr;
+	interlocked_skip_list_node_t* preds[MAX_LEVEL] = { nullptr };
+	interlocked_skip_list_node_t* succs[MAX_LEVEL] = { nullptr };
+	interlocked_skip_list_node_t* old = nullptr;
+	LONG level = 0;
+	backoff_t b;
+	void* volatile* hazards[INSERT_HAZARDS] = { nullptr };
+	void* hkey = allocate_hazard_pointers(INSERT_HAZARDS, hazards);
+	if(!hazards[INSERT_HAZARDS - 1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	for(;;)
+	{
+		if(find_position(s, key, preds, succs, hazards, &b))
+		{
+			backoff_done(&b);
+			deallocate_hazard_pointers(hkey);
+			if(node != nullptr)
+			{
+				smr_free(node);
+			}
+			return false;
+		}
+		if(node == nullptr)
+		{
+			node = new_skip_list_node(key, value, s->key_destructor, s->value_destructor, height);
+			// once it's linked in it can be deleted and unlinked while we're
+			// still building its tower
+			*hazards[INSERT_HAZARDS - 1] = node;
+		}
+		for(level = 0; level < height; ++level)
+		{
+			node->next[level] = succs[level];
+		}
+		if(casp((void* volatile*)&preds[0]->next[0], succs[0], node))
+		{
+			break;
+		}
+		backoff_failed(&b);
+	}
+
+	for(level = 1; level < height; ++level)
+	{
+		for(;;)
+		{
+			old = node->next[level];
+			// deleted already; there's no point linking it any higher
+			if(kv_list_node_test_if_deleted(old))
+			{
+				release_skip_list_links(node, height - level);
+				goto linked;
+			}
+			// fails only if a delete has just marked this level
+			if(old != succs[level] && !casp((void* volatile*)&node->next[level], old, succs[level]))
+			{
+				continue;
+			}
+			if(casp((void* volatile*)&preds[level]->next[level], succs[level], node))
+			{
+				break;
+			}
+			backoff_failed(&b);
+			find_position(s, key, preds, succs, hazards, &b);
+		}
+	}
+
+linked:
+	// a delete that ran while we were linking might have missed the levels we
+	// linked after it looked
+	if(kv_list_node_test_if_deleted(node->next[0]))
+	{
+		find_position(s, key, preds, succs, hazards, &b);
+	}
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	return true;
+}
+
+bool interlocked_skip_list_delete(interlocked_skip_list_t* s, const void* key)
+{
+	interlocked_skip_list_node_t* preds[MAX_LEVEL] = { nullptr };
+	interlocked_skip_list_node_t* succs[MAX_LEVEL] = { nullptr };
+	interlocked_skip_list_node_t* victim = nullptr;
+	interlocked_skip_list_node_t* succ = nullptr;
+	LONG level = 0;
+	bool deleted = false;
+	backoff_t b;
+	void* volatile* hazards[FIND_HAZARDS] = { nullptr };
+	void* hkey = allocate_hazard_pointers(FIND_HAZARDS, hazards);
+	if(!hazards[FIND_HAZARDS - 1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	if(find_position(s, key, preds, succs, hazards, &b))
+	{
+		victim = succs[0];
+		// top down, so that nothing gets linked above a level that's already gone
+		for(level = victim->height - 1; level > 0; --level)
+		{
+			do
+			{
+				succ = victim->next[level];
+			}
+			while(!kv_list_node_test_if_deleted(succ) && !casp((void* volatile*)&victim->next[level], succ, kv_list_node_mark_as_deleted(succ)));
+		}
+		// whoever marks level 0 is the one that deleted it
+		for(;;)
+		{
+			succ = victim->next[0];
+			if(kv_list_node_test_if_deleted(succ))
+			{
+				break;
+			}
+			if(casp((void* volatile*)&victim->next[0], succ, kv_list_node_mark_as_deleted(succ)))
+			{
+				deleted = true;
+				break;
+			}
+			backoff_failed(&b);
+		}
+		if(deleted)
+		{
+			// unlinks it from every level along the way
+			find_position(s, key, preds, succs, hazards, &b);
+		}
+	}
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+	return deleted;
+}
+
+static bool lookup(interlocked_skip_list_t* s, const void* key, int mode, bool exact, skip_list_visitor_t visit, void* context)
+{
+	interlocked_skip_list_node_t* n = nullptr;
+	backoff_t b;
+	void* volatile* hazards[2] = { nullptr };
+	void* hkey = allocate_hazard_pointers(2, hazards);
+	if(!hazards[0] || !hazards[1]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	backoff_init(&b, &s->contention);
+	n = search(s, key, mode, hazards, &b);
+	backoff_done(&b);
+	if(n != nullptr && exact && s->cmp(n->key, key) != 0)
+	{
+		n = nullptr;
+	}
+	if(n != nullptr && visit != nullptr)
+	{
+		visit(n->key, n->value, context);
+	}
+	deallocate_hazard_pointers(hkey);
+	return n != nullptr;
+}
+
+bool interlocked_skip_list_find(interlocked_skip_list_t* s, const void* key, skip_list_visitor_t visit, void* context)
+{
+	return lookup(s, key, SEARCH_LOWER, true, visit, context);
+}
+
+bool interlocked_skip_list_lower_bound(interlocked_skip_list_t* s, const void* key, skip_list_visitor_t visit, void* context)
+{
+	return lookup(s, key, SEARCH_LOWER, false, visit, context);
+}
+
+bool interlocked_skip_list_upper_bound(interlocked_skip_list_t* s, const void* key, skip_list_visitor_t visit, void* context)
+{
+	return lookup(s, key, SEARCH_UPPER, false, visit, context);
+}
+
+void interlocked_skip_list_range_scan(interlocked_skip_list_t* s, const void* lo, const void* hi, skip_list_visitor_t visit, void* context)
+{
+	interlocked_skip_list_node_t* pred = nullptr;
+	interlocked_skip_list_node_t* curr = nullptr;
+	interlocked_skip_list_node_t* succ = nullptr;
+	backoff_t b;
+	// two to walk level 0 hand over hand, and one to hold on to where we were
+	// if we have to search again
+	void* volatile* hazards[3] = { nullptr };
+	void* hkey = allocate_hazard_pointers(3, hazards);
+	if(!hazards[0] || !hazards[1] || !hazards[2]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return; }
+
+	backoff_init(&b, &s->contention);
+	curr = search(s, lo, lo != nullptr ? SEARCH_LOWER : SEARCH_FIRST, hazards, &b);
+	while(curr != nullptr && (hi == nullptr || s->cmp(curr->key, hi) < 0))
+	{
+		visit(curr->key, curr->value, context);
+		pred = curr;
+		swap_hazards(&hazards[0], &hazards[1]);
+		while(!advance(pred, 0, hazards[1], &curr, &succ))
+		{
+			backoff_failed(&b);
+			if(kv_list_node_test_if_deleted(pred->next[0]))
+			{
+				// deleted under us, so its next pointer can't be trusted any more
+				*hazards[2] = pred;
+				curr = search(s, pred->key, SEARCH_UPPER, hazards, &b);
+				*hazards[2] = nullptr;
+				break;
+			}
+		}
+	}
+	backoff_done(&b);
+	deallocate_hazard_pointers(hkey);
+}
+
+bool interlocked_skip_list_is_empty(const interlocked_skip_list_t* s)
+{
+	// skipping over deleted nodes means unlinking them
+	return !lookup((interlocked_skip_list_t*)s, nullptr, SEARCH_FIRST, false, nullptr, nullptr);
+}
+
+contention_t* interlocked_skip_list_contention(interlocked_skip_list_t* s)
+{
+	return &s->contention;
+}
@@ -0,0 +1,61 @@
+#include "stdafx.h"
+
+#include "interlocked_skip_list_nodes.h"
+
+#include <intrin.h>
+
+skip_list_node_t* new_skip_list_node(const void* key, void* value, destructor_t key_destructor, destructor_t value_destructor, LONG height)
+{
+	size_t size = sizeof(skip_list_node_t) + ((height - 1) * sizeof(skip_list_node_t*));
+	skip_list_node_t* n = smr_alloc(size);
+	memset(n, 0, size);
+	n->key = key;
+	n->value = value;
+	n->key_destructor = key_destructor;
+	n->value_destructor = value_destructor;
+	n->link_count = height;
+	n->height = height;
+	return n;
+}
+
+static bool finalize_node(void* context, void* ptr)
+{
+	skip_list_node_t* n = ptr;
+	UNREFERENCED_PARAMETER(context);
+	n->key_destructor(n->key);
+	n->value_destructor(n->value);
+	return true;
+}
+
+void release_skip_list_links(skip_list_node_t* n, LONG count)
+{
+	if(InterlockedExchangeAdd(&n->link_count, -count) == count)
+	{
+		smr_retire_with_finalizer(n, &finalize_node, nullptr);
+	}
+}
+
+LONG random_skip_list_height(LONG max_level)
+{
+	unsigned __int64 r = __rdtsc() ^ ((unsigned __int64)GetCurrentThreadId() << 32);
+	LONG height = 1;
+	// the low bits of the TSC are too regular to use as they are (murmur3 finaliser)
+	r ^= r >> 33;
+	r *= 0xff51afd7ed558ccdULL;
+	r ^= r >> 33;
+	r *= 0xc4ceb9fe1a85ec53ULL;
+	r ^= r >> 33;
+	while((r & 1) && height < max_level)
+	{
+		++height;
+		r >>= 1;
+	}
+	return height;
+}
+
+void swap_hazards(void* volatile** a, void* volatile** b)
+{
+	void* volatile* tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
@@ -1,6 +1,10 @@
 #include "stdafx.h"
 
 #include "interlocked_stack.h"
+#include "concurrent_counter.h"
+#include "backoff.h"
+
+#include <intrin.h>
 
 typedef struct interlocked_stack_node
 {
@@ -15,10 +19,103 @@ interlocked_stack_node_t* new_interlocked_stack_node()
 	return n;
 }
 
+// An elimination array (Hendler, Shavit, and Yerushalmi). A push that loses
+// the race for top parks its value in a random slot for a little while; a pop
+// that loses the race looks in a random slot, and if it finds a value, takes
+// it. The two cancel out without either of them touching top.
+//
+// Each slot is a word holding a state and a sequence number, plus the value.
+// The sequence number is bumped whenever the slot goes back to empty, so a pop
+// that read an offer can't take a later one with the same state.
+#define ELIMINATION_SLOTS	32
+#define ELIMINATION_SPINS	128
+
+#define SLOT_EMPTY	0
+#define SLOT_FILLING	1
+#define SLOT_OFFERED	2
+#define SLOT_TAKEN	3
+
+#define SLOT_STATE(word)	((word) & 3)
+#define SLOT_WORD(sequence, state)	((LONG)(((ULONG)(sequence) << 2) | (state)))
+#define SLOT_SEQUENCE(word)	((ULONG)(word) >> 2)
+
+typedef struct elimination_slot
+{
+	CACHE_ALIGN volatile LONG word;
+	void* volatile value;
+} elimination_slot_t;
+
+// width is how many of the slots are in use. It shrinks when offers go
+// untaken, so that pushes and pops meet, and grows when pushes find their slot
+// busy. It's only a hint, so racing updates don't matter.
+typedef struct elimination_array
+{
+	CACHE_ALIGN volatile LONG width;
+	elimination_slot_t slots[ELIMINATION_SLOTS];
+} elimination_array_t;
+
+static elimination_slot_t* random_slot(elimination_array_t* e)
+{
+	LONG width = e->width;
+	return &e->slots[(ULONG)__rdtsc() % (ULONG)width];
+}
+
+static bool eliminate_push(elimination_array_t* e, void* data)
+{
+	elimination_slot_t* slot = random_slot(e);
+	LONG width = e->width;
+	LONG word = slot->word;
+	ULONG sequence = SLOT_SEQUENCE(word);
+	long spins = 0;
+
+	if(SLOT_STATE(word) != SLOT_EMPTY || !cas(&slot->word, word, SLOT_WORD(sequence, SLOT_FILLING)))
+	{
+		if(width < ELIMINATION_SLOTS) { e->width = width + 1; }
+		return false;
+	}
+	slot->value = data;
+	slot->word = SLOT_WORD(sequence, SLOT_OFFERED);
+
+	for(spins = 0; spins < ELIMINATION_SPINS && SLOT_STATE(slot->word) == SLOT_OFFERED; ++spins)
+	{
+		YieldProcessor();
+	}
+	if(cas(&slot->word, SLOT_WORD(sequence, SLOT_OFFERED), SLOT_WORD(sequence + 1, SLOT_EMPTY)))
+	{
+		if(width > 1) { e->width = width - 1; }
+		return false;
+	}
+	// a pop took it, and nobody else can touch the slot until it's emptied
+	slot->word = SLOT_WORD(sequence + 1, SLOT_EMPTY);
+	return true;
+}
+
+static bool eliminate_pop(elimination_array_t* e, void** output)
+{
+	elimination_slot_t* slot = random_slot(e);
+	LONG word = slot->word;
+	void* data = nullptr;
+
+	if(SLOT_STATE(word) != SLOT_OFFERED)
+	{
+		return false;
+	}
+	data = slot->value;
+	if(!cas(&slot->word, word, SLOT_WORD(SLOT_SEQUENCE(word), SLOT_TAKEN)))
+	{
+		return false;
+	}
+	*output = data;
+	return true;
+}
+
 typedef struct interlocked_stack
 {
 	CACHE_ALIGN interlocked_stack_node_t* top;
 	destructor_t value_destructor;
+	concurrent_counter_t* depth;
+	elimination_array_t* elimination;
+	CACHE_ALIGN contention_t contention;
 } interlocked_stack_t;
 
 interlocked_stack_t* new_interlocked_stack(destructor_t value_destructor)
@@ -26,6 +123,17 @@ interlocked_stack_t* new_interlocked_stack(destructor_t value_destructor)
 	interlocked_stack_t* s = smr_alloc(sizeof(interlocked_stack_t));
 	memset(s, 0, sizeof(interlocked_stack_t));
 	s->value_destructor = value_destructor;
+	s->depth = new_concurrent_counter();
+	contention_init(&s->contention, BACKOFF_NONE);
+	return s;
+}
+
+interlocked_stack_t* new_interlocked_elimination_stack(destructor_t value_destructor)
+{
+	interlocked_stack_t* s = new_interlocked_stack(value_destructor);
+	s->elimination = smr_alloc(sizeof(elimination_array_t));
+	memset(s->elimination, 0, sizeof(elimination_array_t));
+	s->elimination->width = 1;
 	return s;
 }
 
@@ -36,6 +144,13 @@ void delete_interlocked_stack(interlocked_stack_t* s)
 	{
 		s->value_destructor(value);
 	}
+	delete_concurrent_counter(s->depth);
+	s->depth = nullptr;
+	if(s->elimination)
+	{
+		smr_retire(s->elimination);
+		s->elimination = nullptr;
+	}
 	smr_retire(s);
 }
 
@@ -43,7 +158,9 @@ void interlocked_stack_push(interlocked_stack_t* s, void* data)
 {
 	interlocked_stack_node_t* node = new_interlocked_stack_node();
 	interlocked_stack_node_t* t = nullptr;
+	backoff_t b;
 	node->data = data;
+	backoff_init(&b, &s->contention);
 
 	for(;;)
 	{
@@ -53,7 +170,17 @@ void interlocked_stack_push(interlocked_stack_t* s, void* data)
 		{
 			break;
 		}
+		if(s->elimination && eliminate_push(s->elimination, data))
+		{
+			// nobody ever saw the node; and a push that met a pop leaves the depth alone
+			smr_free(node);
+			backoff_done(&b);
+			return;
+		}
+		backoff_failed(&b);
 	}
+	backoff_done(&b);
+	concurrent_counter_increment(s->depth);
 }
 
 bool interlocked_stack_pop(interlocked_stack_t* s, void** output)
@@ -61,10 +188,12 @@ bool interlocked_stack_pop(interlocked_stack_t* s, void** output)
 	interlocked_stack_node_t* next = nullptr;
 	interlocked_stack_node_t* t = nullptr;
 	void* data = nullptr;
+	backoff_t b;
 	void* volatile* hazards[1] = { nullptr };
 	void* key = allocate_hazard_pointers(1, hazards);
 	if(!hazards[0]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
 
+	backoff_init(&b, &s->contention);
 	for(;;)
 	{
 		t = s->top;
@@ -72,6 +201,7 @@ bool interlocked_stack_pop(interlocked_stack_t* s, void** output)
 		{
 			if(output) { *output = nullptr; }
 			deallocate_hazard_pointers(key);
+			backoff_done(&b);
 			return false;
 		}
 		*hazards[0] = t;
@@ -85,19 +215,36 @@ bool interlocked_stack_pop(interlocked_stack_t* s, void** output)
 		{
 			break;
 		}
+		if(s->elimination && eliminate_pop(s->elimination, &data))
+		{
+			deallocate_hazard_pointers(key);
+			backoff_done(&b);
+			if(output) { *output = data; }
+			return true;
+		}
+		backoff_failed(&b);
 	}
+	backoff_done(&b);
 	data = t->data;
 	t->next = nullptr; // make delinking detectable, otherwise this can be pointing off at no-man's land
 	MemoryBarrier();
 	deallocate_hazard_pointers(key);
 	smr_retire(t);
+	concurrent_counter_decrement(s->depth);
 	if(output) { *output = data; }
 	return true;
 }
 
+long interlocked_stack_depth(const interlocked_stack_t* s)
+{
+	// pushes and pops update the counter after the fact, so it can briefly dip below zero
+	LONG64 depth = concurrent_counter_estimate_get(s->depth);
+	return depth > 0 ? (long)depth : 0;
+}
+
 #define MAX_RETRIES	3
 
-long interlocked_stack_depth(const interlocked_stack_t* s)
+long interlocked_stack_exact_depth(const interlocked_stack_t* s)
 {
 	interlocked_stack_node_t* t = nullptr;
 	interlocked_stack_node_t* next = nullptr;
@@ -112,6 +259,7 @@ long interlocked_stack_depth(const interlocked_stack_t* s)
 		t = s->top;
 		if(t == nullptr)
 		{
+			deallocate_hazard_pointers(key);
 			return count;
 		}
 		*hazards[0] = t;
@@ -142,3 +290,8 @@ bool interlocked_stack_is_empty(const interlocked_stack_t* s)
 {
 	return s->top == nullptr;
 }
+
+contention_t* interlocked_stack_contention(interlocked_stack_t* s)
+{
+	return &s->contention;
+}
@@ -0,0 +1,13 @@
+#include "stdafx.hpp"
+
+#include "interlocked_value_queue.hpp"
+
+#include <string>
+
+// force instantiation
+
+// primitive (no-destructor) types
+template struct utility::interlocked_value_queue<int>;
+
+// complex (class) types
+template struct utility::interlocked_value_queue<std::string>;
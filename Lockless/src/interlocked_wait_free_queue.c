@@ -0,0 +1,514 @@
+#include "stdafx.h"
+
+#include "interlocked_wait_free_queue.h"
+
+// Kogan and Petrank's fast-path/slow-path construction: a Michael-Scott queue
+// whose operations give up after MAX_FAILURES attempts and announce themselves
+// with a phase number. Every operation with a later phase, and every fast-path
+// operation once every HELPING_DELAY calls, helps announced operations along,
+// which bounds the number of steps any one operation can take.
+
+// fast-path attempts before an operation announces itself and asks for help
+#define MAX_FAILURES	16
+// fast-path operations between checks on whether a peer needs help
+#define HELPING_DELAY	8
+
+#define NO_THREAD	(-1L)
+
+typedef struct interlocked_wait_free_queue_node
+{
+	struct interlocked_wait_free_queue_node* next;
+	void* data;
+	// handle of the slow-path enqueuer that owns this node, or NO_THREAD
+	LONG enqueuer;
+	// handle of the dequeuer that has claimed this node's successor, or NO_THREAD
+	volatile LONG dequeuer;
+} interlocked_wait_free_queue_node_t;
+
+interlocked_wait_free_queue_node_t* new_interlocked_wait_free_queue_node(void* data, LONG enqueuer)
+{
+	interlocked_wait_free_queue_node_t* n = smr_alloc(sizeof(interlocked_wait_free_queue_node_t));
+	n->next = nullptr;
+	n->data = data;
+	n->enqueuer = enqueuer;
+	n->dequeuer = NO_THREAD;
+	return n;
+}
+
+// an announced operation. These are never modified once published; helpers
+// replace them wholesale with CAS and the loser frees its copy.
+typedef struct interlocked_wait_free_queue_operation
+{
+	LONG64 phase;
+	bool pending;
+	bool enqueue;
+	interlocked_wait_free_queue_node_t* node;
+	// the value a completed dequeue took, captured by whoever completed it
+	void* data;
+} interlocked_wait_free_queue_operation_t;
+
+interlocked_wait_free_queue_operation_t* new_interlocked_wait_free_queue_operation(LONG64 phase, bool pending, bool enqueue, interlocked_wait_free_queue_node_t* node, void* data)
+{
+	interlocked_wait_free_queue_operation_t* op = smr_alloc(sizeof(interlocked_wait_free_queue_operation_t));
+	op->phase = phase;
+	op->pending = pending;
+	op->enqueue = enqueue;
+	op->node = node;
+	op->data = data;
+	return op;
+}
+
+typedef struct interlocked_wait_free_queue_handle
+{
+	CACHE_ALIGN interlocked_wait_free_queue_operation_t* state;
+	LONG id;
+	volatile LONG active;
+	LONG help_cursor;
+	LONG help_countdown;
+} interlocked_wait_free_queue_handle_t;
+
+typedef struct interlocked_wait_free_queue
+{
+	CACHE_ALIGN interlocked_wait_free_queue_node_t* head;
+	CACHE_ALIGN interlocked_wait_free_queue_node_t* tail;
+	CACHE_ALIGN volatile LONG64 phase;
+
+	LONG max_threads;
+	interlocked_wait_free_queue_handle_t* handles;
+	destructor_t value_destructor;
+} interlocked_wait_free_queue_t;
+
+interlocked_wait_free_queue_t* new_interlocked_wait_free_queue(destructor_t value_destructor, long max_threads)
+{
+	LONG i;
+	interlocked_wait_free_queue_t* q = smr_alloc(sizeof(interlocked_wait_free_queue_t));
+	memset(q, 0, sizeof(interlocked_wait_free_queue_t));
+	q->head = q->tail = new_interlocked_wait_free_queue_node(nullptr, NO_THREAD);
+	q->max_threads = max_threads;
+	q->handles = smr_alloc(max_threads * sizeof(interlocked_wait_free_queue_handle_t));
+	memset(q->handles, 0, max_threads * sizeof(interlocked_wait_free_queue_handle_t));
+	for(i = 0; i < max_threads; ++i)
+	{
+		q->handles[i].id = i;
+	}
+	q->value_destructor = value_destructor;
+	return q;
+}
+
+void delete_interlocked_wait_free_queue(interlocked_wait_free_queue_t* q)
+{
+	LONG i;
+	interlocked_wait_free_queue_node_t* n = q->head;
+	interlocked_wait_free_queue_node_t* next = nullptr;
+	// nobody else can be using the queue by now, so the chain can be walked directly
+	while(n != nullptr)
+	{
+		next = n->next;
+		if(n != q->head)
+		{
+			q->value_destructor(n->data);
+		}
+		smr_retire(n);
+		n = next;
+	}
+	for(i = 0; i < q->max_threads; ++i)
+	{
+		if(q->handles[i].state != nullptr)
+		{
+			smr_retire(q->handles[i].state);
+		}
+	}
+	smr_retire(q->handles);
+	q->head = nullptr;
+	q->tail = nullptr;
+	smr_retire(q);
+}
+
+interlocked_wait_free_queue_handle_t* interlocked_wait_free_queue_register(interlocked_wait_free_queue_t* q)
+{
+	LONG i;
+	for(i = 0; i < q->max_threads; ++i)
+	{
+		interlocked_wait_free_queue_handle_t* h = &q->handles[i];
+		if(h->active)
+		{
+			continue;
+		}
+		if(cas(&h->active, 0, 1))
+		{
+			h->help_cursor = (i + 1) % q->max_threads;
+			h->help_countdown = HELPING_DELAY;
+			return h;
+		}
+	}
+	return nullptr;
+}
+
+void interlocked_wait_free_queue_unregister(interlocked_wait_free_queue_t* q, interlocked_wait_free_queue_handle_t* h)
+{
+	UNREFERENCED_PARAMETER(q);
+	InterlockedExchange(&h->active, 0);
+}
+
+static interlocked_wait_free_queue_node_t* protect_node(interlocked_wait_free_queue_node_t* const volatile* location, void* volatile* hazard)
+{
+	interlocked_wait_free_queue_node_t* n = nullptr;
+	do
+	{
+		n = *location;
+		*hazard = n;
+		MemoryBarrier();
+	}
+	while(*location != n);
+	return n;
+}
+
+static interlocked_wait_free_queue_operation_t* protect_state(interlocked_wait_free_queue_handle_t* h, void* volatile* hazard)
+{
+	interlocked_wait_free_queue_operation_t* op = nullptr;
+	do
+	{
+		op = h->state;
+		*hazard = op;
+		MemoryBarrier();
+	}
+	while(h->state != op);
+	return op;
+}
+
+static bool is_still_pending(interlocked_wait_free_queue_t* q, LONG tid, LONG64 phase, bool enqueue, void* volatile* hazard)
+{
+	interlocked_wait_free_queue_operation_t* op = protect_state(&q->handles[tid], hazard);
+	return op != nullptr && op->pending && op->enqueue == enqueue && op->phase <= phase;
+}
+
+static bool replace_state(interlocked_wait_free_queue_handle_t* h, interlocked_wait_free_queue_operation_t* expected, interlocked_wait_free_queue_operation_t* desired)
+{
+	if(casp((void* volatile*)&h->state, expected, desired))
+	{
+		if(expected != nullptr)
+		{
+			smr_retire(expected);
+		}
+		return true;
+	}
+	// never published, so there's nobody to defer the free for
+	smr_free(desired);
+	return false;
+}
+
+// hazards[0] and hazards[1] protect nodes, hazards[2] protects an operation
+static void help_finish_enqueue(interlocked_wait_free_queue_t* q, void* volatile** hazards)
+{
+	interlocked_wait_free_queue_node_t* last = protect_node(&q->tail, hazards[0]);
+	interlocked_wait_free_queue_node_t* next = last->next;
+	if(next == nullptr)
+	{
+		return;
+	}
+	*hazards[1] = next;
+	MemoryBarrier();
+	// next can only be dequeued, and hence retired, once the tail has moved past last
+	if(q->tail != last)
+	{
+		return;
+	}
+	if(next->enqueuer != NO_THREAD)
+	{
+		interlocked_wait_free_queue_handle_t* h = &q->handles[next->enqueuer];
+		interlocked_wait_free_queue_operation_t* op = protect_state(h, hazards[2]);
+		if(q->tail == last && op != nullptr && op->pending && op->enqueue && op->node == next)
+		{
+			replace_state(h, op, new_interlocked_wait_free_queue_operation(op->phase, false, true, next, nullptr));
+		}
+	}
+	casp((void* volatile*)&q->tail, last, next);
+}
+
+static void help_finish_dequeue(interlocked_wait_free_queue_t* q, void* volatile** hazards)
+{
+	interlocked_wait_free_queue_node_t* first = protect_node(&q->head, hazards[0]);
+	interlocked_wait_free_queue_node_t* next = first->next;
+	LONG tid = NO_THREAD;
+	if(next == nullptr)
+	{
+		return;
+	}
+	*hazards[1] = next;
+	MemoryBarrier();
+	if(q->head != first)
+	{
+		return;
+	}
+	tid = first->dequeuer;
+	if(tid == NO_THREAD)
+	{
+		return;
+	}
+	{
+		interlocked_wait_free_queue_handle_t* h = &q->handles[tid];
+		interlocked_wait_free_queue_operation_t* op = protect_state(h, hazards[2]);
+		// fast-path dequeuers claim nodes too, but they have nothing announced
+		if(q->head == first && op != nullptr && op->pending && !op->enqueue && op->node == first)
+		{
+			replace_state(h, op, new_interlocked_wait_free_queue_operation(op->phase, false, false, first, next->data));
+		}
+	}
+	if(casp((void* volatile*)&q->head, first, next))
+	{
+		*hazards[0] = nullptr;
+		smr_retire(first);
+	}
+}
+
+static void help_enqueue(interlocked_wait_free_queue_t* q, LONG tid, LONG64 phase, void* volatile** hazards)
+{
+	while(is_still_pending(q, tid, phase, true, hazards[2]))
+	{
+		interlocked_wait_free_queue_node_t* last = protect_node(&q->tail, hazards[0]);
+		interlocked_wait_free_queue_node_t* next = last->next;
+		if(q->tail != last)
+		{
+			continue;
+		}
+		if(next == nullptr)
+		{
+			interlocked_wait_free_queue_operation_t* op = protect_state(&q->handles[tid], hazards[2]);
+			if(op != nullptr && op->pending && op->enqueue && op->phase <= phase)
+			{
+				// last is still the end of the list, so op->node can't have been linked
+				// already; linking it takes the tail past last and that needs op completed
+				if(casp((void* volatile*)&last->next, nullptr, op->node))
+				{
+					help_finish_enqueue(q, hazards);
+					return;
+				}
+			}
+		}
+		else
+		{
+			help_finish_enqueue(q, hazards);
+		}
+	}
+}
+
+static void help_dequeue(interlocked_wait_free_queue_t* q, LONG tid, LONG64 phase, void* volatile** hazards)
+{
+	interlocked_wait_free_queue_handle_t* h = &q->handles[tid];
+	while(is_still_pending(q, tid, phase, false, hazards[2]))
+	{
+		interlocked_wait_free_queue_node_t* first = protect_node(&q->head, hazards[0]);
+		interlocked_wait_free_queue_node_t* last = q->tail;
+		interlocked_wait_free_queue_node_t* next = first->next;
+		interlocked_wait_free_queue_operation_t* op = nullptr;
+		*hazards[1] = next;
+		MemoryBarrier();
+		if(q->head != first)
+		{
+			continue;
+		}
+		if(first == last)
+		{
+			if(next == nullptr)
+			{
+				op = protect_state(h, hazards[2]);
+				if(q->tail == last && op != nullptr && op->pending && !op->enqueue && op->phase <= phase)
+				{
+					// queue was empty at the linearization point
+					replace_state(h, op, new_interlocked_wait_free_queue_operation(op->phase, false, false, nullptr, nullptr));
+				}
+			}
+			else
+			{
+				help_finish_enqueue(q, hazards);
+			}
+			continue;
+		}
+		op = protect_state(h, hazards[2]);
+		if(op == nullptr || !op->pending || op->enqueue || op->phase > phase)
+		{
+			break;
+		}
+		if(q->head == first && op->node != first)
+		{
+			if(!replace_state(h, op, new_interlocked_wait_free_queue_operation(op->phase, true, false, first, nullptr)))
+			{
+				continue;
+			}
+		}
+		InterlockedCompareExchange(&first->dequeuer, tid, NO_THREAD);
+		help_finish_dequeue(q, hazards);
+	}
+}
+
+static void help_operation(interlocked_wait_free_queue_t* q, LONG tid, LONG64 phase, void* volatile** hazards)
+{
+	interlocked_wait_free_queue_operation_t* op = protect_state(&q->handles[tid], hazards[2]);
+	if(op != nullptr && op->pending && op->phase <= phase)
+	{
+		if(op->enqueue)
+		{
+			help_enqueue(q, tid, op->phase, hazards);
+		}
+		else
+		{
+			help_dequeue(q, tid, op->phase, hazards);
+		}
+	}
+}
+
+static void help_all(interlocked_wait_free_queue_t* q, LONG64 phase, void* volatile** hazards)
+{
+	LONG i;
+	for(i = 0; i < q->max_threads; ++i)
+	{
+		help_operation(q, i, phase, hazards);
+	}
+}
+
+// fast-path operations take turns looking in on one peer, so that an announced
+// operation can't starve even when no other thread ever takes the slow path
+static void help_if_needed(interlocked_wait_free_queue_t* q, interlocked_wait_free_queue_handle_t* h, void* volatile** hazards)
+{
+	if(--h->help_countdown > 0)
+	{
+		return;
+	}
+	h->help_countdown = HELPING_DELAY;
+	help_operation(q, h->help_cursor, MAXLONGLONG, hazards);
+	h->help_cursor = (h->help_cursor + 1) % q->max_threads;
+}
+
+static void announce(interlocked_wait_free_queue_handle_t* h, interlocked_wait_free_queue_operation_t* op)
+{
+	// only the owner ever replaces a descriptor that isn't pending
+	interlocked_wait_free_queue_operation_t* old = InterlockedExchangePointer((void* volatile*)&h->state, op);
+	if(old != nullptr)
+	{
+		smr_retire(old);
+	}
+}
+
+void interlocked_wait_free_queue_push(interlocked_wait_free_queue_t* q, interlocked_wait_free_queue_handle_t* h, void* data)
+{
+	interlocked_wait_free_queue_node_t* node = new_interlocked_wait_free_queue_node(data, NO_THREAD);
+	interlocked_wait_free_queue_node_t* last = nullptr;
+	interlocked_wait_free_queue_node_t* next = nullptr;
+	LONG64 phase = 0;
+	int tries = 0;
+	void* volatile* hazards[3] = { nullptr };
+	void* key = allocate_hazard_pointers(3, hazards);
+	if(!hazards[0] || !hazards[1] || !hazards[2]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return; }
+
+	help_if_needed(q, h, hazards);
+
+	for(tries = 0; tries < MAX_FAILURES; ++tries)
+	{
+		last = protect_node(&q->tail, hazards[0]);
+		next = last->next;
+		if(q->tail != last)
+		{
+			continue;
+		}
+		if(next == nullptr)
+		{
+			if(casp((void* volatile*)&last->next, nullptr, node))
+			{
+				help_finish_enqueue(q, hazards);
+				deallocate_hazard_pointers(key);
+				return;
+			}
+		}
+		else
+		{
+			help_finish_enqueue(q, hazards);
+		}
+	}
+
+	// slow path
+	node->enqueuer = h->id;
+	phase = InterlockedIncrement64(&q->phase);
+	announce(h, new_interlocked_wait_free_queue_operation(phase, true, true, node, nullptr));
+	help_all(q, phase, hazards);
+	help_finish_enqueue(q, hazards);
+	deallocate_hazard_pointers(key);
+}
+
+bool interlocked_wait_free_queue_pop(interlocked_wait_free_queue_t* q, interlocked_wait_free_queue_handle_t* h, void** output)
+{
+	interlocked_wait_free_queue_node_t* first = nullptr;
+	interlocked_wait_free_queue_node_t* last = nullptr;
+	interlocked_wait_free_queue_node_t* next = nullptr;
+	interlocked_wait_free_queue_operation_t* op = nullptr;
+	void* data = nullptr;
+	LONG64 phase = 0;
+	int tries = 0;
+	void* volatile* hazards[3] = { nullptr };
+	void* key = allocate_hazard_pointers(3, hazards);
+	if(!hazards[0] || !hazards[1] || !hazards[2]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	help_if_needed(q, h, hazards);
+
+	for(tries = 0; tries < MAX_FAILURES; ++tries)
+	{
+		first = protect_node(&q->head, hazards[0]);
+		last = q->tail;
+		next = first->next;
+		*hazards[1] = next;
+		MemoryBarrier();
+		if(q->head != first)
+		{
+			continue;
+		}
+		if(first == last)
+		{
+			if(next == nullptr)
+			{
+				deallocate_hazard_pointers(key);
+				if(output) { *output = nullptr; }
+				return false;
+			}
+			help_finish_enqueue(q, hazards);
+			continue;
+		}
+		if(next == nullptr)
+		{
+			continue;
+		}
+		data = next->data;
+		if(InterlockedCompareExchange(&first->dequeuer, h->id, NO_THREAD) == NO_THREAD)
+		{
+			help_finish_dequeue(q, hazards);
+			deallocate_hazard_pointers(key);
+			if(output) { *output = data; }
+			return true;
+		}
+		help_finish_dequeue(q, hazards);
+	}
+
+	// slow path
+	phase = InterlockedIncrement64(&q->phase);
+	announce(h, new_interlocked_wait_free_queue_operation(phase, true, false, nullptr, nullptr));
+	help_all(q, phase, hazards);
+	help_finish_dequeue(q, hazards);
+	deallocate_hazard_pointers(key);
+
+	// our own completed descriptor can only be replaced by us
+	op = h->state;
+	data = op->node != nullptr ? op->data : nullptr;
+	if(output) { *output = data; }
+	return data != nullptr;
+}
+
+bool interlocked_wait_free_queue_is_empty(const interlocked_wait_free_queue_t* q)
+{
+	bool empty = false;
+	void* volatile* hazards[1] = { nullptr };
+	void* key = allocate_hazard_pointers(1, hazards);
+	if(!hazards[0]) { RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return false; }
+
+	empty = protect_node(&q->head, hazards[0])->next == nullptr;
+
+	deallocate_hazard_pointers(key);
+	return empty;
+}
@@ -0,0 +1,241 @@
+#include "stdafx.h"
+
+#include "object_pool.h"
+#include "interlocked_stack.h"
+
+#define MAGAZINE_SIZE	32
+
+typedef struct magazine
+{
+	long count;
+	void* objects[MAGAZINE_SIZE];
+} magazine_t;
+
+static magazine_t* new_magazine()
+{
+	magazine_t* m = smr_alloc(sizeof(magazine_t));
+	m->count = 0;
+	return m;
+}
+
+static void delete_magazine(magazine_t* m)
+{
+	long i = 0;
+	for(i = 0; i < m->count; ++i)
+	{
+		smr_free(m->objects[i]);
+	}
+	smr_free(m);
+}
+
+static void delete_depot_magazine(const void* m)
+{
+	delete_magazine((magazine_t*)m);
+}
+
+// A cache belongs to one thread at a time. When its thread exits, the cache is
+// flushed into the depot and left idle for the next new thread to pick up; the
+// pool only frees caches when it's deleted. If the pool goes first, the thread
+// frees its own cache on the way out, but not until the pool has finished
+// emptying it.
+#define CACHE_LIVE	0
+#define CACHE_FLUSHING	1
+#define CACHE_IDLE	2
+#define CACHE_ORPHANING	3
+#define CACHE_ORPHANED	4
+
+typedef struct object_pool_cache
+{
+	CACHE_ALIGN magazine_t* loaded;
+	magazine_t* previous;
+	object_pool_t* pool;
+	struct object_pool_cache* next;
+	CACHE_ALIGN volatile LONG state;
+} object_pool_cache_t;
+
+typedef struct object_pool
+{
+	size_t object_size;
+	DWORD tls_slot;
+	// magazines with something in them, and magazines with nothing in them
+	interlocked_stack_t* full;
+	interlocked_stack_t* empty;
+	CACHE_ALIGN object_pool_cache_t* volatile caches;
+} object_pool_t;
+
+object_pool_t* new_object_pool(size_t object_size)
+{
+	object_pool_t* p = smr_alloc(sizeof(object_pool_t));
+	memset(p, 0, sizeof(object_pool_t));
+	p->object_size = object_size;
+	p->tls_slot = TlsAlloc();
+	if(p->tls_slot == TLS_OUT_OF_INDEXES) { smr_free(p); RaiseException(ERROR_NOT_ENOUGH_MEMORY, 0, 0, nullptr); return nullptr; }
+	p->full = new_interlocked_stack(&delete_depot_magazine);
+	p->empty = new_interlocked_stack(&delete_depot_magazine);
+	return p;
+}
+
+static void flush_cache(object_pool_cache_t* c)
+{
+	magazine_t* magazines[2] = { c->loaded, c->previous };
+	int i = 0;
+	for(i = 0; i < 2; ++i)
+	{
+		if(magazines[i] == nullptr)
+		{
+			continue;
+		}
+		interlocked_stack_push(magazines[i]->count > 0 ? c->pool->full : c->pool->empty, magazines[i]);
+	}
+	c->loaded = nullptr;
+	c->previous = nullptr;
+}
+
+static void on_thread_exit(void* context)
+{
+	object_pool_cache_t* c = context;
+	if(cas(&c->state, CACHE_LIVE, CACHE_FLUSHING))
+	{
+		flush_cache(c);
+		c->state = CACHE_IDLE;
+	}
+	else
+	{
+		// the pool's being deleted, and may still be freeing our magazines
+		while(c->state == CACHE_ORPHANING)
+		{
+			YieldProcessor();
+		}
+		smr_free(c);
+	}
+}
+
+void delete_object_pool(object_pool_t* p)
+{
+	object_pool_cache_t* c = p->caches;
+	while(c != nullptr)
+	{
+		object_pool_cache_t* next = c->next;
+		if(cas(&c->state, CACHE_LIVE, CACHE_ORPHANING))
+		{
+			// its thread is still running, and will free the cache when it exits;
+			// it waits for this first, so the cache can't go away under us
+			if(c->loaded) { delete_magazine(c->loaded); }
+			if(c->previous) { delete_magazine(c->previous); }
+			c->loaded = nullptr;
+			c->previous = nullptr;
+			c->state = CACHE_ORPHANED;
+		}
+		else
+		{
+			while(c->state == CACHE_FLUSHING)
+			{
+				YieldProcessor();
+			}
+			smr_free(c);
+		}
+		c = next;
+	}
+	p->caches = nullptr;
+	delete_interlocked_stack(p->full);
+	delete_interlocked_stack(p->empty);
+	TlsFree(p->tls_slot);
+	smr_retire(p);
+}
+
+static object_pool_cache_t* attach_cache(object_pool_t* p)
+{
+	object_pool_cache_t* c = nullptr;
+	object_pool_cache_t* head = nullptr;
+
+	for(c = p->caches; c != nullptr; c = c->next)
+	{
+		if(c->state == CACHE_IDLE && cas(&c->state, CACHE_IDLE, CACHE_LIVE))
+		{
+			break;
+		}
+	}
+	if(c == nullptr)
+	{
+		c = smr_alloc(sizeof(object_pool_cache_t));
+		memset(c, 0, sizeof(object_pool_cache_t));
+		c->pool = p;
+		c->state = CACHE_LIVE;
+		do
+		{
+			head = p->caches;
+			c->next = head;
+		}
+		while(!casp((void* volatile*)&p->caches, head, c));
+	}
+	c->loaded = new_magazine();
+	c->previous = new_magazine();
+	smr_at_thread_exit(&on_thread_exit, c);
+	TlsSetValue(p->tls_slot, c);
+	return c;
+}
+
+static object_pool_cache_t* get_cache(object_pool_t* p)
+{
+	object_pool_cache_t* c = TlsGetValue(p->tls_slot);
+	return c != nullptr ? c : attach_cache(p);
+}
+
+static void swap_magazines(object_pool_cache_t* c)
+{
+	magazine_t* m = c->loaded;
+	c->loaded = c->previous;
+	c->previous = m;
+}
+
+void* object_pool_acquire(object_pool_t* p)
+{
+	object_pool_cache_t* c = get_cache(p);
+	void* full = nullptr;
+
+	if(c->loaded->count > 0)
+	{
+		return c->loaded->objects[--c->loaded->count];
+	}
+	if(c->previous->count > 0)
+	{
+		swap_magazines(c);
+		return c->loaded->objects[--c->loaded->count];
+	}
+	// both empty; trade one in for a full one
+	if(interlocked_stack_pop(p->full, &full))
+	{
+		interlocked_stack_push(p->empty, c->previous);
+		c->previous = c->loaded;
+		c->loaded = full;
+		return c->loaded->objects[--c->loaded->count];
+	}
+	return smr_alloc(p->object_size);
+}
+
+void object_pool_release(object_pool_t* p, void* object)
+{
+	object_pool_cache_t* c = get_cache(p);
+	void* empty = nullptr;
+
+	if(c->loaded->count < MAGAZINE_SIZE)
+	{
+		c->loaded->objects[c->loaded->count++] = object;
+		return;
+	}
+	if(c->previous->count < MAGAZINE_SIZE)
+	{
+		swap_magazines(c);
+		c->loaded->objects[c->loaded->count++] = object;
+		return;
+	}
+	// both full; trade one in for an empty one
+	if(!interlocked_stack_pop(p->empty, &empty))
+	{
+		empty = new_magazine();
+	}
+	interlocked_stack_push(p->full, c->previous);
+	c->previous = c->loaded;
+	c->loaded = empty;
+	c->loaded->objects[c->loaded->count++] = object;
+}
@@ -0,0 +1,8 @@
+#include "stdafx.hpp"
+
+#include "sloppy_counter.hpp"
+
+// force instantiation
+template struct sloppy_counter<long long>;
+template struct sloppy_counter<unsigned long long>;
+template struct sloppy_counter<unsigned long long, cat_padded_layout>;
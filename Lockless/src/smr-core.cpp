@@ -6,6 +6,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <atomic>
+#include <memory>
 
 #pragma warning(disable : 4200) // warning C4200: nonstandard extension used : zero-sized array in struct/union
 #pragma warning(disable : 4204) // warning C4204: nonstandard extension used : non-constant aggregate initializer
@@ -65,10 +66,10 @@ struct retired_list_t
 	retired_data_t retired_items[0];
 };
 
-retired_list_t* new_retired_list()
+retired_list_t* new_retired_list(size_t minimum_size = 1)
 {
 	size_t size = total_hazard_pointers.load();
-	size = std::max(size, static_cast<size_t>(1));
+	size = std::max(size, minimum_size);
 	retired_list_t* rl = static_cast<retired_list_t*>(smr_alloc(sizeof(retired_list_t) + (size * sizeof(retired_data_t))));
 	std::memset(rl, 0, sizeof(retired_list_t) + (size * sizeof(retired_data_t)));
 	rl->maximum_size = size;
@@ -91,7 +92,8 @@ void retired_list_push(retired_list_t** l, retired_data_t val)
 	if((*l)->retired_count == (*l)->maximum_size)
 	{
 		retired_list_t* old_list = *l;
-		retired_list_t* new_list = new_retired_list();
+		// the hazard pointer total may not have moved since this list was sized
+		retired_list_t* new_list = new_retired_list(old_list->maximum_size * 2);
 		new_list->retired_count = old_list->retired_count;
 		std::memcpy(new_list->retired_items, old_list->retired_items, old_list->retired_count * sizeof(retired_data_t));
 		*l = new_list;
@@ -134,6 +136,8 @@ LONG retired_list_count(retired_list_t* l)
 	return l->retired_count;
 }
 
+struct thread_hpr_record_t;
+
 struct hazard_pointer_record_t
 {
 #ifdef _DEBUG
@@ -141,6 +145,9 @@ struct hazard_pointer_record_t
 #endif
 	hazard_pointer_record_t* next;
 	std::atomic<bool> active = ATOMIC_VAR_INIT(false);
+	// the thread that has it claimed; records can be in several threads'
+	// caches, so a thread can only give back the ones it's holding
+	thread_hpr_record_t* volatile owner;
 	LONG count;
 	void* volatile hazard_pointers[0];
 };
@@ -182,9 +189,11 @@ hpr_cache_t* new_hpr_cache(LONG count)
 
 void retire_hpr(hazard_pointer_record_t* hprec);
 
-void delete_hpr_cache(hpr_cache_t* hc)
+void delete_hpr_cache(hpr_cache_t* hc, thread_hpr_record_t* thr)
 {
-	if(hc->record)
+	// only if the thread left its pointers allocated; otherwise the record
+	// might be in use by another thread that also has it cached
+	if(hc->record && hc->record->owner == thr)
 	{
 		retire_hpr(hc->record);
 	}
@@ -194,6 +203,13 @@ void delete_hpr_cache(hpr_cache_t* hc)
 	_aligned_free(hc);
 }
 
+struct thread_exit_callback_record_t
+{
+	thread_exit_callback_t callback;
+	void* context;
+	thread_exit_callback_record_t* next;
+};
+
 struct thread_hpr_record_t
 {
 #ifdef _DEBUG
@@ -205,6 +221,7 @@ struct thread_hpr_record_t
 	// actual data
 	retired_list_t* retired_list;
 	hpr_cache_t* cache;
+	thread_exit_callback_record_t* exit_callbacks;
 };
 
 thread_hpr_record_t* new_thr()
@@ -266,6 +283,7 @@ void retire_hpr(hazard_pointer_record_t* hprec)
 	{
 		hprec->hazard_pointers[i] = nullptr;
 	}
+	hprec->owner = nullptr;
 	hprec->active.store(0);
 }
 
@@ -308,12 +326,30 @@ thread_hpr_record_t* get_mythrec()
 	return thr;
 }
 
+// these run before the thread's record is retired, so the callbacks can still
+// use containers
+void run_thread_exit_callbacks()
+{
+	thread_hpr_record_t* thr = static_cast<thread_hpr_record_t*>(TlsGetValue(thr_slot));
+	if(nullptr == thr)
+	{
+		return;
+	}
+	while(thr->exit_callbacks != nullptr)
+	{
+		thread_exit_callback_record_t* cb = thr->exit_callbacks;
+		thr->exit_callbacks = cb->next;
+		cb->callback(cb->context);
+		_aligned_free(cb);
+	}
+}
+
 void retire_thr(thread_hpr_record_t* thr)
 {
 	for(hpr_cache_t* cache = thr->cache; cache != nullptr;)
 	{
 		hpr_cache_t* next = cache->next;
-		delete_hpr_cache(cache);
+		delete_hpr_cache(cache, thr);
 		cache = next;
 	}
 	thr->cache = nullptr;
@@ -443,7 +479,8 @@ void* allocate_hazard_pointers(LONG count, void* volatile** pointers)
 
 	for(; cache != nullptr; cache = cache->next)
 	{
-		if(cache->record != nullptr && !cache->record->active.load() && cache->record->count >= count)
+		// records can end up in more than one thread's cache, so claiming one has to be atomic
+		if(cache->record != nullptr && cache->record->count >= count && !cache->record->active.load() && !atomic_test_and_set(cache->record->active))
 		{
 			hprec = cache->record;
 			break;
@@ -468,6 +505,7 @@ void* allocate_hazard_pointers(LONG count, void* volatile** pointers)
 		hprec = new_cache->record;
 	}
 	hprec->active.store(true);
+	hprec->owner = get_mythrec();
 	for(i = 0; i < count; ++i)
 	{
 		pointers[i] = &hprec->hazard_pointers[i];
@@ -479,6 +517,28 @@ void deallocate_hazard_pointers(void* key) {
 	retire_hpr(static_cast<hazard_pointer_record_t*>(key));
 }
 
+void smr_at_thread_exit(thread_exit_callback_t callback, void* context)
+{
+	thread_hpr_record_t* thr = get_mythrec();
+	// thread private, like the hazard cache
+	thread_exit_callback_record_t* cb = static_cast<thread_exit_callback_record_t*>(_aligned_malloc(sizeof(thread_exit_callback_record_t), CACHE_LINE));
+	cb->callback = callback;
+	cb->context = context;
+	cb->next = thr->exit_callbacks;
+	thr->exit_callbacks = cb;
+}
+
+void smr_thread_attach(LONG hazard_count)
+{
+	get_mythrec();
+	if(hazard_count > 0)
+	{
+		// leaves a record of the right size in the thread's cache
+		std::unique_ptr<void* volatile*[]> hazards(new void* volatile*[hazard_count]);
+		deallocate_hazard_pointers(allocate_hazard_pointers(hazard_count, hazards.get()));
+	}
+}
+
 void report_remaining_objects()
 {
 	if(head_thr.load() != nullptr && head_hpr.load() != nullptr)
@@ -557,6 +617,7 @@ void NTAPI on_tls_callback(void* dll, DWORD reason, void* reserved)
 	case DLL_THREAD_ATTACH:
 		break;
 	case DLL_THREAD_DETACH:
+		run_thread_exit_callbacks();
 		// no point in cleaning up if I never got things dirty to start with
 		if(head_thr.load() != nullptr && head_hpr.load() != nullptr)
 		{
@@ -564,6 +625,7 @@ void NTAPI on_tls_callback(void* dll, DWORD reason, void* reserved)
 		}
 		break;
 	case DLL_PROCESS_DETACH:
+		run_thread_exit_callbacks();
 		// the first thread only gets a process notification, not a thread notification.
 		if(head_thr.load() != nullptr && head_hpr.load() != nullptr)
 		{
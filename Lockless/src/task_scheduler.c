@@ -0,0 +1,381 @@
+#include "stdafx.h"
+
+#include "task_scheduler.h"
+#include "interlocked_deque.h"
+#include "interlocked_queue.h"
+
+#include <stdlib.h>
+
+// enough for the queue's pop, which is the most any worker needs at once
+#define WORKER_HAZARDS	2
+// how many times an idle worker looks for work before parking
+#define IDLE_SPINS	64
+
+typedef struct task
+{
+	task_proc_t proc;
+	void* context;
+	task_group_t* group;
+} task_t;
+
+static void delete_task(const void* t)
+{
+	free((void*)t);
+}
+
+// Lets workers sleep without a lock on the submit path. A worker announces
+// itself with prepare_wait, looks for work one last time, and only then
+// commits to sleeping; a submitter publishes its task before checking for
+// waiters, so one of the two always sees the other.
+typedef struct eventcount
+{
+	CACHE_ALIGN volatile LONG waiters;
+	volatile LONG epoch;
+	SRWLOCK lock;
+	CONDITION_VARIABLE wake;
+} eventcount_t;
+
+static void eventcount_init(eventcount_t* e)
+{
+	e->waiters = 0;
+	e->epoch = 0;
+	InitializeSRWLock(&e->lock);
+	InitializeConditionVariable(&e->wake);
+}
+
+static LONG eventcount_prepare_wait(eventcount_t* e)
+{
+	InterlockedIncrement(&e->waiters);
+	return e->epoch;
+}
+
+static void eventcount_cancel_wait(eventcount_t* e)
+{
+	InterlockedDecrement(&e->waiters);
+}
+
+static void eventcount_commit_wait(eventcount_t* e, LONG key)
+{
+	AcquireSRWLockExclusive(&e->lock);
+	while(e->epoch == key)
+	{
+		SleepConditionVariableSRW(&e->wake, &e->lock, INFINITE, 0);
+	}
+	ReleaseSRWLockExclusive(&e->lock);
+	InterlockedDecrement(&e->waiters);
+}
+
+static void eventcount_notify(eventcount_t* e, bool all)
+{
+	MemoryBarrier();
+	if(e->waiters == 0)
+	{
+		return;
+	}
+	AcquireSRWLockExclusive(&e->lock);
+	++e->epoch;
+	ReleaseSRWLockExclusive(&e->lock);
+	if(all)
+	{
+		WakeAllConditionVariable(&e->wake);
+	}
+	else
+	{
+		WakeConditionVariable(&e->wake);
+	}
+}
+
+typedef struct task_worker
+{
+	CACHE_ALIGN interlocked_deque_t* tasks;
+	task_scheduler_t* scheduler;
+	size_t index;
+	ULONG random;
+	HANDLE thread;
+} task_worker_t;
+
+typedef struct task_scheduler
+{
+	CACHE_ALIGN interlocked_queue_t* injected;
+	CACHE_ALIGN volatile LONG stopping;
+	eventcount_t idle;
+
+	size_t worker_count;
+	task_worker_t* workers;
+	bool pin_workers;
+} task_scheduler_t;
+
+static __declspec(thread) task_worker_t* current_worker = nullptr;
+
+static task_worker_t* worker_for(const task_scheduler_t* s)
+{
+	task_worker_t* w = current_worker;
+	return (w != nullptr && w->scheduler == s) ? w : nullptr;
+}
+
+static ULONG next_random(ULONG* state)
+{
+	ULONG x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// own deque first, since that's the most recently pushed and cache-warm work,
+// then anything submitted from outside, then other workers' oldest tasks
+static task_t* find_task(task_scheduler_t* s, task_worker_t* w)
+{
+	void* t = nullptr;
+	size_t first = 0;
+	size_t i = 0;
+
+	if(w && interlocked_deque_pop(w->tasks, &t))
+	{
+		return t;
+	}
+	if(interlocked_queue_pop(s->injected, &t))
+	{
+		return t;
+	}
+	first = w ? next_random(&w->random) % s->worker_count : 0;
+	for(i = 0; i < s->worker_count; ++i)
+	{
+		task_worker_t* victim = &s->workers[(first + i) % s->worker_count];
+		if(victim == w)
+		{
+			continue;
+		}
+		if(interlocked_deque_steal(victim->tasks, &t))
+		{
+			return t;
+		}
+	}
+	return nullptr;
+}
+
+static void run_task(task_t* t)
+{
+	task_group_t* group = t->group;
+	t->proc(t->context);
+	free(t);
+	// last, as the group's owner can return as soon as this hits zero
+	if(group)
+	{
+		InterlockedDecrement(&group->pending);
+	}
+}
+
+static DWORD WINAPI worker_proc(void* data)
+{
+	task_worker_t* w = data;
+	task_scheduler_t* s = w->scheduler;
+	task_t* t = nullptr;
+	LONG key = 0;
+	int spins = 0;
+
+	if(s->pin_workers)
+	{
+		SYSTEM_INFO si = { 0 };
+		size_t processors = 0;
+		GetSystemInfo(&si);
+		processors = si.dwNumberOfProcessors < sizeof(DWORD_PTR) * 8 ? si.dwNumberOfProcessors : sizeof(DWORD_PTR) * 8;
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (w->index % processors));
+	}
+	// get the thread's SMR bookkeeping out of the way before the first task
+	smr_thread_attach(WORKER_HAZARDS);
+	current_worker = w;
+
+	for(;;)
+	{
+		t = find_task(s, w);
+		if(t)
+		{
+			run_task(t);
+			spins = 0;
+			continue;
+		}
+		if(spins++ < IDLE_SPINS)
+		{
+			YieldProcessor();
+			continue;
+		}
+		key = eventcount_prepare_wait(&s->idle);
+		t = find_task(s, w);
+		if(t)
+		{
+			eventcount_cancel_wait(&s->idle);
+			run_task(t);
+			spins = 0;
+			continue;
+		}
+		if(s->stopping)
+		{
+			eventcount_cancel_wait(&s->idle);
+			break;
+		}
+		eventcount_commit_wait(&s->idle, key);
+		spins = 0;
+	}
+
+	current_worker = nullptr;
+	return 0;
+}
+
+task_scheduler_t* new_task_scheduler(size_t worker_count, bool pin_workers)
+{
+	task_scheduler_t* s = smr_alloc(sizeof(task_scheduler_t));
+	size_t i = 0;
+
+	if(worker_count == 0)
+	{
+		SYSTEM_INFO si = { 0 };
+		GetSystemInfo(&si);
+		worker_count = si.dwNumberOfProcessors;
+	}
+
+	memset(s, 0, sizeof(task_scheduler_t));
+	s->injected = new_interlocked_queue(&delete_task);
+	eventcount_init(&s->idle);
+	s->worker_count = worker_count;
+	s->pin_workers = pin_workers;
+	s->workers = smr_alloc(sizeof(task_worker_t) * worker_count);
+	memset(s->workers, 0, sizeof(task_worker_t) * worker_count);
+	for(i = 0; i < worker_count; ++i)
+	{
+		s->workers[i].tasks = new_interlocked_deque(&delete_task);
+		s->workers[i].scheduler = s;
+		s->workers[i].index = i;
+		s->workers[i].random = (ULONG)(i + 1) * 2654435761UL;
+	}
+	// all the deques have to exist before anyone starts stealing
+	for(i = 0; i < worker_count; ++i)
+	{
+		s->workers[i].thread = CreateThread(nullptr, 0, &worker_proc, &s->workers[i], 0, nullptr);
+	}
+	return s;
+}
+
+void delete_task_scheduler(task_scheduler_t* s)
+{
+	size_t i = 0;
+
+	s->stopping = 1;
+	eventcount_notify(&s->idle, true);
+	for(i = 0; i < s->worker_count; ++i)
+	{
+		WaitForSingleObject(s->workers[i].thread, INFINITE);
+		CloseHandle(s->workers[i].thread);
+	}
+	for(i = 0; i < s->worker_count; ++i)
+	{
+		delete_interlocked_deque(s->workers[i].tasks);
+	}
+	smr_free(s->workers);
+	s->workers = nullptr;
+	delete_interlocked_queue(s->injected);
+	s->injected = nullptr;
+	smr_free(s);
+}
+
+size_t task_scheduler_worker_count(const task_scheduler_t* s)
+{
+	return s->worker_count;
+}
+
+void task_scheduler_submit(task_scheduler_t* s, task_group_t* group, task_proc_t proc, void* context)
+{
+	task_worker_t* w = worker_for(s);
+	task_t* t = malloc(sizeof(task_t));
+	t->proc = proc;
+	t->context = context;
+	t->group = group;
+	if(group)
+	{
+		InterlockedIncrement(&group->pending);
+	}
+
+	if(w)
+	{
+		interlocked_deque_push(w->tasks, t);
+	}
+	else
+	{
+		interlocked_queue_push(s->injected, t);
+	}
+	eventcount_notify(&s->idle, false);
+}
+
+void task_scheduler_wait(task_scheduler_t* s, task_group_t* group)
+{
+	task_worker_t* w = worker_for(s);
+	int spins = 0;
+
+	while(group->pending != 0)
+	{
+		task_t* t = find_task(s, w);
+		if(t)
+		{
+			run_task(t);
+			spins = 0;
+		}
+		else if(spins++ < IDLE_SPINS)
+		{
+			YieldProcessor();
+		}
+		else
+		{
+			SwitchToThread();
+		}
+	}
+}
+
+typedef struct parallel_for_range
+{
+	task_scheduler_t* scheduler;
+	task_group_t* group;
+	size_t begin;
+	size_t end;
+	size_t grain;
+	range_proc_t body;
+	void* context;
+} parallel_for_range_t;
+
+static void parallel_for_proc(void* context);
+
+// keeps the lower half and hands out the upper halves, so the ranges that
+// thieves take are big ones
+static void split_range(parallel_for_range_t* r)
+{
+	while(r->end - r->begin > r->grain)
+	{
+		size_t middle = r->begin + ((r->end - r->begin) / 2);
+		parallel_for_range_t* upper = malloc(sizeof(parallel_for_range_t));
+		*upper = *r;
+		upper->begin = middle;
+		task_scheduler_submit(r->scheduler, r->group, &parallel_for_proc, upper);
+		r->end = middle;
+	}
+	r->body(r->begin, r->end, r->context);
+}
+
+static void parallel_for_proc(void* context)
+{
+	parallel_for_range_t r = *(parallel_for_range_t*)context;
+	free(context);
+	split_range(&r);
+}
+
+void task_scheduler_parallel_for(task_scheduler_t* s, size_t begin, size_t end, size_t grain, range_proc_t body, void* context)
+{
+	task_group_t group = { 0 };
+	parallel_for_range_t r = { s, &group, begin, end, grain != 0 ? grain : 1, body, context };
+
+	if(begin >= end)
+	{
+		return;
+	}
+	split_range(&r);
+	task_scheduler_wait(s, &group);
+}
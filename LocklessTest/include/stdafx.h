@@ -10,6 +10,11 @@
 #define STRICT
 #include <Windows.h>
 
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <queue>
+#include <shared_mutex>
 #include <vector>
 #include <iostream>
 #include <string>
@@ -45,40 +45,2351 @@ while(0)
 #endif // _DEBUG
 
 #include "concurrent_auto_table.hpp"
+#include "concurrent_rw_lock.hpp"
+#include "sloppy_counter.hpp"
+#include "counter_group.hpp"
 #include "non_blocking_unordered_map.hpp"
+#include "interlocked_queue.h"
+#include "interlocked_segment_queue.h"
+#include "interlocked_wait_free_queue.h"
+#include "interlocked_value_queue.hpp"
+#include "interlocked_priority_queue.h"
+#include "interlocked_skip_list.h"
+#include "interlocked_kv_list.h"
+#include "interlocked_hash_set.h"
+#include "interlocked_stack.h"
+#include "interlocked_deque.h"
+#include "object_pool.h"
+#include "interlocked_containers.hpp"
+#include "interlocked_harris_list.hpp"
+#include "task_scheduler.hpp"
 
-typedef concurrent_auto_table<unsigned __int64> counter_t;
+// the same counter striped three ways per thread and once per processor, one
+// that only folds in now and then, and a single interlocked word for scale
+template<typename Layout, typename Probe = cat_probe>
+struct concurrent_auto_table_traits {
+	typedef concurrent_auto_table<unsigned __int64, Layout, Probe> counter_type;
+	static counter_type* create() { return new (smr::smr) counter_type(); }
+	static void destroy(counter_type* c) { smr::smr_destroy(c); }
+	static void increment(counter_type* c) { c->increment(); }
+	static unsigned __int64 get(counter_type* c) { return c->get(); }
+};
+
+struct packed_counter_traits : concurrent_auto_table_traits<cat_packed_layout> {
+	static const char* name() { return "concurrent_auto_table (packed)"; }
+};
+
+struct padded_counter_traits : concurrent_auto_table_traits<cat_padded_layout> {
+	static const char* name() { return "concurrent_auto_table (padded)"; }
+};
+
+struct pair_padded_counter_traits : concurrent_auto_table_traits<cat_pair_padded_layout> {
+	static const char* name() { return "concurrent_auto_table (pair padded)"; }
+};
+
+struct cpu_counter_traits : concurrent_auto_table_traits<cat_padded_layout, cat_cpu_probe> {
+	static const char* name() { return "concurrent_auto_table (padded, per processor)"; }
+};
+
+struct sloppy_counter_traits {
+	typedef sloppy_counter<unsigned __int64> counter_type;
+	static const char* name() { return "sloppy_counter"; }
+	static counter_type* create() { return new counter_type(); }
+	static void destroy(counter_type* c) { delete c; }
+	static void increment(counter_type* c) { c->increment(); }
+	static unsigned __int64 get(counter_type* c) { return c->get(); }
+};
+
+struct interlocked_counter_traits {
+	typedef volatile LONGLONG counter_type;
+	static const char* name() { return "InterlockedIncrement64"; }
+	static counter_type* create() { return new (smr::smr) counter_type(0); }
+	static void destroy(counter_type* c) { smr::smr_destroy(const_cast<LONGLONG*>(c)); }
+	static void increment(counter_type* c) { ::InterlockedIncrement64(c); }
+	static unsigned __int64 get(counter_type* c) { return static_cast<unsigned __int64>(*c); }
+};
+
+static const __declspec(align(64)) unsigned __int64 target = 512 * 1024;
+
+template<typename Traits>
+struct counter_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	typename Traits::counter_type* counter;
+};
+
+template<typename Traits>
+DWORD WINAPI counter_thread_proc(void* data) {
+	counter_thread_info<Traits>* ti = static_cast<counter_thread_info<Traits>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	for(size_t i(0); i < target; ++i) {
+		Traits::increment(ti->counter);
+	}
+	return 0;
+}
+
+template<typename Traits>
+void report_counter(size_t thread_count, size_t processor_count) {
+	LARGE_INTEGER frequency = { 0 };
+	LARGE_INTEGER start = { 0 }, end = { 0 };
+	::QueryPerformanceFrequency(&frequency);
+
+	typename Traits::counter_type* counter = Traits::create();
+	HANDLE begin = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+	std::vector<HANDLE> threads(thread_count);
+	std::vector<counter_thread_info<Traits> > infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].processor_id = i % processor_count;
+		infos[i].begin = begin;
+		infos[i].counter = counter;
+
+		threads[i] = ::CreateThread(nullptr, 0, &counter_thread_proc<Traits>, &infos[i], 0, nullptr);
+	}
+	::QueryPerformanceCounter(&start);
+	::SetEvent(begin);
+	for(size_t i(0); i < thread_count; ++i) {
+		::WaitForSingleObject(threads[i], INFINITE);
+	}
+	::QueryPerformanceCounter(&end);
+	for(size_t i(0); i < thread_count; ++i) {
+		::CloseHandle(threads[i]);
+	}
+	::CloseHandle(begin);
+
+	const double seconds = static_cast<double>(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+	const double operations = static_cast<double>(thread_count) * static_cast<double>(target);
+	const unsigned __int64 expected = static_cast<unsigned __int64>(thread_count) * target;
+	const unsigned __int64 actual = Traits::get(counter);
+	std::cout << "\t" << Traits::name() << " expected count: " << expected << " actual count: " << actual << " time: " << seconds << " Mops/s: " << (operations / seconds) / 1000000.0 << (actual != expected ? " WRONG" : "") << std::endl;
+	Traits::destroy(counter);
+}
+
+// Packed stripes share cache lines, so two threads on neighbouring stripes
+// still ping-pong the line between them; padding trades memory for that.
+void benchmark_counters() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(128), processor_count * 4);
+
+	::SetPriorityClass(::GetCurrentProcess(), BELOW_NORMAL_PRIORITY_CLASS);
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_counter<packed_counter_traits     >(thread_count, processor_count);
+		report_counter<padded_counter_traits     >(thread_count, processor_count);
+		report_counter<pair_padded_counter_traits>(thread_count, processor_count);
+		report_counter<cpu_counter_traits        >(thread_count, processor_count);
+		report_counter<sloppy_counter_traits     >(thread_count, processor_count);
+		report_counter<interlocked_counter_traits>(thread_count, processor_count);
+	}
+}
+
+// one contended run, so a layout that drops increments shows up as WRONG
+void check_counters() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t thread_count = processor_count * 2;
+
+	std::cout << "threads: " << thread_count << std::endl;
+	report_counter<packed_counter_traits     >(thread_count, processor_count);
+	report_counter<padded_counter_traits     >(thread_count, processor_count);
+	report_counter<pair_padded_counter_traits>(thread_count, processor_count);
+	report_counter<cpu_counter_traits        >(thread_count, processor_count);
+}
+
+// a handful of related metrics bumped together on every operation, each in its
+// own concurrent_auto_table or all in one counter_group row
+static const size_t related_counters = 4;
+
+struct separate_counters_traits {
+	typedef concurrent_auto_table<unsigned __int64, cat_padded_layout> table_type;
+	struct counter_type {
+		table_type* tables[related_counters];
+	};
+	static const char* name() { return "separate concurrent_auto_tables"; }
+	static counter_type* create() {
+		counter_type* c = new counter_type;
+		for(size_t i(0); i < related_counters; ++i) {
+			c->tables[i] = new (smr::smr) table_type();
+		}
+		return c;
+	}
+	static void destroy(counter_type* c) {
+		for(size_t i(0); i < related_counters; ++i) {
+			smr::smr_destroy(c->tables[i]);
+		}
+		delete c;
+	}
+	static void increment(counter_type* c) {
+		for(size_t i(0); i < related_counters; ++i) {
+			c->tables[i]->increment();
+		}
+	}
+	// the smallest, so a lost add in any of them shows
+	static unsigned __int64 get(counter_type* c) {
+		unsigned __int64 least = c->tables[0]->get();
+		for(size_t i(1); i < related_counters; ++i) {
+			least = std::min(least, c->tables[i]->get());
+		}
+		return least;
+	}
+};
+
+template<typename Probe>
+struct counter_group_traits {
+	typedef counter_group<unsigned __int64, Probe> counter_type;
+	static counter_type* create() { return new counter_type(related_counters); }
+	static void destroy(counter_type* c) { delete c; }
+	static void increment(counter_type* c) {
+		for(size_t i(0); i < related_counters; ++i) {
+			c->increment(i);
+		}
+	}
+	static unsigned __int64 get(counter_type* c) {
+		unsigned __int64 values[related_counters];
+		c->snapshot(values);
+		return *std::min_element(values, values + related_counters);
+	}
+};
+
+struct thread_counter_group_traits : counter_group_traits<cat_probe> {
+	static const char* name() { return "counter_group"; }
+};
+
+struct cpu_counter_group_traits : counter_group_traits<cat_cpu_probe> {
+	static const char* name() { return "counter_group (per processor)"; }
+};
+
+// With separate tables every operation writes one line per metric; with a
+// group the metrics sit together in the thread's row.
+void benchmark_counter_groups() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(128), processor_count * 4);
+
+	::SetPriorityClass(::GetCurrentProcess(), BELOW_NORMAL_PRIORITY_CLASS);
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_counter<separate_counters_traits   >(thread_count, processor_count);
+		report_counter<thread_counter_group_traits>(thread_count, processor_count);
+		report_counter<cpu_counter_group_traits   >(thread_count, processor_count);
+	}
+}
+
+// The read side of a concurrent_rw_lock hands back a stripe that the unlock
+// needs; std::shared_mutex has nothing to hand back.
+struct concurrent_rw_lock_traits {
+	typedef concurrent_rw_lock lock_type;
+	typedef size_t token_type;
+	static const char* name() { return "concurrent_rw_lock"; }
+	static token_type lock_shared(lock_type* l) { return l->lock_shared(); }
+	static void unlock_shared(lock_type* l, token_type t) { l->unlock_shared(t); }
+};
+
+struct shared_mutex_traits {
+	typedef std::shared_mutex lock_type;
+	typedef int token_type;
+	static const char* name() { return "std::shared_mutex"; }
+	static token_type lock_shared(lock_type* l) { l->lock_shared(); return 0; }
+	static void unlock_shared(lock_type* l, token_type) { l->unlock_shared(); }
+};
+
+static const size_t rw_lock_operations = 256 * 1024;
+// one operation in this many takes the lock exclusively
+static const size_t rw_lock_write_interval = 1000;
+
+static const size_t rw_lock_data_size = 8;
+
+// what the lock protects; readers sum it, writers bump every element, so a
+// reader that sees the elements disagree got in while a writer held the lock
+struct rw_lock_data {
+	size_t values[rw_lock_data_size];
+};
+
+template<typename Traits>
+struct rw_lock_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	typename Traits::lock_type* lock;
+	rw_lock_data* data;
+	size_t checksum;
+	size_t writes;
+	size_t torn_reads;
+};
+
+template<typename Traits>
+DWORD WINAPI rw_lock_thread_proc(void* data) {
+	rw_lock_thread_info<Traits>* ti = static_cast<rw_lock_thread_info<Traits>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	size_t checksum = 0, writes = 0, torn_reads = 0;
+	for(size_t i(0); i < rw_lock_operations; ++i) {
+		if((i + ti->processor_id) % rw_lock_write_interval == 0) {
+			ti->lock->lock();
+			for(size_t j(0); j < rw_lock_data_size; ++j) {
+				++ti->data->values[j];
+			}
+			ti->lock->unlock();
+			++writes;
+		} else {
+			typename Traits::token_type t = Traits::lock_shared(ti->lock);
+			const size_t first = ti->data->values[0];
+			for(size_t j(0); j < rw_lock_data_size; ++j) {
+				checksum += ti->data->values[j];
+				if(ti->data->values[j] != first) {
+					++torn_reads;
+					break;
+				}
+			}
+			Traits::unlock_shared(ti->lock, t);
+		}
+	}
+	ti->checksum = checksum; // so the reads aren't optimized away
+	ti->writes = writes;
+	ti->torn_reads = torn_reads;
+	return 0;
+}
+
+template<typename Traits>
+void report_rw_lock(size_t thread_count, size_t processor_count) {
+	LARGE_INTEGER frequency = { 0 };
+	LARGE_INTEGER start = { 0 }, end = { 0 };
+	::QueryPerformanceFrequency(&frequency);
+
+	typename Traits::lock_type* lock = new typename Traits::lock_type();
+	rw_lock_data data = { { 0 } };
+	HANDLE begin = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+	std::vector<HANDLE> threads(thread_count);
+	std::vector<rw_lock_thread_info<Traits> > infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].processor_id = i % processor_count;
+		infos[i].begin = begin;
+		infos[i].lock = lock;
+		infos[i].data = &data;
+		infos[i].checksum = 0;
+		infos[i].writes = 0;
+		infos[i].torn_reads = 0;
+
+		threads[i] = ::CreateThread(nullptr, 0, &rw_lock_thread_proc<Traits>, &infos[i], 0, nullptr);
+	}
+	::QueryPerformanceCounter(&start);
+	::SetEvent(begin);
+	for(size_t i(0); i < thread_count; ++i) {
+		::WaitForSingleObject(threads[i], INFINITE);
+	}
+	::QueryPerformanceCounter(&end);
+	for(size_t i(0); i < thread_count; ++i) {
+		::CloseHandle(threads[i]);
+	}
+	::CloseHandle(begin);
+	delete lock;
+
+	const double seconds = static_cast<double>(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+	const double operations = static_cast<double>(thread_count) * static_cast<double>(rw_lock_operations);
+	size_t writes = 0, torn_reads = 0;
+	for(size_t i(0); i < thread_count; ++i) {
+		writes += infos[i].writes;
+		torn_reads += infos[i].torn_reads;
+	}
+	// every write landed on every element, and no reader saw one half done
+	const bool wrong = torn_reads != 0 || static_cast<size_t>(std::count(data.values, data.values + rw_lock_data_size, writes)) != rw_lock_data_size;
+	std::cout << "\t" << Traits::name() << " time: " << seconds << " Mops/s: " << (operations / seconds) / 1000000.0 << " torn reads: " << torn_reads << (wrong ? " WRONG" : "") << std::endl;
+}
+
+void check_rw_locks() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t thread_count = processor_count * 2;
+
+	std::cout << "threads: " << thread_count << std::endl;
+	report_rw_lock<concurrent_rw_lock_traits>(thread_count, processor_count);
+}
+
+// read-mostly, with many more readers than processors at the top end
+void benchmark_rw_locks() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(128), processor_count * 4);
+
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_rw_lock<concurrent_rw_lock_traits>(thread_count, processor_count);
+		report_rw_lock<shared_mutex_traits      >(thread_count, processor_count);
+	}
+}
+
+static void null_destructor(const void*) {
+}
+
+// the wait-free queue needs a handle per thread; the others get by without one
+struct interlocked_queue_traits {
+	typedef interlocked_queue_t queue_type;
+	typedef void handle_type;
+	static const char* name() { return "interlocked_queue"; }
+	static queue_type* create(size_t) { return ::new_interlocked_queue(&null_destructor); }
+	static void destroy(queue_type* q) { ::delete_interlocked_queue(q); }
+	static handle_type* attach(queue_type*) { return nullptr; }
+	static void detach(queue_type*, handle_type*) { }
+	static void push(queue_type* q, handle_type*, void* v) { ::interlocked_queue_push(q, v); }
+	static bool pop(queue_type* q, handle_type*, void** v) { return ::interlocked_queue_pop(q, v); }
+	static contention_t* contention(queue_type* q) { return ::interlocked_queue_contention(q); }
+	static long depth(queue_type* q) { return ::interlocked_queue_depth(q); }
+	static long exact_depth(queue_type* q) { return ::interlocked_queue_exact_depth(q); }
+};
+
+struct interlocked_segment_queue_traits {
+	typedef interlocked_segment_queue_t queue_type;
+	typedef void handle_type;
+	static const char* name() { return "interlocked_segment_queue"; }
+	static queue_type* create(size_t) { return ::new_interlocked_segment_queue(&null_destructor); }
+	static void destroy(queue_type* q) { ::delete_interlocked_segment_queue(q); }
+	static handle_type* attach(queue_type*) { return nullptr; }
+	static void detach(queue_type*, handle_type*) { }
+	static void push(queue_type* q, handle_type*, void* v) { ::interlocked_segment_queue_push(q, v); }
+	static bool pop(queue_type* q, handle_type*, void** v) { return ::interlocked_segment_queue_pop(q, v); }
+};
+
+struct interlocked_wait_free_queue_traits {
+	typedef interlocked_wait_free_queue_t queue_type;
+	typedef interlocked_wait_free_queue_handle_t handle_type;
+	static const char* name() { return "interlocked_wait_free_queue"; }
+	static queue_type* create(size_t thread_count) { return ::new_interlocked_wait_free_queue(&null_destructor, static_cast<long>(thread_count)); }
+	static void destroy(queue_type* q) { ::delete_interlocked_wait_free_queue(q); }
+	static handle_type* attach(queue_type* q) { return ::interlocked_wait_free_queue_register(q); }
+	static void detach(queue_type* q, handle_type* h) { ::interlocked_wait_free_queue_unregister(q, h); }
+	static void push(queue_type* q, handle_type* h, void* v) { ::interlocked_wait_free_queue_push(q, h, v); }
+	static bool pop(queue_type* q, handle_type* h, void** v) { return ::interlocked_wait_free_queue_pop(q, h, v); }
+};
+
+struct interlocked_value_queue_traits {
+	typedef utility::interlocked_value_queue<void*> queue_type;
+	typedef void handle_type;
+	static const char* name() { return "interlocked_value_queue"; }
+	static queue_type* create(size_t) { return new queue_type(); }
+	static void destroy(queue_type* q) { delete q; }
+	static handle_type* attach(queue_type*) { return nullptr; }
+	static void detach(queue_type*, handle_type*) { }
+	static void push(queue_type* q, handle_type*, void* v) { q->push(v); }
+	static bool pop(queue_type* q, handle_type*, void** v) { return q->try_pop(*v); }
+};
+
+// stacks get run through the same push-then-pop workload as the queues
+struct interlocked_stack_traits {
+	typedef interlocked_stack_t queue_type;
+	typedef void handle_type;
+	static const char* name() { return "interlocked_stack"; }
+	static queue_type* create(size_t) { return ::new_interlocked_stack(&null_destructor); }
+	static void destroy(queue_type* q) { ::delete_interlocked_stack(q); }
+	static handle_type* attach(queue_type*) { return nullptr; }
+	static void detach(queue_type*, handle_type*) { }
+	static void push(queue_type* q, handle_type*, void* v) { ::interlocked_stack_push(q, v); }
+	static bool pop(queue_type* q, handle_type*, void** v) { return ::interlocked_stack_pop(q, v); }
+	static contention_t* contention(queue_type* q) { return ::interlocked_stack_contention(q); }
+	static long depth(queue_type* q) { return ::interlocked_stack_depth(q); }
+	static long exact_depth(queue_type* q) { return ::interlocked_stack_exact_depth(q); }
+};
+
+struct interlocked_elimination_stack_traits : interlocked_stack_traits {
+	static const char* name() { return "interlocked_elimination_stack"; }
+	static queue_type* create(size_t) { return ::new_interlocked_elimination_stack(&null_destructor); }
+};
+
+static const size_t queue_operations = 256 * 1024;
+
+// what a benchmark thread gets handed; latencies is only there for the
+// benchmarks that time every operation
+template<typename Container>
+struct container_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	Container* container;
+	std::vector<LONGLONG>* latencies;
+};
+
+// Starts a thread on proc for each of infos, having filled in their
+// processor_id and begin, lets them all go at once, and returns how long the
+// last of them took to finish.
+template<typename Info>
+double run_threads(std::vector<Info>& infos, size_t processor_count, LPTHREAD_START_ROUTINE proc) {
+	LARGE_INTEGER frequency = { 0 };
+	LARGE_INTEGER start = { 0 }, end = { 0 };
+	::QueryPerformanceFrequency(&frequency);
+
+	HANDLE begin = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	std::vector<HANDLE> threads(infos.size());
+	for(size_t i(0); i < infos.size(); ++i) {
+		infos[i].processor_id = i % processor_count;
+		infos[i].begin = begin;
+
+		threads[i] = ::CreateThread(nullptr, 0, proc, &infos[i], 0, nullptr);
+	}
+	::QueryPerformanceCounter(&start);
+	::SetEvent(begin);
+	// WaitForMultipleObjects can only wait on MAXIMUM_WAIT_OBJECTS handles at a time
+	for(size_t i(0); i < threads.size(); ++i) {
+		::WaitForSingleObject(threads[i], INFINITE);
+	}
+	::QueryPerformanceCounter(&end);
+	for(size_t i(0); i < threads.size(); ++i) {
+		::CloseHandle(threads[i]);
+	}
+	::CloseHandle(begin);
+	return static_cast<double>(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+}
+
+// every thread is both a producer and a consumer, so the queue stays short
+// and all the contention lands on the ends
+template<typename Traits>
+DWORD WINAPI queue_thread_proc(void* data) {
+	container_thread_info<typename Traits::queue_type>* ti = static_cast<container_thread_info<typename Traits::queue_type>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	typename Traits::handle_type* h = Traits::attach(ti->container);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	void* v = nullptr;
+	for(size_t i(0); i < queue_operations; ++i) {
+		Traits::push(ti->container, h, reinterpret_cast<void*>(i + 1));
+		Traits::pop(ti->container, h, &v);
+	}
+	Traits::detach(ti->container, h);
+	return 0;
+}
+
+// the same workload, but every push and pop is timed individually
+template<typename Traits>
+DWORD WINAPI queue_latency_thread_proc(void* data) {
+	container_thread_info<typename Traits::queue_type>* ti = static_cast<container_thread_info<typename Traits::queue_type>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	typename Traits::handle_type* h = Traits::attach(ti->container);
+	std::vector<LONGLONG>& latencies = *ti->latencies;
+	latencies.reserve(2 * queue_operations);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	void* v = nullptr;
+	LARGE_INTEGER before = { 0 }, after = { 0 };
+	for(size_t i(0); i < queue_operations; ++i) {
+		::QueryPerformanceCounter(&before);
+		Traits::push(ti->container, h, reinterpret_cast<void*>(i + 1));
+		::QueryPerformanceCounter(&after);
+		latencies.push_back(after.QuadPart - before.QuadPart);
+		Traits::pop(ti->container, h, &v);
+		::QueryPerformanceCounter(&before);
+		latencies.push_back(before.QuadPart - after.QuadPart);
+	}
+	Traits::detach(ti->container, h);
+	return 0;
+}
+
+// times thread_count threads running proc against one container
+template<typename Container>
+double benchmark_container(Container* c, size_t thread_count, size_t processor_count, LPTHREAD_START_ROUTINE proc, std::vector<std::vector<LONGLONG> >* latencies) {
+	std::vector<container_thread_info<Container> > infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].container = c;
+		infos[i].latencies = latencies ? &(*latencies)[i] : nullptr;
+	}
+	return run_threads(infos, processor_count, proc);
+}
+
+template<typename Traits>
+double benchmark_queue(size_t thread_count, size_t processor_count, LPTHREAD_START_ROUTINE proc, std::vector<std::vector<LONGLONG> >* latencies) {
+	typename Traits::queue_type* q = Traits::create(thread_count);
+	double seconds = benchmark_container(q, thread_count, processor_count, proc, latencies);
+	Traits::destroy(q);
+	return seconds;
+}
+
+template<typename Traits>
+void report_queue(size_t thread_count, size_t processor_count) {
+	double seconds = benchmark_queue<Traits>(thread_count, processor_count, &queue_thread_proc<Traits>, nullptr);
+	double operations = 2.0 * static_cast<double>(thread_count) * static_cast<double>(queue_operations);
+	std::cout << "\t" << Traits::name() << " time: " << seconds << " Mops/s: " << (operations / seconds) / 1000000.0 << std::endl;
+}
+
+void benchmark_queues() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(128), processor_count * 2);
+
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_queue<interlocked_queue_traits          >(thread_count, processor_count);
+		report_queue<interlocked_segment_queue_traits  >(thread_count, processor_count);
+		report_queue<interlocked_wait_free_queue_traits>(thread_count, processor_count);
+		report_queue<interlocked_value_queue_traits    >(thread_count, processor_count);
+	}
+}
+
+static const size_t queue_check_operations = 16 * 1024;
+
+template<typename Traits>
+struct queue_check_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	typename Traits::queue_type* queue;
+	size_t producer;
+	std::vector<size_t> popped;
+};
+
+// Each value says which thread pushed it and in what order; none of them is zero.
+static size_t queue_check_value(size_t producer, size_t sequence) {
+	return (producer * queue_check_operations) + sequence + 1;
+}
+
+// the benchmark's workload, but keeping hold of everything popped
+template<typename Traits>
+DWORD WINAPI queue_check_thread_proc(void* data) {
+	queue_check_thread_info<Traits>* ti = static_cast<queue_check_thread_info<Traits>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	typename Traits::handle_type* h = Traits::attach(ti->queue);
+	ti->popped.reserve(queue_check_operations);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	void* v = nullptr;
+	for(size_t i(0); i < queue_check_operations; ++i) {
+		Traits::push(ti->queue, h, reinterpret_cast<void*>(queue_check_value(ti->producer, i)));
+		if(Traits::pop(ti->queue, h, &v)) {
+			ti->popped.push_back(reinterpret_cast<size_t>(v));
+		}
+	}
+	Traits::detach(ti->queue, h);
+	return 0;
+}
+
+// Everything pushed has to come out exactly once, whether a thread popped it
+// or it was left for the drain at the end. A FIFO container also mustn't let
+// any one thread see another thread's values out of the order they went in.
+template<typename Traits>
+void check_queue(size_t thread_count, size_t processor_count, bool fifo) {
+	// one more handle, for draining what's left
+	typename Traits::queue_type* q = Traits::create(thread_count + 1);
+	std::vector<queue_check_thread_info<Traits> > infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].queue = q;
+		infos[i].producer = i;
+	}
+	run_threads(infos, processor_count, &queue_check_thread_proc<Traits>);
+
+	// the drain counts as one more consumer
+	std::vector<std::vector<size_t> > popped(thread_count + 1);
+	for(size_t i(0); i < thread_count; ++i) {
+		popped[i].swap(infos[i].popped);
+	}
+	typename Traits::handle_type* h = Traits::attach(q);
+	void* v = nullptr;
+	while(Traits::pop(q, h, &v)) {
+		popped.back().push_back(reinterpret_cast<size_t>(v));
+	}
+	Traits::detach(q, h);
+	Traits::destroy(q);
+
+	std::vector<size_t> seen(thread_count * queue_check_operations, 0);
+	size_t strays = 0, out_of_order = 0;
+	for(size_t i(0); i < popped.size(); ++i) {
+		std::vector<size_t> last(thread_count, 0);
+		for(size_t j(0); j < popped[i].size(); ++j) {
+			const size_t value = popped[i][j];
+			if(value == 0 || value > seen.size()) {
+				++strays;
+				continue;
+			}
+			++seen[value - 1];
+			const size_t producer = (value - 1) / queue_check_operations;
+			if(fifo && value < last[producer]) {
+				++out_of_order;
+			}
+			last[producer] = value;
+		}
+	}
+	const size_t lost = static_cast<size_t>(std::count(seen.begin(), seen.end(), 0));
+	const size_t duplicated = seen.size() - lost - static_cast<size_t>(std::count(seen.begin(), seen.end(), 1));
+	std::cout << "\t" << Traits::name() << " lost: " << lost << " duplicated: " << duplicated << " strays: " << strays;
+	if(fifo) {
+		std::cout << " out of order: " << out_of_order;
+	}
+	std::cout << (lost == 0 && duplicated == 0 && strays == 0 && out_of_order == 0 ? "" : " WRONG") << std::endl;
+}
+
+void check_queues() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	const size_t thread_counts[] = { 1, processor_count * 2 };
+	for(size_t i(0); i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+		std::cout << "threads: " << thread_counts[i] << std::endl;
+		check_queue<interlocked_queue_traits          >(thread_counts[i], processor_count, true);
+		check_queue<interlocked_segment_queue_traits  >(thread_counts[i], processor_count, true);
+		check_queue<interlocked_wait_free_queue_traits>(thread_counts[i], processor_count, true);
+		check_queue<interlocked_value_queue_traits    >(thread_counts[i], processor_count, true);
+		// a stack promises nothing about order, only that nothing goes missing
+		check_queue<interlocked_stack_traits            >(thread_counts[i], processor_count, false);
+		check_queue<interlocked_elimination_stack_traits>(thread_counts[i], processor_count, false);
+	}
+}
+
+// Every thread pushes its share and pops half of it back. A pop can't find
+// the container empty, because nobody pops more than they've pushed.
+template<typename Traits>
+DWORD WINAPI depth_check_thread_proc(void* data) {
+	container_thread_info<typename Traits::queue_type>* ti = static_cast<container_thread_info<typename Traits::queue_type>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	typename Traits::handle_type* h = Traits::attach(ti->container);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	for(size_t i(0); i < queue_check_operations; ++i) {
+		Traits::push(ti->container, h, reinterpret_cast<void*>(i + 1));
+	}
+	void* v = nullptr;
+	for(size_t i(0); i < queue_check_operations / 2; ++i) {
+		Traits::pop(ti->container, h, &v);
+	}
+	Traits::detach(ti->container, h);
+	return 0;
+}
+
+// Once the threads are done the counter has every update in it, so after
+// waiting out its staleness the cheap depth has to agree with the walk.
+template<typename Traits>
+void check_depth(size_t thread_count, size_t processor_count) {
+	typename Traits::queue_type* q = Traits::create(thread_count);
+	benchmark_container(q, thread_count, processor_count, &depth_check_thread_proc<Traits>, nullptr);
+	::Sleep(10);
+
+	const long expected = static_cast<long>(thread_count * (queue_check_operations / 2));
+	const long depth = Traits::depth(q);
+	const long exact_depth = Traits::exact_depth(q);
+	Traits::destroy(q);
+	std::cout << "\t" << Traits::name() << " expected depth: " << expected << " depth: " << depth << " exact depth: " << exact_depth << (depth == expected && exact_depth == expected ? "" : " WRONG") << std::endl;
+}
+
+void check_depths() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t thread_count = processor_count * 2;
+
+	std::cout << "threads: " << thread_count << std::endl;
+	check_depth<interlocked_queue_traits>(thread_count, processor_count);
+	check_depth<interlocked_stack_traits>(thread_count, processor_count);
+}
+
+// merges every thread's timings and prints the distribution
+void report_latencies(const char* name, std::vector<std::vector<LONGLONG> >& latencies) {
+	LARGE_INTEGER frequency = { 0 };
+	::QueryPerformanceFrequency(&frequency);
+
+	std::vector<LONGLONG> all;
+	for(size_t i(0); i < latencies.size(); ++i) {
+		all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+		std::vector<LONGLONG>().swap(latencies[i]);
+	}
+	std::sort(all.begin(), all.end());
+
+	const double percentiles[] = { 50.0, 99.0, 99.9, 99.99 };
+	std::cout << "\t" << name << " latency (ns)";
+	for(size_t i(0); i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+		size_t index = static_cast<size_t>((percentiles[i] / 100.0) * static_cast<double>(all.size() - 1));
+		double nanoseconds = static_cast<double>(all[index]) * 1000000000.0 / static_cast<double>(frequency.QuadPart);
+		std::cout << " p" << percentiles[i] << ": " << nanoseconds;
+	}
+	std::cout << " max: " << static_cast<double>(all.back()) * 1000000000.0 / static_cast<double>(frequency.QuadPart) << std::endl;
+}
+
+template<typename Traits>
+void report_queue_latency(size_t thread_count, size_t processor_count) {
+	std::vector<std::vector<LONGLONG> > latencies(thread_count);
+	benchmark_queue<Traits>(thread_count, processor_count, &queue_latency_thread_proc<Traits>, &latencies);
+	report_latencies(Traits::name(), latencies);
+}
+
+// elimination only kicks in once pushes and pops are colliding on top
+void benchmark_stacks() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	for(size_t thread_count(8); thread_count <= 128; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_queue<interlocked_stack_traits            >(thread_count, processor_count);
+		report_queue<interlocked_elimination_stack_traits>(thread_count, processor_count);
+	}
+}
+
+// buffers the size of a cache line, recycled through a pool or through a
+// stack used as a free list
+static const size_t recycled_object_size = 64;
+static const size_t recycling_operations = 256 * 1024;
+// how many buffers a thread has out at once
+static const size_t recycling_batch = 8;
+
+static void free_recycled_object(const void* object) {
+	smr::detail::smr_free(const_cast<void*>(object));
+}
+
+struct object_pool_recycling_traits {
+	typedef object_pool_t pool_type;
+	static const char* name() { return "object_pool"; }
+	static pool_type* create() { return ::new_object_pool(recycled_object_size); }
+	static void destroy(pool_type* p) { ::delete_object_pool(p); }
+	static void* acquire(pool_type* p) { return ::object_pool_acquire(p); }
+	static void release(pool_type* p, void* object) { ::object_pool_release(p, object); }
+};
+
+struct interlocked_stack_recycling_traits {
+	typedef interlocked_stack_t pool_type;
+	static const char* name() { return "interlocked_stack free list"; }
+	static pool_type* create() { return ::new_interlocked_stack(&free_recycled_object); }
+	static void destroy(pool_type* p) { ::delete_interlocked_stack(p); }
+	static void* acquire(pool_type* p) {
+		void* object = nullptr;
+		return ::interlocked_stack_pop(p, &object) ? object : smr::detail::smr_alloc(recycled_object_size);
+	}
+	static void release(pool_type* p, void* object) { ::interlocked_stack_push(p, object); }
+};
+
+template<typename Traits>
+DWORD WINAPI recycling_thread_proc(void* data) {
+	container_thread_info<typename Traits::pool_type>* ti = static_cast<container_thread_info<typename Traits::pool_type>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	void* objects[recycling_batch];
+	::WaitForSingleObject(ti->begin, INFINITE);
+	for(size_t i(0); i < recycling_operations; i += recycling_batch) {
+		for(size_t j(0); j < recycling_batch; ++j) {
+			objects[j] = Traits::acquire(ti->container);
+		}
+		for(size_t j(0); j < recycling_batch; ++j) {
+			Traits::release(ti->container, objects[j]);
+		}
+	}
+	return 0;
+}
+
+template<typename Traits>
+void report_recycling(size_t thread_count, size_t processor_count) {
+	typename Traits::pool_type* p = Traits::create();
+	double seconds = benchmark_container(p, thread_count, processor_count, &recycling_thread_proc<Traits>, nullptr);
+	Traits::destroy(p);
+	double operations = 2.0 * static_cast<double>(thread_count) * static_cast<double>(recycling_operations);
+	std::cout << "\t" << Traits::name() << " time: " << seconds << " Mops/s: " << (operations / seconds) / 1000000.0 << std::endl;
+}
+
+// every acquire and release on the free list is a CAS on one shared top; the
+// pool only goes to its depot once a magazine's worth
+void benchmark_object_pools() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(64), processor_count * 2);
+
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_recycling<object_pool_recycling_traits      >(thread_count, processor_count);
+		report_recycling<interlocked_stack_recycling_traits>(thread_count, processor_count);
+	}
+}
+
+static const size_t pool_check_objects = 256;
+static const size_t pool_check_passes = 16;
+static const size_t pool_check_rounds = 4;
+static const size_t pool_check_magic = 0x0ddba110;
+
+// what the check writes into every buffer it has out
+struct pool_check_object {
+	size_t state;
+	size_t holder;
+};
+
+struct pool_check_shared {
+	object_pool_t* pool;
+	// buffers one thread acquired for another thread to release
+	interlocked_stack_t* handoff;
+	// stamps for buffers that are out and buffers that have gone back, unique
+	// to the check, so a stale one from an earlier pool can't be mistaken
+	size_t in_use;
+	size_t released;
+	// in the last round the pool is deleted while its threads are still running
+	bool orphan;
+	std::atomic<size_t> parked;
+	size_t orphan_count;
+	HANDLE gate;
+};
+
+struct pool_check_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	pool_check_shared* shared;
+	size_t id;
+	size_t mistakes;
+	size_t recycled;
+};
+
+static pool_check_object* acquire_checked(pool_check_thread_info* ti) {
+	pool_check_object* o = static_cast<pool_check_object*>(::object_pool_acquire(ti->shared->pool));
+	if(o->state == ti->shared->in_use) {
+		++ti->mistakes; // somebody else still has it
+	} else if(o->state == ti->shared->released) {
+		++ti->recycled;
+	}
+	o->state = ti->shared->in_use;
+	o->holder = ti->id;
+	return o;
+}
+
+static void release_checked(pool_check_thread_info* ti, pool_check_object* o) {
+	if(o->state != ti->shared->in_use) {
+		++ti->mistakes;
+	}
+	o->state = ti->shared->released;
+	::object_pool_release(ti->shared->pool, o);
+}
+
+// Each pass takes a batch out, makes sure nobody else was handed any of it,
+// and gives half back and half to whichever thread picks it up, so buffers
+// (and whole magazines) move between threads. Threads then exit, sending
+// their magazines to the depot and leaving their caches for the next round to
+// pick up, or in the last round wait while thread 0 deletes the pool out from
+// under them.
+DWORD WINAPI pool_check_thread_proc(void* data) {
+	pool_check_thread_info* ti = static_cast<pool_check_thread_info*>(data);
+	pool_check_shared* shared = ti->shared;
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	std::vector<pool_check_object*> held;
+	held.reserve(pool_check_objects);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	void* v = nullptr;
+	for(size_t i(0); i < pool_check_passes; ++i) {
+		for(size_t j(0); j < pool_check_objects; ++j) {
+			held.push_back(acquire_checked(ti));
+		}
+		for(size_t j(0); j < held.size(); ++j) {
+			if(held[j]->state != shared->in_use || held[j]->holder != ti->id) {
+				++ti->mistakes;
+			}
+		}
+		for(size_t j(0); j < held.size(); ++j) {
+			if(j % 2 == 0) {
+				release_checked(ti, held[j]);
+			} else {
+				::interlocked_stack_push(shared->handoff, held[j]);
+			}
+		}
+		held.clear();
+		while(::interlocked_stack_pop(shared->handoff, &v)) {
+			release_checked(ti, static_cast<pool_check_object*>(v));
+		}
+	}
+	if(!shared->orphan) {
+		return 0;
+	}
+	if(ti->id != 0) {
+		++shared->parked;
+		::WaitForSingleObject(shared->gate, INFINITE);
+		return 0;
+	}
+	while(shared->parked.load() != shared->orphan_count) {
+		::SwitchToThread();
+	}
+	// anything still out when the pool goes is ours to free
+	while(::interlocked_stack_pop(shared->handoff, &v)) {
+		smr::detail::smr_free(v);
+	}
+	::delete_object_pool(shared->pool);
+	shared->pool = nullptr;
+	::SetEvent(shared->gate);
+	return 0;
+}
+
+void check_object_pool(size_t thread_count, size_t processor_count) {
+	static size_t generation = 0;
+	++generation;
+
+	pool_check_shared shared;
+	shared.pool = ::new_object_pool(recycled_object_size);
+	shared.handoff = ::new_interlocked_stack(&null_destructor);
+	shared.in_use = pool_check_magic + (generation * 4) + 1;
+	shared.released = pool_check_magic + (generation * 4) + 2;
+	shared.orphan = false;
+	shared.parked = 0;
+	shared.orphan_count = thread_count - 1;
+	shared.gate = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+	size_t mistakes = 0, recycled = 0;
+	for(size_t round(0); round < pool_check_rounds; ++round) {
+		shared.orphan = round + 1 == pool_check_rounds;
+		std::vector<pool_check_thread_info> infos(thread_count);
+		for(size_t i(0); i < thread_count; ++i) {
+			infos[i].shared = &shared;
+			infos[i].id = i;
+			infos[i].mistakes = 0;
+			infos[i].recycled = 0;
+		}
+		run_threads(infos, processor_count, &pool_check_thread_proc);
+		for(size_t i(0); i < thread_count; ++i) {
+			mistakes += infos[i].mistakes;
+			// the first round's threads have nothing to reuse
+			recycled += round != 0 ? infos[i].recycled : 0;
+		}
+		if(!shared.orphan) {
+			void* v = nullptr;
+			while(::interlocked_stack_pop(shared.handoff, &v)) {
+				::object_pool_release(shared.pool, v);
+			}
+		}
+	}
+	::delete_interlocked_stack(shared.handoff);
+	::CloseHandle(shared.gate);
+
+	// later rounds have to get back what the earlier ones' threads left behind
+	std::cout << "\tobject_pool mistakes: " << mistakes << " recycled: " << recycled << (mistakes == 0 && recycled != 0 ? "" : " WRONG") << std::endl;
+}
+
+void check_object_pools() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t thread_count = std::max(static_cast<size_t>(2), processor_count * 2);
+
+	std::cout << "threads: " << thread_count << std::endl;
+	check_object_pool(thread_count, processor_count);
+}
+
+static const char* backoff_policy_name(backoff_policy_t policy) {
+	switch(policy) {
+	case BACKOFF_NONE:         return "none";
+	case BACKOFF_EXPONENTIAL:  return "exponential";
+	case BACKOFF_PROPORTIONAL: return "proportional";
+	case BACKOFF_YIELD:        return "yield";
+	}
+	return "unknown";
+}
+
+// runs a container under the given backoff policy, keeping hold of its retry
+// statistics when it's torn down
+template<typename Traits, backoff_policy_t Policy>
+struct backoff_traits : Traits {
+	typedef typename Traits::queue_type queue_type;
+	static queue_type* create(size_t thread_count) {
+		queue_type* q = Traits::create(thread_count);
+		::contention_set_policy(Traits::contention(q), Policy);
+		return q;
+	}
+	static void destroy(queue_type* q) {
+		::contention_get_stats(Traits::contention(q), &last_stats);
+		Traits::destroy(q);
+	}
+	static contention_stats_t last_stats;
+};
+
+template<typename Traits, backoff_policy_t Policy>
+contention_stats_t backoff_traits<Traits, Policy>::last_stats;
+
+template<typename Traits, backoff_policy_t Policy>
+void report_backoff(size_t thread_count, size_t processor_count) {
+	typedef backoff_traits<Traits, Policy> traits_type;
+	double seconds = benchmark_queue<traits_type>(thread_count, processor_count, &queue_thread_proc<traits_type>, nullptr);
+	double operations = 2.0 * static_cast<double>(thread_count) * static_cast<double>(queue_operations);
+	const contention_stats_t& stats = traits_type::last_stats;
+	std::cout << "\t" << Traits::name() << " " << backoff_policy_name(Policy) << " Mops/s: " << (operations / seconds) / 1000000.0
+	          << " contended: " << static_cast<double>(stats.contended_operations) / operations
+	          << " retries/op: " << static_cast<double>(stats.retries) / operations
+	          << " pauses/op: " << static_cast<double>(stats.pauses) / operations << std::endl;
+}
+
+template<typename Traits>
+void report_backoff_policies(size_t thread_count, size_t processor_count) {
+	report_backoff<Traits, BACKOFF_NONE        >(thread_count, processor_count);
+	report_backoff<Traits, BACKOFF_EXPONENTIAL >(thread_count, processor_count);
+	report_backoff<Traits, BACKOFF_PROPORTIONAL>(thread_count, processor_count);
+	report_backoff<Traits, BACKOFF_YIELD       >(thread_count, processor_count);
+}
+
+// backing off changes when a CAS is retried, never what it ends up doing
+template<typename Traits, backoff_policy_t Policy>
+void check_backoff_policy(size_t thread_count, size_t processor_count, bool fifo) {
+	std::cout << "\t" << backoff_policy_name(Policy) << ":" << std::endl;
+	check_queue<backoff_traits<Traits, Policy> >(thread_count, processor_count, fifo);
+}
+
+template<typename Traits>
+void check_backoff_policies(size_t thread_count, size_t processor_count, bool fifo) {
+	check_backoff_policy<Traits, BACKOFF_NONE        >(thread_count, processor_count, fifo);
+	check_backoff_policy<Traits, BACKOFF_EXPONENTIAL >(thread_count, processor_count, fifo);
+	check_backoff_policy<Traits, BACKOFF_PROPORTIONAL>(thread_count, processor_count, fifo);
+	check_backoff_policy<Traits, BACKOFF_YIELD       >(thread_count, processor_count, fifo);
+}
+
+void check_backoff() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t thread_count = processor_count * 4;
+
+	std::cout << "threads: " << thread_count << std::endl;
+	check_backoff_policies<interlocked_stack_traits>(thread_count, processor_count, false);
+	check_backoff_policies<interlocked_queue_traits>(thread_count, processor_count, true);
+}
+
+void benchmark_backoff() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	const size_t thread_counts[] = { processor_count, processor_count * 4 };
+	for(size_t i(0); i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+		std::cout << "threads: " << thread_counts[i] << std::endl;
+		report_backoff_policies<interlocked_stack_traits>(thread_counts[i], processor_count);
+		report_backoff_policies<interlocked_queue_traits>(thread_counts[i], processor_count);
+	}
+}
+
+// tail latency only gets interesting once threads start getting preempted
+// mid-operation, so run oversubscribed as well as one thread per core. QPC is
+// coarse next to a single uncontended operation, so p50 is mostly the timer
+// resolution; the high percentiles are what matter.
+void benchmark_queue_latencies() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	const size_t thread_counts[] = { processor_count, processor_count * 4 };
+	for(size_t i(0); i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+		std::cout << "threads: " << thread_counts[i] << std::endl;
+		report_queue_latency<interlocked_queue_traits          >(thread_counts[i], processor_count);
+		report_queue_latency<interlocked_wait_free_queue_traits>(thread_counts[i], processor_count);
+	}
+}
+
+// keys go in as the pointer values themselves, so there's no allocation in the way
+static int compare_keys(const void* lhs, const void* rhs) {
+	size_t l = reinterpret_cast<size_t>(lhs);
+	size_t r = reinterpret_cast<size_t>(rhs);
+	return l < r ? -1 : (r < l ? 1 : 0);
+}
+
+// xorshift, so that making up keys costs next to nothing
+static size_t next_key(unsigned __int64& state) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return static_cast<size_t>(state);
+}
+
+static const size_t priority_queue_prefill = 64 * 1024;
+static const size_t priority_queue_operations = 128 * 1024;
+
+template<typename Traits>
+typename Traits::queue_type* prefill_priority_queue(typename Traits::queue_type* q) {
+	unsigned __int64 state = 88172645463325252ULL;
+	for(size_t i(0); i < priority_queue_prefill; ++i) {
+		Traits::push(q, next_key(state));
+	}
+	return q;
+}
+
+struct interlocked_priority_queue_traits {
+	typedef interlocked_priority_queue_t queue_type;
+	static const char* name() { return "interlocked_priority_queue"; }
+	static queue_type* create(size_t) { return prefill_priority_queue<interlocked_priority_queue_traits>(::new_interlocked_priority_queue(&compare_keys, &null_destructor, &null_destructor)); }
+	static void destroy(queue_type* q) { ::delete_interlocked_priority_queue(q); }
+	static void push(queue_type* q, size_t key) { ::interlocked_priority_queue_push(q, reinterpret_cast<const void*>(key), nullptr); }
+	static bool pop(queue_type* q) {
+		return ::interlocked_priority_queue_delete_min(q, nullptr, nullptr);
+	}
+};
+
+// Keys that live on the heap, as they do behind the C++ wrapper. With integer
+// keys cast to pointers, comparing against a key that's already been freed
+// goes unnoticed; with these, the debug heap catches it. Each value is the
+// number its key was made from, so a pop that hands back a key and value that
+// don't belong together is counted too.
+struct string_priority_queue_traits {
+	typedef utility::interlocked_priority_queue<std::string, size_t> queue_type;
+	static const char* name() { return "utility::interlocked_priority_queue (string keys)"; }
+	static queue_type* create(size_t) { return prefill_priority_queue<string_priority_queue_traits>(new queue_type()); }
+	static void destroy(queue_type* q) { delete q; }
+	static void push(queue_type* q, size_t key) { q->push(make_key(key), key); }
+	static bool pop(queue_type* q) {
+		std::pair<bool, std::pair<std::string, size_t> > e(q->pop());
+		if(e.first && e.second.first != make_key(e.second.second)) {
+			++mismatches;
+		}
+		return e.first;
+	}
+
+	// long enough to stay out of std::string's small buffer
+	static std::string make_key(size_t key) {
+		return "priority-queue-key-" + std::to_string(key);
+	}
+
+	static std::atomic<size_t> mismatches;
+};
+
+std::atomic<size_t> string_priority_queue_traits::mismatches;
+
+struct locked_heap {
+	locked_heap() {
+		::InitializeCriticalSection(&cs);
+	}
+
+	~locked_heap() {
+		::DeleteCriticalSection(&cs);
+	}
+
+	CRITICAL_SECTION cs;
+	std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t> > heap;
+};
+
+struct locked_heap_traits {
+	typedef locked_heap queue_type;
+	static const char* name() { return "locked std::priority_queue"; }
+	static queue_type* create(size_t) { return prefill_priority_queue<locked_heap_traits>(new locked_heap()); }
+	static void destroy(queue_type* q) { delete q; }
+	static void push(queue_type* q, size_t key) {
+		::EnterCriticalSection(&q->cs);
+		q->heap.push(key);
+		::LeaveCriticalSection(&q->cs);
+	}
+	static bool pop(queue_type* q) {
+		::EnterCriticalSection(&q->cs);
+		bool popped = !q->heap.empty();
+		if(popped) {
+			q->heap.pop();
+		}
+		::LeaveCriticalSection(&q->cs);
+		return popped;
+	}
+};
+
+// the steady state of a scheduler: take the most urgent job, queue up another
+template<typename Traits>
+DWORD WINAPI priority_queue_thread_proc(void* data) {
+	container_thread_info<typename Traits::queue_type>* ti = static_cast<container_thread_info<typename Traits::queue_type>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	unsigned __int64 state = (static_cast<unsigned __int64>(::GetCurrentThreadId()) * 0x9e3779b97f4a7c15ULL) | 1;
+	::WaitForSingleObject(ti->begin, INFINITE);
+	for(size_t i(0); i < priority_queue_operations; ++i) {
+		Traits::pop(ti->container);
+		Traits::push(ti->container, next_key(state));
+	}
+	return 0;
+}
+
+template<typename Traits>
+void report_priority_queue(size_t thread_count, size_t processor_count) {
+	double seconds = benchmark_queue<Traits>(thread_count, processor_count, &priority_queue_thread_proc<Traits>, nullptr);
+	double operations = 2.0 * static_cast<double>(thread_count) * static_cast<double>(priority_queue_operations);
+	std::cout << "\t" << Traits::name() << " time: " << seconds << " Mops/s: " << (operations / seconds) / 1000000.0 << std::endl;
+}
+
+typedef std::vector<std::pair<size_t, size_t> > priority_queue_entries;
+
+struct priority_queue_check_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	interlocked_priority_queue_t* queue;
+	size_t producer;
+	priority_queue_entries popped;
+};
+
+static void record_priority_queue_entry(const void* key, void* value, void* context) {
+	static_cast<priority_queue_entries*>(context)->push_back(std::make_pair(reinterpret_cast<size_t>(key), reinterpret_cast<size_t>(value)));
+}
+
+// random keys, but every value says who pushed it and when
+DWORD WINAPI priority_queue_check_thread_proc(void* data) {
+	priority_queue_check_thread_info* ti = static_cast<priority_queue_check_thread_info*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	unsigned __int64 state = (static_cast<unsigned __int64>(ti->producer + 1) * 0x9e3779b97f4a7c15ULL) | 1;
+	ti->popped.reserve(queue_check_operations);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	for(size_t i(0); i < queue_check_operations; ++i) {
+		::interlocked_priority_queue_push(ti->queue, reinterpret_cast<const void*>(next_key(state)), reinterpret_cast<void*>(queue_check_value(ti->producer, i)));
+		if(i % 2 == 0) {
+			::interlocked_priority_queue_delete_min(ti->queue, &record_priority_queue_entry, &ti->popped);
+		}
+	}
+	return 0;
+}
+
+// Every entry has to be claimed exactly once, by one of the threads or by the
+// drain at the end, and with nobody else pushing, the drain has to come out
+// in key order.
+void check_priority_queue(size_t thread_count, size_t processor_count) {
+	interlocked_priority_queue_t* q = ::new_interlocked_priority_queue(&compare_keys, &null_destructor, &null_destructor);
+	std::vector<priority_queue_check_thread_info> infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].queue = q;
+		infos[i].producer = i;
+	}
+	run_threads(infos, processor_count, &priority_queue_check_thread_proc);
+
+	priority_queue_entries drained;
+	while(::interlocked_priority_queue_delete_min(q, &record_priority_queue_entry, &drained)) {
+	}
+	::delete_interlocked_priority_queue(q);
+
+	size_t unsorted = 0;
+	for(size_t i(1); i < drained.size(); ++i) {
+		if(drained[i].first < drained[i - 1].first) {
+			++unsorted;
+		}
+	}
+	std::vector<size_t> seen(thread_count * queue_check_operations, 0);
+	size_t strays = 0;
+	for(size_t i(0); i <= thread_count; ++i) {
+		const priority_queue_entries& popped = i < thread_count ? infos[i].popped : drained;
+		for(size_t j(0); j < popped.size(); ++j) {
+			const size_t value = popped[j].second;
+			if(value == 0 || value > seen.size()) {
+				++strays;
+				continue;
+			}
+			++seen[value - 1];
+		}
+	}
+	const size_t lost = static_cast<size_t>(std::count(seen.begin(), seen.end(), 0));
+	const size_t duplicated = seen.size() - lost - static_cast<size_t>(std::count(seen.begin(), seen.end(), 1));
+	std::cout << "\tinterlocked_priority_queue lost: " << lost << " duplicated: " << duplicated << " strays: " << strays << " out of order: " << unsorted
+	          << (lost == 0 && duplicated == 0 && strays == 0 && unsorted == 0 ? "" : " WRONG") << std::endl;
+}
+
+void check_priority_queues() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	const size_t thread_counts[] = { 1, processor_count * 2 };
+	for(size_t i(0); i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+		std::cout << "threads: " << thread_counts[i] << std::endl;
+		check_priority_queue(thread_counts[i], processor_count);
+	}
+}
+
+void benchmark_priority_queues() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(64), processor_count * 2);
+
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_priority_queue<interlocked_priority_queue_traits>(thread_count, processor_count);
+		report_priority_queue<string_priority_queue_traits     >(thread_count, processor_count);
+		report_priority_queue<locked_heap_traits               >(thread_count, processor_count);
+	}
+	if(string_priority_queue_traits::mismatches != 0) {
+		std::cout << "string keys: " << string_priority_queue_traits::mismatches << " mismatched entries WRONG" << std::endl;
+	}
+}
+
+// big enough that the index doesn't fit in cache, which is the point of an ordered index
+static const size_t ordered_map_key_range = 2 * 1024 * 1024;
+static const size_t ordered_map_operations = 256 * 1024;
+
+// a list has to walk to its key, so it gets a range short enough to stay in cache
+static const size_t ordered_list_key_range = 256;
+
+template<typename Traits>
+static size_t next_ordered_map_key(unsigned __int64& state) {
+	return (next_key(state) % Traits::key_range) + 1;
+}
+
+template<typename Traits>
+typename Traits::map_type* prefill_ordered_map(typename Traits::map_type* m) {
+	unsigned __int64 state = 88172645463325252ULL;
+	for(size_t i(0); i < Traits::key_range / 2; ++i) {
+		Traits::insert(m, next_ordered_map_key<Traits>(state));
+	}
+	return m;
+}
+
+struct interlocked_skip_list_traits {
+	typedef interlocked_skip_list_t map_type;
+	static const size_t key_range = ordered_map_key_range;
+	static const char* name() { return "interlocked_skip_list"; }
+	static map_type* create() { return prefill_ordered_map<interlocked_skip_list_traits>(::new_interlocked_skip_list(&compare_keys, &null_destructor, &null_destructor)); }
+	static void destroy(map_type* m) { ::delete_interlocked_skip_list(m); }
+	static void insert(map_type* m, size_t key) { ::interlocked_skip_list_insert(m, reinterpret_cast<const void*>(key), nullptr); }
+	static void erase(map_type* m, size_t key) { ::interlocked_skip_list_delete(m, reinterpret_cast<const void*>(key)); }
+	static bool lower_bound(map_type* m, size_t key) { return ::interlocked_skip_list_lower_bound(m, reinterpret_cast<const void*>(key), nullptr, nullptr); }
+};
+
+struct locked_map {
+	locked_map() {
+		::InitializeCriticalSection(&cs);
+	}
 
-struct thread_info {
+	~locked_map() {
+		::DeleteCriticalSection(&cs);
+	}
+
+	CRITICAL_SECTION cs;
+	std::map<size_t, void*> map;
+};
+
+struct locked_map_traits {
+	typedef locked_map map_type;
+	static const size_t key_range = ordered_map_key_range;
+	static const char* name() { return "locked std::map"; }
+	static map_type* create() { return prefill_ordered_map<locked_map_traits>(new locked_map()); }
+	static void destroy(map_type* m) { delete m; }
+	static void insert(map_type* m, size_t key) {
+		::EnterCriticalSection(&m->cs);
+		m->map.insert(std::make_pair(key, static_cast<void*>(nullptr)));
+		::LeaveCriticalSection(&m->cs);
+	}
+	static void erase(map_type* m, size_t key) {
+		::EnterCriticalSection(&m->cs);
+		m->map.erase(key);
+		::LeaveCriticalSection(&m->cs);
+	}
+	static bool lower_bound(map_type* m, size_t key) {
+		::EnterCriticalSection(&m->cs);
+		bool found = m->map.lower_bound(key) != m->map.end();
+		::LeaveCriticalSection(&m->cs);
+		return found;
+	}
+};
+
+// The list's find walks to the first key not less than the one it's after,
+// which is the same search a lower_bound does.
+template<typename List>
+struct ordered_list_traits {
+	typedef List map_type;
+	static const size_t key_range = ordered_list_key_range;
+	static map_type* create() { return prefill_ordered_map<ordered_list_traits<List> >(new map_type()); }
+	static void destroy(map_type* m) { delete m; }
+	static void insert(map_type* m, size_t key) { m->insert(key, key); }
+	static void erase(map_type* m, size_t key) { m->erase(key); }
+	static bool lower_bound(map_type* m, size_t key) { return m->find(key).first; }
+};
+
+struct interlocked_harris_list_traits : ordered_list_traits<utility::interlocked_harris_list<size_t, size_t> > {
+	static const char* name() { return "interlocked_harris_list"; }
+};
+
+struct interlocked_kv_list_traits : ordered_list_traits<utility::interlocked_kv_list<size_t, size_t> > {
+	static const char* name() { return "utility::interlocked_kv_list"; }
+};
+
+// mostly lookups, with enough inserts and deletes to keep the index churning
+template<typename Traits>
+DWORD WINAPI ordered_map_thread_proc(void* data) {
+	container_thread_info<typename Traits::map_type>* ti = static_cast<container_thread_info<typename Traits::map_type>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	unsigned __int64 state = (static_cast<unsigned __int64>(::GetCurrentThreadId()) * 0x9e3779b97f4a7c15ULL) | 1;
+	::WaitForSingleObject(ti->begin, INFINITE);
+	for(size_t i(0); i < ordered_map_operations; ++i) {
+		size_t key = next_ordered_map_key<Traits>(state);
+		switch(key % 10) {
+		case 0:
+			Traits::insert(ti->container, key);
+			break;
+		case 1:
+			Traits::erase(ti->container, key);
+			break;
+		default:
+			Traits::lower_bound(ti->container, key);
+			break;
+		}
+	}
+	return 0;
+}
+
+template<typename Traits>
+void report_ordered_map(size_t thread_count, size_t processor_count) {
+	typename Traits::map_type* m = Traits::create();
+	double seconds = benchmark_container(m, thread_count, processor_count, &ordered_map_thread_proc<Traits>, nullptr);
+	Traits::destroy(m);
+	double operations = static_cast<double>(thread_count) * static_cast<double>(ordered_map_operations);
+	std::cout << "\t" << Traits::name() << " time: " << seconds << " Mops/s: " << (operations / seconds) / 1000000.0 << std::endl;
+}
+
+void benchmark_ordered_maps() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(64), processor_count * 2);
+
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_ordered_map<interlocked_skip_list_traits>(thread_count, processor_count);
+		report_ordered_map<locked_map_traits           >(thread_count, processor_count);
+	}
+}
+
+// one allocation per node against three, and inlined comparisons against calls through a pointer
+void benchmark_ordered_lists() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(64), processor_count * 2);
+
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_ordered_map<interlocked_harris_list_traits>(thread_count, processor_count);
+		report_ordered_map<interlocked_kv_list_traits    >(thread_count, processor_count);
+	}
+}
+
+static const size_t kv_list_check_keys = 64;
+static const size_t kv_list_check_operations = 16 * 1024;
+
+// Values come out of a pool and are never really freed, so one that's handed
+// out after it was destroyed, or destroyed twice, can be told apart from one
+// that's still live.
+struct kv_list_check_value {
+	size_t key;
+	std::atomic<int> state;
+};
+
+enum { kv_list_value_unused, kv_list_value_live, kv_list_value_destroyed };
+
+static std::atomic<size_t> kv_list_double_destroys;
+
+static void destroy_kv_list_check_value(const void* value) {
+	kv_list_check_value* v = static_cast<kv_list_check_value*>(const_cast<void*>(value));
+	if(v->state.exchange(kv_list_value_destroyed) != kv_list_value_live) {
+		++kv_list_double_destroys;
+	}
+}
+
+// a value handed out while it's protected has to be live, and has to be its key's
+static bool kv_list_check_value_ok(const void* key, const void* value) {
+	const kv_list_check_value* v = static_cast<const kv_list_check_value*>(value);
+	return v != nullptr && v->state.load() == kv_list_value_live && v->key == reinterpret_cast<size_t>(key);
+}
+
+struct kv_list_check_thread_info {
 	size_t processor_id;
 	HANDLE begin;
-	counter_t* counters;
+	interlocked_kv_list_t* list;
+	kv_list_check_value* values; // this thread's share of the pool
+	size_t used;
+	kv_list_check_value* computed;
+	size_t mistakes;
+	size_t lost_computes;
 };
 
-static const __declspec(align(64)) unsigned __int64 target = 512 * 1024;
+static kv_list_check_value* new_kv_list_check_value(kv_list_check_thread_info* ti, size_t key) {
+	kv_list_check_value* v = &ti->values[ti->used++];
+	v->key = key;
+	v->state.store(kv_list_value_live);
+	return v;
+}
+
+static void* compute_kv_list_check_value(const void* key, void* context) {
+	kv_list_check_thread_info* ti = static_cast<kv_list_check_thread_info*>(context);
+	ti->computed = new_kv_list_check_value(ti, reinterpret_cast<size_t>(key));
+	// give another thread the chance to insert the key first
+	::SwitchToThread();
+	return ti->computed;
+}
+
+struct kv_list_lookup {
+	void* value;
+	size_t mistakes;
+};
+
+static void check_kv_list_lookup(const void* key, void* value, void* context) {
+	kv_list_lookup* lookup = static_cast<kv_list_lookup*>(context);
+	// hold on to the value while other threads get a turn at replacing and deleting it
+	::SwitchToThread();
+	lookup->value = value;
+	lookup->mistakes += kv_list_check_value_ok(key, value) ? 0 : 1;
+}
+
+struct kv_list_scan {
+	size_t last;
+	size_t count;
+	size_t mistakes;
+};
+
+static bool check_kv_list_entry(const void* key, void* value, void* context) {
+	kv_list_scan* scan = static_cast<kv_list_scan*>(context);
+	const size_t k = reinterpret_cast<size_t>(key);
+	if(!kv_list_check_value_ok(key, value) || (scan->count != 0 && k <= scan->last)) {
+		++scan->mistakes;
+	}
+	scan->last = k;
+	++scan->count;
+	return true;
+}
 
-DWORD WINAPI thread_proc(void* data) {
-	thread_info* ti = static_cast<thread_info*>(data);
-	::SetThreadAffinityMask(::GetCurrentThread(), 1 << ti->processor_id);
+// A few keys, so that every kind of update keeps landing on nodes that other
+// threads are reading, replacing and deleting.
+DWORD WINAPI kv_list_check_thread_proc(void* data) {
+	kv_list_check_thread_info* ti = static_cast<kv_list_check_thread_info*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	unsigned __int64 state = (static_cast<unsigned __int64>(::GetCurrentThreadId()) * 0x9e3779b97f4a7c15ULL) | 1;
 	::WaitForSingleObject(ti->begin, INFINITE);
-	for(size_t i(0); i < target; ++i) {
-		ti->counters->increment();
+	size_t mistakes = 0;
+	for(size_t i(0); i < kv_list_check_operations; ++i) {
+		const size_t key = (next_key(state) % kv_list_check_keys) + 1;
+		const void* k = reinterpret_cast<const void*>(key);
+		switch(next_key(state) % 6) {
+		case 0:
+			::interlocked_kv_list_insert_or_assign(ti->list, k, new_kv_list_check_value(ti, key));
+			break;
+		case 1:
+			{
+				ti->computed = nullptr;
+				if(::interlocked_kv_list_compute_if_absent(ti->list, k, &compute_kv_list_check_value, ti)) {
+					mistakes += ti->computed != nullptr ? 0 : 1;
+				} else if(ti->computed != nullptr) {
+					// lost the race, so the list has already destroyed it
+					++ti->lost_computes;
+					mistakes += ti->computed->state.load() == kv_list_value_destroyed ? 0 : 1;
+				}
+			}
+			break;
+		case 2:
+			{
+				kv_list_lookup lookup = { nullptr, 0 };
+				if(::interlocked_kv_list_find(ti->list, k, &check_kv_list_lookup, &lookup)) {
+					kv_list_check_value* desired = new_kv_list_check_value(ti, key);
+					if(!::interlocked_kv_list_replace_value(ti->list, k, lookup.value, desired)) {
+						desired->state.store(kv_list_value_destroyed); // never the list's
+					}
+				}
+				mistakes += lookup.mistakes;
+			}
+			break;
+		case 3:
+			::interlocked_kv_list_delete(ti->list, k);
+			break;
+		case 4:
+			{
+				kv_list_lookup lookup = { nullptr, 0 };
+				::interlocked_kv_list_find(ti->list, k, &check_kv_list_lookup, &lookup);
+				mistakes += lookup.mistakes;
+			}
+			break;
+		case 5:
+			{
+				kv_list_scan scan = { 0, 0, 0 };
+				::interlocked_kv_list_range_scan(ti->list, nullptr, nullptr, &check_kv_list_entry, &scan);
+				mistakes += scan.mistakes;
+			}
+			break;
+		}
 	}
+	ti->mistakes = mistakes;
 	return 0;
 }
 
-static unsigned __int64 interlocked_counter = 0;
+void check_kv_list(size_t thread_count, size_t processor_count) {
+	// every operation uses at most one value
+	std::vector<kv_list_check_value> values(thread_count * kv_list_check_operations);
+	kv_list_double_destroys = 0;
+
+	interlocked_kv_list_t* l = ::new_interlocked_kv_list(&compare_keys, &null_destructor, &destroy_kv_list_check_value);
+	std::vector<kv_list_check_thread_info> infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].list = l;
+		infos[i].values = &values[i * kv_list_check_operations];
+		infos[i].used = 0;
+		infos[i].computed = nullptr;
+		infos[i].mistakes = 0;
+		infos[i].lost_computes = 0;
+	}
+	run_threads(infos, processor_count, &kv_list_check_thread_proc);
+
+	size_t mistakes = 0, lost_computes = 0;
+	for(size_t i(0); i < thread_count; ++i) {
+		mistakes += infos[i].mistakes;
+		lost_computes += infos[i].lost_computes;
+	}
+	kv_list_scan scan = { 0, 0, 0 };
+	::interlocked_kv_list_range_scan(l, nullptr, nullptr, &check_kv_list_entry, &scan);
+	mistakes += scan.mistakes;
+	::delete_interlocked_kv_list(l);
+	// the pool has to outlast everything retired into it
+	smr::detail::smr_clean();
+
+	std::cout << "\tinterlocked_kv_list mistakes: " << mistakes << " double destroys: " << kv_list_double_destroys << " lost computes: " << lost_computes
+	          << (mistakes == 0 && kv_list_double_destroys == 0 ? "" : " WRONG") << std::endl;
+}
+
+void check_kv_lists() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	const size_t thread_counts[] = { 1, processor_count * 2 };
+	for(size_t i(0); i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+		std::cout << "threads: " << thread_counts[i] << std::endl;
+		check_kv_list(thread_counts[i], processor_count);
+	}
+}
+
+static const size_t harris_list_check_keys = 64;
+static const size_t harris_list_check_operations = 16 * 1024;
+
+// Counts itself in and out, so a node that's never reclaimed, or reclaimed
+// twice, leaves the count off zero. A destroyed value forgets its key.
+struct harris_list_check_value {
+	explicit harris_list_check_value(size_t k = 0) : key(k) {
+		++live;
+	}
+
+	harris_list_check_value(const harris_list_check_value& rhs) : key(rhs.key) {
+		++live;
+	}
+
+	harris_list_check_value& operator=(const harris_list_check_value& rhs) {
+		key = rhs.key;
+		return *this;
+	}
+
+	~harris_list_check_value() {
+		key = 0;
+		--live;
+	}
+
+	size_t key;
+	static std::atomic<long> live;
+};
+
+std::atomic<long> harris_list_check_value::live;
+
+typedef utility::interlocked_harris_list<size_t, harris_list_check_value> harris_check_list;
+
+struct harris_list_check_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	harris_check_list* list;
+	std::atomic<size_t>* finished;
+	size_t thread_count;
+	size_t inserted;
+	size_t erased;
+	size_t mistakes;
+};
 
-DWORD WINAPI naive_thread_proc(void* data) {
-	thread_info* ti = static_cast<thread_info*>(data);
-	::SetThreadAffinityMask(::GetCurrentThread(), 1 << ti->processor_id);
+DWORD WINAPI harris_list_check_thread_proc(void* data) {
+	harris_list_check_thread_info* ti = static_cast<harris_list_check_thread_info*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	unsigned __int64 state = (static_cast<unsigned __int64>(::GetCurrentThreadId()) * 0x9e3779b97f4a7c15ULL) | 1;
 	::WaitForSingleObject(ti->begin, INFINITE);
-	for(size_t i(0); i < target; ++i) {
-		::InterlockedIncrement(&interlocked_counter);
+	for(size_t i(0); i < harris_list_check_operations; ++i) {
+		const size_t key = (next_key(state) % harris_list_check_keys) + 1;
+		switch(next_key(state) % 3) {
+		case 0:
+			ti->inserted += ti->list->emplace(key, key) ? 1 : 0;
+			break;
+		case 1:
+			ti->erased += ti->list->erase(key) ? 1 : 0;
+			break;
+		case 2:
+			{
+				std::pair<bool, harris_list_check_value> r = ti->list->find(key);
+				ti->mistakes += (r.first && r.second.key != key) ? 1 : 0;
+			}
+			break;
+		}
+	}
+	// a thread's retirements go with it when it exits, so once nobody is
+	// holding a hazard any more, everything it unlinked has to go now
+	++*ti->finished;
+	while(ti->finished->load() != ti->thread_count) {
+		::SwitchToThread();
+	}
+	smr::detail::smr_clean();
+	return 0;
+}
+
+void check_harris_list(size_t thread_count, size_t processor_count) {
+	harris_list_check_value::live = 0;
+	std::atomic<size_t> finished(0);
+	harris_check_list* l = new harris_check_list();
+	std::vector<harris_list_check_thread_info> infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].list = l;
+		infos[i].finished = &finished;
+		infos[i].thread_count = thread_count;
+		infos[i].inserted = 0;
+		infos[i].erased = 0;
+		infos[i].mistakes = 0;
+	}
+	run_threads(infos, processor_count, &harris_list_check_thread_proc);
+
+	size_t inserted = 0, erased = 0, mistakes = 0;
+	for(size_t i(0); i < thread_count; ++i) {
+		inserted += infos[i].inserted;
+		erased += infos[i].erased;
+		mistakes += infos[i].mistakes;
+	}
+	size_t present = 0;
+	for(size_t key(1); key <= harris_list_check_keys; ++key) {
+		present += l->find(key).first ? 1 : 0;
+	}
+	// every insert that took is either still there or was erased exactly once
+	mistakes += present == inserted - erased ? 0 : 1;
+	const long in_list = harris_list_check_value::live.load();
+	delete l;
+	smr::detail::smr_clean();
+	const long leaked = harris_list_check_value::live.load();
+
+	std::cout << "\tinterlocked_harris_list inserted: " << inserted << " erased: " << erased << " present: " << present << " mistakes: " << mistakes << " leaked: " << leaked
+	          << (mistakes == 0 && in_list == static_cast<long>(present) && leaked == 0 ? "" : " WRONG") << std::endl;
+}
+
+void check_harris_lists() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	const size_t thread_counts[] = { 1, processor_count * 2 };
+	for(size_t i(0); i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+		std::cout << "threads: " << thread_counts[i] << std::endl;
+		check_harris_list(thread_counts[i], processor_count);
+	}
+}
+
+static const size_t scan_check_keys = 1024;
+static const size_t scan_check_scans = 256;
+
+// every fourth key stays put; the rest keep getting deleted and put back
+static bool scan_check_key_is_permanent(size_t key) {
+	return key % 4 == 0;
+}
+
+struct scan_check_output {
+	std::vector<size_t> keys;
+	// the key the scan is standing on, for the deleters to aim at
+	std::atomic<size_t>* position;
+};
+
+// collects what a scan hands out, and now and then lets the deleters run
+// while the scan is holding on to an entry
+static void record_scanned_key(scan_check_output* output, const void* key) {
+	output->keys.push_back(reinterpret_cast<size_t>(key));
+	if(output->keys.size() % 16 == 0) {
+		output->position->store(reinterpret_cast<size_t>(key));
+		::SwitchToThread();
+	}
+}
+
+static bool record_scanned_kv_list_entry(const void* key, void*, void* context) {
+	record_scanned_key(static_cast<scan_check_output*>(context), key);
+	return true;
+}
+
+static void record_scanned_skip_list_entry(const void* key, void*, void* context) {
+	record_scanned_key(static_cast<scan_check_output*>(context), key);
+}
+
+struct kv_list_iterator_scan_traits {
+	typedef interlocked_kv_list_t map_type;
+	static const char* name() { return "interlocked_kv_list iterator"; }
+	static map_type* create() { return ::new_interlocked_kv_list(&compare_keys, &null_destructor, &null_destructor); }
+	static void destroy(map_type* m) { ::delete_interlocked_kv_list(m); }
+	static void insert(map_type* m, size_t key) { ::interlocked_kv_list_insert(m, reinterpret_cast<const void*>(key), nullptr); }
+	static void erase(map_type* m, size_t key) { ::interlocked_kv_list_delete(m, reinterpret_cast<const void*>(key)); }
+	// lo of zero means from the start
+	static void scan(map_type* m, size_t lo, scan_check_output* output) {
+		interlocked_kv_list_iterator_t* it = ::new_interlocked_kv_list_iterator(m);
+		if(lo != 0) {
+			::interlocked_kv_list_iterator_seek(it, reinterpret_cast<const void*>(lo));
+		}
+		const void* key = nullptr;
+		while(::interlocked_kv_list_iterator_next(it, &key, nullptr)) {
+			record_scanned_key(output, key);
+		}
+		::delete_interlocked_kv_list_iterator(it);
+	}
+};
+
+struct kv_list_range_scan_traits : kv_list_iterator_scan_traits {
+	static const char* name() { return "interlocked_kv_list range_scan"; }
+	static void scan(map_type* m, size_t lo, scan_check_output* output) {
+		::interlocked_kv_list_range_scan(m, lo != 0 ? reinterpret_cast<const void*>(lo) : nullptr, nullptr, &record_scanned_kv_list_entry, output);
+	}
+};
+
+struct skip_list_range_scan_traits {
+	typedef interlocked_skip_list_t map_type;
+	static const char* name() { return "interlocked_skip_list range_scan"; }
+	static map_type* create() { return ::new_interlocked_skip_list(&compare_keys, &null_destructor, &null_destructor); }
+	static void destroy(map_type* m) { ::delete_interlocked_skip_list(m); }
+	static void insert(map_type* m, size_t key) { ::interlocked_skip_list_insert(m, reinterpret_cast<const void*>(key), nullptr); }
+	static void erase(map_type* m, size_t key) { ::interlocked_skip_list_delete(m, reinterpret_cast<const void*>(key)); }
+	static void scan(map_type* m, size_t lo, scan_check_output* output) {
+		::interlocked_skip_list_range_scan(m, lo != 0 ? reinterpret_cast<const void*>(lo) : nullptr, nullptr, &record_scanned_skip_list_entry, output);
+	}
+};
+
+template<typename Traits>
+struct scan_check_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	typename Traits::map_type* map;
+	bool scanner;
+	std::atomic<size_t>* scanners_left;
+	std::atomic<size_t>* position;
+	size_t scans;
+	size_t unsorted;
+	size_t missing;
+};
+
+// Scanners walk the map from random starting points while the deleters churn
+// everything but the permanent keys, half the time going for the key a scan
+// last stopped on, so scans keep standing on nodes that are being deleted (and
+// put back). Whatever a scan hands out has to go up strictly, and the
+// permanent keys past its starting point must all be there.
+template<typename Traits>
+DWORD WINAPI scan_check_thread_proc(void* data) {
+	scan_check_thread_info<Traits>* ti = static_cast<scan_check_thread_info<Traits>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	unsigned __int64 state = (static_cast<unsigned __int64>(::GetCurrentThreadId()) * 0x9e3779b97f4a7c15ULL) | 1;
+	::WaitForSingleObject(ti->begin, INFINITE);
+	if(!ti->scanner) {
+		while(ti->scanners_left->load() != 0) {
+			size_t key = (next_key(state) % 2 == 0) ? ti->position->load() : (next_key(state) % scan_check_keys) + 1;
+			if(key == 0 || scan_check_key_is_permanent(key)) {
+				continue;
+			}
+			if(next_key(state) % 2 == 0) {
+				Traits::erase(ti->map, key);
+			} else {
+				Traits::insert(ti->map, key);
+			}
+		}
+		return 0;
+	}
+	scan_check_output output;
+	output.position = ti->position;
+	std::vector<size_t>& keys = output.keys;
+	for(size_t i(0); i < scan_check_scans; ++i) {
+		const size_t lo = (next_key(state) % 2 == 0) ? 0 : (next_key(state) % scan_check_keys) + 1;
+		keys.clear();
+		Traits::scan(ti->map, lo, &output);
+		for(size_t j(0); j < keys.size(); ++j) {
+			if(keys[j] < lo || (j != 0 && keys[j] <= keys[j - 1])) {
+				++ti->unsorted;
+			}
+		}
+		for(size_t key(std::max(lo, static_cast<size_t>(1))); key <= scan_check_keys; ++key) {
+			if(scan_check_key_is_permanent(key) && !std::binary_search(keys.begin(), keys.end(), key)) {
+				++ti->missing;
+			}
+		}
+		++ti->scans;
+	}
+	--*ti->scanners_left;
+	return 0;
+}
+
+template<typename Traits>
+void check_scan(size_t thread_count, size_t processor_count) {
+	typename Traits::map_type* m = Traits::create();
+	for(size_t key(1); key <= scan_check_keys; ++key) {
+		Traits::insert(m, key);
+	}
+	// every other thread scans
+	std::atomic<size_t> scanners_left((thread_count + 1) / 2);
+	std::atomic<size_t> position(0);
+	std::vector<scan_check_thread_info<Traits> > infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].map = m;
+		infos[i].scanner = (i % 2) == 0;
+		infos[i].scanners_left = &scanners_left;
+		infos[i].position = &position;
+		infos[i].scans = 0;
+		infos[i].unsorted = 0;
+		infos[i].missing = 0;
+	}
+	run_threads(infos, processor_count, &scan_check_thread_proc<Traits>);
+	Traits::destroy(m);
+
+	size_t scans = 0, unsorted = 0, missing = 0;
+	for(size_t i(0); i < thread_count; ++i) {
+		scans += infos[i].scans;
+		unsorted += infos[i].unsorted;
+		missing += infos[i].missing;
+	}
+	std::cout << "\t" << Traits::name() << " scans: " << scans << " unsorted: " << unsorted << " missing: " << missing << (unsorted == 0 && missing == 0 ? "" : " WRONG") << std::endl;
+}
+
+void check_scans() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t thread_count = std::max(static_cast<size_t>(2), processor_count * 2);
+
+	std::cout << "threads: " << thread_count << std::endl;
+	check_scan<kv_list_iterator_scan_traits>(thread_count, processor_count);
+	check_scan<kv_list_range_scan_traits   >(thread_count, processor_count);
+	check_scan<skip_list_range_scan_traits >(thread_count, processor_count);
+}
+
+static const size_t hash_set_insertions = 64 * 1024;
+
+// the keys are already random, so they can be their own hash
+static size_t hash_key(const void* key) {
+	return reinterpret_cast<size_t>(key);
+}
+
+struct interlocked_hash_set_traits {
+	typedef interlocked_hash_set_t set_type;
+	static const char* name() { return "interlocked_hash_set"; }
+	static set_type* create() { return ::new_interlocked_hash_set(&hash_key, &compare_keys, &null_destructor); }
+	static void destroy(set_type* m) { ::delete_interlocked_hash_set(m); }
+	static void insert(set_type* m, size_t key) { ::interlocked_hash_set_insert(m, reinterpret_cast<const void*>(key)); }
+};
+
+struct non_blocking_unordered_map_traits {
+	typedef non_blocking_unordered_map<size_t, size_t> set_type;
+	static const char* name() { return "non_blocking_unordered_map"; }
+	static set_type* create() { return new (smr::smr) set_type(); }
+	static void destroy(set_type* m) { smr::smr_destroy(m); }
+	static void insert(set_type* m, size_t key) { m->putIfAbsent(key, key); }
+};
+
+// Every thread inserts into a table that starts out empty, so it has to keep
+// growing the whole time. Each insert is timed, because what we're after is
+// whether growing stalls the inserts that run into it.
+template<typename Traits>
+DWORD WINAPI hash_set_growth_thread_proc(void* data) {
+	container_thread_info<typename Traits::set_type>* ti = static_cast<container_thread_info<typename Traits::set_type>*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	unsigned __int64 state = (static_cast<unsigned __int64>(::GetCurrentThreadId()) * 0x9e3779b97f4a7c15ULL) | 1;
+	std::vector<LONGLONG>& latencies = *ti->latencies;
+	latencies.reserve(hash_set_insertions);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	LARGE_INTEGER before = { 0 }, after = { 0 };
+	for(size_t i(0); i < hash_set_insertions; ++i) {
+		size_t key = next_key(state);
+		::QueryPerformanceCounter(&before);
+		Traits::insert(ti->container, key);
+		::QueryPerformanceCounter(&after);
+		latencies.push_back(after.QuadPart - before.QuadPart);
+	}
+	return 0;
+}
+
+template<typename Traits>
+void report_hash_set_growth(size_t thread_count, size_t processor_count) {
+	std::vector<std::vector<LONGLONG> > latencies(thread_count);
+	typename Traits::set_type* m = Traits::create();
+	double seconds = benchmark_container(m, thread_count, processor_count, &hash_set_growth_thread_proc<Traits>, &latencies);
+	Traits::destroy(m);
+	double operations = static_cast<double>(thread_count) * static_cast<double>(hash_set_insertions);
+	std::cout << "\t" << Traits::name() << " time: " << seconds << " Mops/s: " << (operations / seconds) / 1000000.0 << std::endl;
+	report_latencies(Traits::name(), latencies);
+}
+
+static const size_t hash_set_check_keys = 16 * 1024;
+
+struct hash_set_check_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	interlocked_hash_set_t* set;
+	size_t producer;
+	size_t mistakes;
+	size_t shared_deletes;
+};
+
+// keys 1 to hash_set_check_keys are shared; each thread also has a run of its own
+static size_t hash_set_check_key(size_t producer, size_t i) {
+	return ((producer + 1) * hash_set_check_keys) + i + 1;
+}
+
+// Nobody else touches a thread's own keys, so every answer about them is known
+// in advance. The shared keys are all deleted at once, and each delete has to
+// go to exactly one thread.
+DWORD WINAPI hash_set_check_thread_proc(void* data) {
+	hash_set_check_thread_info* ti = static_cast<hash_set_check_thread_info*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	interlocked_hash_set_t* s = ti->set;
+	::WaitForSingleObject(ti->begin, INFINITE);
+	size_t mistakes = 0;
+	for(size_t i(0); i < hash_set_check_keys; ++i) {
+		mistakes += ::interlocked_hash_set_insert(s, reinterpret_cast<const void*>(hash_set_check_key(ti->producer, i))) ? 0 : 1;
+	}
+	for(size_t i(0); i < hash_set_check_keys; ++i) {
+		mistakes += ::interlocked_hash_set_contains(s, reinterpret_cast<const void*>(hash_set_check_key(ti->producer, i))) ? 0 : 1;
+	}
+	for(size_t i(0); i < hash_set_check_keys; i += 2) {
+		const void* key = reinterpret_cast<const void*>(hash_set_check_key(ti->producer, i));
+		mistakes += ::interlocked_hash_set_delete(s, key) ? 0 : 1;
+		mistakes += ::interlocked_hash_set_delete(s, key) ? 1 : 0;
+	}
+	for(size_t i(0); i < hash_set_check_keys; ++i) {
+		const bool present = (i % 2) != 0;
+		mistakes += ::interlocked_hash_set_contains(s, reinterpret_cast<const void*>(hash_set_check_key(ti->producer, i))) == present ? 0 : 1;
+	}
+	for(size_t i(1); i < hash_set_check_keys; i += 2) {
+		mistakes += ::interlocked_hash_set_insert(s, reinterpret_cast<const void*>(hash_set_check_key(ti->producer, i))) ? 1 : 0;
+	}
+	size_t shared_deletes = 0;
+	for(size_t i(0); i < hash_set_check_keys; ++i) {
+		shared_deletes += ::interlocked_hash_set_delete(s, reinterpret_cast<const void*>(i + 1)) ? 1 : 0;
+	}
+	ti->mistakes = mistakes;
+	ti->shared_deletes = shared_deletes;
+	return 0;
+}
+
+void check_hash_set(size_t thread_count, size_t processor_count) {
+	interlocked_hash_set_t* s = ::new_interlocked_hash_set(&hash_key, &compare_keys, &null_destructor);
+	for(size_t i(0); i < hash_set_check_keys; ++i) {
+		::interlocked_hash_set_insert(s, reinterpret_cast<const void*>(i + 1));
+	}
+	std::vector<hash_set_check_thread_info> infos(thread_count);
+	for(size_t i(0); i < thread_count; ++i) {
+		infos[i].set = s;
+		infos[i].producer = i;
+		infos[i].mistakes = 0;
+		infos[i].shared_deletes = 0;
+	}
+	run_threads(infos, processor_count, &hash_set_check_thread_proc);
+
+	size_t mistakes = 0, shared_deletes = 0;
+	for(size_t i(0); i < thread_count; ++i) {
+		mistakes += infos[i].mistakes;
+		shared_deletes += infos[i].shared_deletes;
+	}
+	// what's left: none of the shared keys, and the odd half of everyone's own
+	for(size_t i(0); i < hash_set_check_keys; ++i) {
+		mistakes += ::interlocked_hash_set_contains(s, reinterpret_cast<const void*>(i + 1)) ? 1 : 0;
+	}
+	for(size_t t(0); t < thread_count; ++t) {
+		for(size_t i(0); i < hash_set_check_keys; ++i) {
+			const bool present = (i % 2) != 0;
+			mistakes += ::interlocked_hash_set_contains(s, reinterpret_cast<const void*>(hash_set_check_key(t, i))) == present ? 0 : 1;
+		}
+	}
+	::delete_interlocked_hash_set(s);
+	std::cout << "\tinterlocked_hash_set mistakes: " << mistakes << " shared keys deleted: " << shared_deletes << " of " << hash_set_check_keys
+	          << (mistakes == 0 && shared_deletes == hash_set_check_keys ? "" : " WRONG") << std::endl;
+}
+
+void check_hash_sets() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	const size_t thread_counts[] = { 1, processor_count * 2 };
+	for(size_t i(0); i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+		std::cout << "threads: " << thread_counts[i] << std::endl;
+		check_hash_set(thread_counts[i], processor_count);
+	}
+}
+
+void benchmark_hash_sets() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t max_threads = std::max(static_cast<size_t>(64), processor_count * 2);
+
+	for(size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+		std::cout << "threads: " << thread_count << std::endl;
+		report_hash_set_growth<interlocked_hash_set_traits      >(thread_count, processor_count);
+		report_hash_set_growth<non_blocking_unordered_map_traits>(thread_count, processor_count);
+	}
+}
+
+static const size_t deque_check_operations = 32 * 1024;
+static const size_t deque_check_rounds = 16;
+
+struct deque_check_thread_info {
+	size_t processor_id;
+	HANDLE begin;
+	interlocked_deque_t* deque;
+	bool owner;
+	std::atomic<bool>* done;
+	std::vector<size_t> taken;
+};
+
+// The owner pushes in bursts of up to a thousand or so, popping now and then,
+// and empties the deque by popping after every burst. Each fresh deque starts
+// small, so the early bursts grow it while the thieves are reading the old
+// array, and every emptying ends in a race with the thieves for the last
+// element.
+DWORD WINAPI deque_check_thread_proc(void* data) {
+	deque_check_thread_info* ti = static_cast<deque_check_thread_info*>(data);
+	::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << ti->processor_id);
+	unsigned __int64 state = (static_cast<unsigned __int64>(::GetCurrentThreadId()) * 0x9e3779b97f4a7c15ULL) | 1;
+	ti->taken.reserve(ti->owner ? deque_check_operations : deque_check_operations / 4);
+	::WaitForSingleObject(ti->begin, INFINITE);
+	void* v = nullptr;
+	if(!ti->owner) {
+		while(!ti->done->load()) {
+			if(::interlocked_deque_steal(ti->deque, &v)) {
+				ti->taken.push_back(reinterpret_cast<size_t>(v));
+			}
+		}
+		return 0;
+	}
+	size_t pushed = 0;
+	while(pushed < deque_check_operations) {
+		const size_t burst = std::min(static_cast<size_t>(next_key(state) % 1024) + 1, deque_check_operations - pushed);
+		for(size_t i(0); i < burst; ++i) {
+			::interlocked_deque_push(ti->deque, reinterpret_cast<void*>(++pushed));
+			if(next_key(state) % 4 == 0 && ::interlocked_deque_pop(ti->deque, &v)) {
+				ti->taken.push_back(reinterpret_cast<size_t>(v));
+			}
+			// let the thieves in partway through, so some are caught mid-steal
+			if(i % 64 == 63) {
+				::SwitchToThread();
+			}
+		}
+		while(::interlocked_deque_pop(ti->deque, &v)) {
+			ti->taken.push_back(reinterpret_cast<size_t>(v));
+		}
 	}
+	ti->done->store(true);
 	return 0;
 }
 
+// one owner and the rest thieves; everything pushed has to be taken exactly once
+void check_deque(size_t thread_count, size_t processor_count) {
+	size_t lost = 0, duplicated = 0, strays = 0, stolen = 0;
+	for(size_t round(0); round < deque_check_rounds; ++round) {
+		interlocked_deque_t* d = ::new_interlocked_deque(&null_destructor);
+		std::atomic<bool> done(false);
+		std::vector<deque_check_thread_info> infos(thread_count);
+		for(size_t i(0); i < thread_count; ++i) {
+			infos[i].deque = d;
+			infos[i].owner = i == 0;
+			infos[i].done = &done;
+		}
+		run_threads(infos, processor_count, &deque_check_thread_proc);
+		::delete_interlocked_deque(d);
+
+		std::vector<size_t> seen(deque_check_operations, 0);
+		for(size_t i(0); i < thread_count; ++i) {
+			for(size_t j(0); j < infos[i].taken.size(); ++j) {
+				const size_t value = infos[i].taken[j];
+				if(value == 0 || value > seen.size()) {
+					++strays;
+					continue;
+				}
+				++seen[value - 1];
+			}
+			if(!infos[i].owner) {
+				stolen += infos[i].taken.size();
+			}
+		}
+		const size_t round_lost = static_cast<size_t>(std::count(seen.begin(), seen.end(), 0));
+		lost += round_lost;
+		duplicated += seen.size() - round_lost - static_cast<size_t>(std::count(seen.begin(), seen.end(), 1));
+	}
+	std::cout << "\tinterlocked_deque lost: " << lost << " duplicated: " << duplicated << " strays: " << strays << " stolen: " << stolen
+	          << (lost == 0 && duplicated == 0 && strays == 0 ? "" : " WRONG") << std::endl;
+}
+
+void check_deques() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+	const size_t thread_count = std::max(static_cast<size_t>(4), processor_count * 2);
+
+	std::cout << "threads: " << thread_count << std::endl;
+	check_deque(thread_count, processor_count);
+}
+
+static unsigned __int64 serial_fib(unsigned int n) {
+	return n < 2 ? n : serial_fib(n - 1) + serial_fib(n - 2);
+}
+
+// every call that recurses spawns a task, so this is nothing but task overhead
+static void parallel_fib(utility::task_scheduler& s, unsigned int n, unsigned __int64* result) {
+	if(n < 2) {
+		*result = n;
+		return;
+	}
+	unsigned __int64 lhs = 0, rhs = 0;
+	utility::task_group g;
+	s.submit(g, [&s, n, &lhs]() { parallel_fib(s, n - 1, &lhs); });
+	parallel_fib(s, n - 2, &rhs);
+	s.wait(g);
+	*result = lhs + rhs;
+}
+
+static const ptrdiff_t quicksort_cutoff = 2048;
+
+static void parallel_quicksort(utility::task_scheduler& s, unsigned int* first, unsigned int* last) {
+	utility::task_group g;
+	while(last - first > quicksort_cutoff) {
+		unsigned int a = *first, b = first[(last - first) / 2], c = *(last - 1);
+		unsigned int pivot = std::max(std::min(a, b), std::min(std::max(a, b), c));
+		unsigned int* lower = std::partition(first, last, [pivot](unsigned int v) { return v < pivot; });
+		unsigned int* upper = std::partition(lower, last, [pivot](unsigned int v) { return !(pivot < v); });
+		s.submit(g, [&s, first, lower]() { parallel_quicksort(s, first, lower); });
+		first = upper;
+	}
+	std::sort(first, last);
+	s.wait(g);
+}
+
+static double seconds_since(const LARGE_INTEGER& start) {
+	LARGE_INTEGER frequency = { 0 };
+	LARGE_INTEGER end = { 0 };
+	::QueryPerformanceFrequency(&frequency);
+	::QueryPerformanceCounter(&end);
+	return static_cast<double>(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+}
+
+// The calling thread helps out while it waits, so "workers: 1" is really two
+// threads. Per-task overhead is the processor time the fork-join fib took,
+// less what the same calls cost serially, over the number of tasks.
+void benchmark_task_scheduler() {
+	::SYSTEM_INFO si = { 0 };
+	::GetSystemInfo(&si);
+	const size_t processor_count = si.dwNumberOfProcessors;
+
+	const unsigned int fib_n = 30;
+	const double fib_tasks = static_cast<double>(serial_fib(fib_n + 1) - 1);
+	LARGE_INTEGER start = { 0 };
+	::QueryPerformanceCounter(&start);
+	unsigned __int64 expected = serial_fib(fib_n);
+	const double serial_fib_seconds = seconds_since(start);
+
+	const size_t element_count = 8 * 1024 * 1024;
+	std::vector<unsigned int> original(element_count);
+	std::vector<unsigned int> elements(element_count);
+	{
+		utility::task_scheduler s;
+		s.parallel_for(0, element_count, 64 * 1024, [&original](size_t i) {
+			unsigned __int64 state = (static_cast<unsigned __int64>(i) + 1) * 0x9e3779b97f4a7c15ULL;
+			original[i] = static_cast<unsigned int>(next_key(state));
+		});
+	}
+	elements = original;
+	::QueryPerformanceCounter(&start);
+	std::sort(elements.begin(), elements.end());
+	const double serial_sort_seconds = seconds_since(start);
+
+	std::cout << "serial fib(" << fib_n << ") time: " << serial_fib_seconds << " std::sort of " << element_count << " time: " << serial_sort_seconds << std::endl;
+	for(size_t worker_count(1); worker_count <= processor_count; worker_count *= 2) {
+		utility::task_scheduler s(worker_count, true);
+		std::cout << "workers: " << worker_count << std::endl;
+
+		unsigned __int64 result = 0;
+		::QueryPerformanceCounter(&start);
+		utility::task_group g;
+		s.submit(g, [&s, fib_n, &result]() { parallel_fib(s, fib_n, &result); });
+		s.wait(g);
+		double seconds = seconds_since(start);
+		std::cout << "\tfib time: " << seconds << (result == expected ? "" : " WRONG")
+		          << " ns/task: " << ((seconds * static_cast<double>(worker_count) - serial_fib_seconds) * 1000000000.0) / fib_tasks << std::endl;
+
+		elements = original;
+		::QueryPerformanceCounter(&start);
+		parallel_quicksort(s, &elements[0], &elements[0] + element_count);
+		seconds = seconds_since(start);
+		std::cout << "\tquicksort time: " << seconds << (std::is_sorted(elements.begin(), elements.end()) ? "" : " UNSORTED")
+		          << " speedup: " << serial_sort_seconds / seconds << std::endl;
+	}
+}
+
 DWORD WINAPI test_thread(void*)
 {
 	for(int i = 0; i < 1; ++i)
@@ -196,66 +2507,32 @@ int main(int, char*[])
 	//_CrtSetBreakAlloc(161);
 	HANDLE test = CreateThread(nullptr, 0, &test_thread, nullptr, 0, nullptr);
 	WaitForSingleObject(test, INFINITE);
+	check_counters();
+	check_rw_locks();
+	check_queues();
+	check_depths();
+	check_deques();
+	check_object_pools();
+	check_priority_queues();
+	check_hash_sets();
+	check_kv_lists();
+	check_harris_lists();
+	check_scans();
+	check_backoff();
 goto end;
-	for(int j = 0; j < 1; ++j)
-	{
-		interlocked_counter = 0;
-		::SetPriorityClass(::GetCurrentProcess(), BELOW_NORMAL_PRIORITY_CLASS);
-
-		LARGE_INTEGER frequency = { 0 };
-		LARGE_INTEGER start = { 0 }, end = { 0 };
-		::QueryPerformanceFrequency(&frequency);
-
-		counter_t* counters = new (smr::smr) counter_t();
-		HANDLE begin = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
-
-		::SYSTEM_INFO si = { 0 };
-		::GetSystemInfo(&si);
-
-		const int load_multiplier = 4;
-		const int thread_count = load_multiplier * si.dwNumberOfProcessors;
-	
-		std::vector<HANDLE> threads(thread_count);
-		std::vector<thread_info> infos(thread_count);
-		for(int i(0); i < thread_count; ++i)
-		{
-			infos[i].processor_id = i;
-			infos[i].begin = begin;
-			infos[i].counters = counters;
-
-			threads[i] = ::CreateThread(nullptr, 0, &thread_proc, &infos[i], 0, nullptr);
-		}
-		::QueryPerformanceCounter(&start);
-		::SetEvent(begin);
-		::WaitForMultipleObjects(thread_count, &threads[0], TRUE, INFINITE);
-		::QueryPerformanceCounter(&end);
-		for(int i(0); i < thread_count; ++i)
-		{
-			::CloseHandle(threads[i]);
-		}
-		std::cout << "expected count: " << static_cast<unsigned __int64>(thread_count) * target << " actual count: " << counters->get() << " time: " << static_cast<double>(end.QuadPart - start.QuadPart) / frequency.QuadPart << std::endl;
-		::ResetEvent(begin);
-		for(int i(0); i < thread_count; ++i)
-		{
-			infos[i].processor_id = i;
-			infos[i].begin = begin;
-			infos[i].counters = counters;
-
-			threads[i] = ::CreateThread(nullptr, 0, &naive_thread_proc, &infos[i], 0, nullptr);
-		}
-		::QueryPerformanceCounter(&start);
-		::SetEvent(begin);
-		::WaitForMultipleObjects(thread_count, &threads[0], TRUE, INFINITE);
-		::QueryPerformanceCounter(&end);
-		for(int i(0); i < thread_count; ++i)
-		{
-			::CloseHandle(threads[i]);
-		}
-		std::cout << "expected count: " << static_cast<unsigned __int64>(thread_count) * target << " actual count: " << interlocked_counter << " time: " << static_cast<double>(end.QuadPart - start.QuadPart) / frequency.QuadPart << std::endl;
-
-		::CloseHandle(begin);
-		smr::smr_destroy(counters);
-	}
+	benchmark_counters();
+	benchmark_counter_groups();
+	benchmark_rw_locks();
+	benchmark_queues();
+	benchmark_stacks();
+	benchmark_object_pools();
+	benchmark_backoff();
+	benchmark_queue_latencies();
+	benchmark_priority_queues();
+	benchmark_ordered_maps();
+	benchmark_ordered_lists();
+	benchmark_hash_sets();
+	benchmark_task_scheduler();
 
 end:
 	smr::detail::smr_unsafe_full_clean();